@@ -0,0 +1,46 @@
+#include "frustum.h"
+
+void frustum_from_matrices(Frustum* f, const float projection[16], const float modelview[16])
+{
+    float clip[16];
+    int r, c, k;
+
+    /* clip = projection * modelview, both column-major */
+    for (c = 0; c < 4; c++) {
+        for (r = 0; r < 4; r++) {
+            clip[c*4 + r] = 0;
+            for (k = 0; k < 4; k++) {
+                clip[c*4 + r] += projection[k*4 + r] * modelview[c*4 + k];
+            }
+        }
+    }
+
+    /* Planes are sums and differences of the last clip matrix row with the others:
+     * -w <= x <= w, -w <= y <= w, -w <= z <= w */
+    for (k = 0; k < 3; k++) {
+        for (c = 0; c < 4; c++) {
+            f->planes[2*k][c] = clip[c*4 + 3] + clip[c*4 + k];
+            f->planes[2*k + 1][c] = clip[c*4 + 3] - clip[c*4 + k];
+        }
+    }
+}
+
+bool frustum_test_box(const Frustum* f, const float min[3], const float max[3])
+{
+    int k;
+
+    for (k = 0; k < 6; k++) {
+        const float* p = f->planes[k];
+
+        /* Box corner furthest along the plane normal */
+        float x = p[0] >= 0 ? max[0] : min[0];
+        float y = p[1] >= 0 ? max[1] : min[1];
+        float z = p[2] >= 0 ? max[2] : min[2];
+
+        if (p[0]*x + p[1]*y + p[2]*z + p[3] < 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,19 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <stdbool.h>
+
+/* View frustum given by six planes (a, b, c, d): a point p is inside the plane
+ * if a*p.x + b*p.y + c*p.z + d >= 0. Plane order: left, right, bottom, top, near, far */
+typedef struct frustum {
+    float planes[6][4];
+}   Frustum;
+
+/* Extracts frustum planes from column-major projection and modelview matrices.
+ * Planes are given in the coordinate frame the modelview matrix maps from */
+void frustum_from_matrices(Frustum* f, const float projection[16], const float modelview[16]);
+
+/* Returns false only if the axis aligned box [min, max] is completely outside the frustum */
+bool frustum_test_box(const Frustum* f, const float min[3], const float max[3]);
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "sim.h"
+#include "stream.h"
+#include "region.h"
+
+/* Headless driver: runs the game simulation without a window, with a simple
+ * wandering player, and reports how many ticks per second it manages.
+ * Whenever the player wins or dies, the outcome is counted and the player
+ * starts over from the starting position.
+ *
+ * Usage: headless [ticks [level_file [seed] | dimensions_file map_file connections_file [seed]]] */
+
+#define PI 3.14159265359
+
+/* Ticks the wandering player keeps one direction for */
+#define WANDER_TICKS 50
+
+/* Returns monotonic time in seconds */
+static double now();
+
+/* Returns size of the file in bytes, 0 if it can't be read */
+static double file_size(const char* file);
+
+int main(int argc, char** argv)
+{
+    SimState sim;
+    SimInput input = {0};
+
+    long ticks = argc > 1 ? atol(argv[1]) : 1000000;
+    bool level = argc == 3 || argc == 4;
+    const char* dimensions_file = argc > 4 ? argv[2] : "map_dimensions.txt";
+    const char* map_file = argc > 4 ? argv[3] : "map.txt";
+    const char* connections_file = argc > 4 ? argv[4] : "map_connections.txt";
+    const char* seed_argument = level ? (argc > 3 ? argv[3] : NULL) : (argc > 5 ? argv[5] : NULL);
+    unsigned seed = seed_argument != NULL ? (unsigned)atoi(seed_argument) : 1;
+
+    long t, won = 0, died = 0;
+    bool goal_reachable;
+    double start, seconds;
+    size_t map_bytes;
+
+    start = now();
+    if (level) {
+        sim_load_level(&sim, argv[2]);
+    } else {
+        sim_load(&sim, dimensions_file, map_file, connections_file);
+    }
+    seconds = now() - start;
+    if (level) {
+        printf("map loaded in %.1f ms\n", seconds * 1000);
+    } else {
+        double megabytes = (file_size(map_file) + file_size(connections_file)) / (1 << 20);
+
+        printf("map parsed in %.1f ms: %.1f MB, %.1f MB/s\n",
+               seconds * 1000, megabytes, megabytes / seconds);
+    }
+
+    /* First region query builds the index, apart from parsing */
+    start = now();
+    goal_reachable = sim_goal_reachable(&sim);
+    if (sim.regions != NULL) {
+        printf("regions built in %.1f ms\n", (now() - start) * 1000);
+    }
+
+    srand(seed);
+
+    input.forward = 1;
+    input.front[2] = -1;
+
+    start = now();
+    for (t = 0; t < ticks; t++) {
+        /* Turning to a random direction every now and then */
+        if (t % WANDER_TICKS == 0) {
+            float angle = 2 * PI * rand() / RAND_MAX;
+
+            input.front[0] = cos(angle);
+            input.front[2] = sin(angle);
+            input.teleport = true;
+        } else {
+            input.teleport = false;
+        }
+
+        sim_tick(&sim, &input, SIM_TICK);
+
+        if (sim.status != SIM_PLAYING) {
+            if (sim.status == SIM_WON) {
+                won++;
+            } else {
+                died++;
+            }
+
+            sim_respawn(&sim);
+        }
+    }
+    seconds = now() - start;
+
+    printf("%ld ticks in %.3f s: %.0f ticks/s (%.1fx real time)\n",
+           ticks, seconds, ticks / seconds, ticks * SIM_TICK / seconds);
+    printf("won %ld, died %ld, last position (%.2f, %.2f, %.2f)\n",
+           won, died, sim.position[0], sim.position[1], sim.position[2]);
+    if (sim.regions != NULL) {
+        printf("%d regions, goal %s from the start with doors closed\n",
+               sim.regions->region_count, goal_reachable ? "reachable" : "not reachable");
+    }
+
+    if (sim.stream != NULL) {
+        map_bytes = (size_t)sim.stream->slot_count * STREAM_CHUNK_SIZE * STREAM_CHUNK_SIZE
+                    * sizeof(FieldData) + (sim.link_mask + 1) * sizeof(SimLink);
+        printf("map %dx%d streamed: %zu bytes, %ld chunks loaded, %ld evicted, %ld stalls\n",
+               sim.rows, sim.cols, map_bytes, sim.stream->loads, sim.stream->evictions,
+               sim.stream->stalls);
+    } else {
+        map_bytes = sim.rows * sizeof(FieldData*) + (size_t)sim.rows * sim.cols * sizeof(FieldData)
+                    + (sim.link_mask + 1) * sizeof(SimLink);
+        printf("map %dx%d: %zu bytes, %.2f per cell\n",
+               sim.rows, sim.cols, map_bytes, (double)map_bytes / sim.rows / sim.cols);
+    }
+
+    sim_free(&sim);
+
+    return 0;
+}
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double file_size(const char* file)
+{
+    struct stat st;
+
+    return stat(file, &st) == 0 ? (double)st.st_size : 0;
+}
@@ -0,0 +1,110 @@
+#include "latency.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+/* Error-checking function. Used for technical C details */
+#define osAssert(condition, msg) osError(condition, msg)
+static void osError(bool condition, const char* msg)
+{
+    if (!condition) {
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Comparison of two samples, for sorting */
+static int compare_samples(const void* a, const void* b);
+
+void latency_init(LatencyLog* l)
+{
+    l->samples = NULL;
+    l->count = l->capacity = 0;
+    l->pending_count = 0;
+    l->dropped = 0;
+}
+
+double latency_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void latency_input(LatencyLog* l, double time, long tag)
+{
+    /* Keeping the newest events: a full list means frames stopped coming */
+    if (l->pending_count == LATENCY_PENDING) {
+        memmove(l->pending, l->pending + 1, (LATENCY_PENDING - 1) * sizeof(LatencyEvent));
+        l->pending_count--;
+        l->dropped++;
+    }
+
+    l->pending[l->pending_count].time = time;
+    l->pending[l->pending_count].tag = tag;
+    l->pending_count++;
+}
+
+void latency_frame(LatencyLog* l, double time, long tag)
+{
+    int k, done;
+
+    /* Events are in tag order, so the ones shown are at the front */
+    for (done = 0; done < l->pending_count && l->pending[done].tag <= tag; done++) {
+    }
+
+    if (l->count + done > l->capacity) {
+        l->capacity = 2 * (l->count + done);
+        l->samples = (double*)realloc(l->samples, l->capacity * sizeof(double));
+        osAssert(l->samples != NULL, "Allocating memory for latency samples failed\n");
+    }
+
+    for (k = 0; k < done; k++) {
+        l->samples[l->count++] = time - l->pending[k].time;
+    }
+
+    l->pending_count -= done;
+    memmove(l->pending, l->pending + done, l->pending_count * sizeof(LatencyEvent));
+}
+
+void latency_report(const LatencyLog* l, const char* name, FILE* f)
+{
+    static const double percentiles[] = {50, 90, 99, 99.9};
+    double* sorted = NULL;
+    int k;
+
+    if (l->count == 0) {
+        fprintf(f, "%s latency: no input events presented\n", name);
+        return;
+    }
+
+    sorted = (double*)malloc(l->count * sizeof(double));
+    osAssert(sorted != NULL, "Allocating memory for latency report failed\n");
+    memcpy(sorted, l->samples, l->count * sizeof(double));
+    qsort(sorted, l->count, sizeof(double), compare_samples);
+
+    fprintf(f, "%s latency of %d input events (%ld dropped):", name, l->count, l->dropped);
+    for (k = 0; k < (int)(sizeof(percentiles) / sizeof(percentiles[0])); k++) {
+        fprintf(f, " p%g %.1f ms", percentiles[k],
+                sorted[(int)(percentiles[k] / 100 * (l->count - 1))] * 1000);
+    }
+    fprintf(f, " max %.1f ms\n", sorted[l->count - 1] * 1000);
+
+    free(sorted);
+}
+
+void latency_free(LatencyLog* l)
+{
+    free(l->samples);
+    latency_init(l);
+}
+
+static int compare_samples(const void* a, const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
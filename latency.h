@@ -0,0 +1,48 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+
+/* Input-to-display latency log. Input events are timestamped and tagged as they
+ * come; when a frame is presented, every pending event with a tag up to the one
+ * the frame shows is done and its latency (presentation time minus event time)
+ * becomes a sample. Tags grow with events, so a frame always finishes the oldest
+ * pending ones. Events are in seconds of the monotonic clock */
+
+/* Events waiting for a frame. Older ones are dropped if more come between two frames */
+#define LATENCY_PENDING 1024
+
+typedef struct latency_event {
+    double time;
+    long tag;
+}   LatencyEvent;
+
+typedef struct latency_log {
+    double* samples;
+    int count, capacity;
+
+    LatencyEvent pending[LATENCY_PENDING];
+    int pending_count;
+    long dropped;
+}   LatencyLog;
+
+/* Initializes an empty log */
+void latency_init(LatencyLog* l);
+
+/* Returns monotonic time in seconds */
+double latency_now();
+
+/* Records input event with the given tag that came at the given time */
+void latency_input(LatencyLog* l, double time, long tag);
+
+/* Records frame presented at the given time, showing everything up to the given
+ * tag: pending events tagged up to it become samples */
+void latency_frame(LatencyLog* l, double time, long tag);
+
+/* Prints number of samples and their latency percentiles, under the given name */
+void latency_report(const LatencyLog* l, const char* name, FILE* f);
+
+/* Releases the log */
+void latency_free(LatencyLog* l);
+
+#endif
@@ -1,11 +1,25 @@
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
 #include <cglm/cglm.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <math.h>
+#include <string.h>
 #include <time.h>
 
+#include "mesh.h"
+#include "world_mesh.h"
+#include "frustum.h"
+#include "pvs.h"
+#include "teleport.h"
+#include "props.h"
+#include "render_queue.h"
+#include "tile_pool.h"
+#include "sim.h"
+#include "sim_thread.h"
+#include "latency.h"
+
 /* Error-checking function. Used for technical C details */
 #define osAssert(condition, msg) osError(condition, msg)
 void osError(bool condition, const char* msg) {
@@ -19,40 +33,38 @@ void osError(bool condition, const char* msg) {
 
 #define MAX_FILE_NAME 32
 
+/* Far plane distance, in cubes. Nothing further than this is drawn, which is
+ * also as far as visible sets reach */
+#define VIEW_DISTANCE PVS_RADIUS
+
+/* Distances (in cubes, scaled by lod_bias) where props and teleports switch
+ * to the next detail level. Past the last one props aren't drawn at all and
+ * teleports are drawn as their floor circle only */
+#define LOD_NEAR_DISTANCE 4
+#define LOD_MID_DISTANCE 8
+#define LOD_FAR_DISTANCE 14
+
+/* Detail level of objects that are beyond the far plane */
+#define LOD_SKIP -1
+
+/* Change of lod_bias on '+' and '-' keys */
+#define LOD_BIAS_STEP 0.25
+
 #define PI 3.14159265359
 #define EPS 0.01
 #define RAD_TO_DEG 180/PI
 #define DEG_TO_RAD PI/180
 
-#define GLOBAL_TIMER_ID 0
-#define TIMER_INTERVAL 20
-
-#define TELEPORT_TIMER_ID 1
-
-#define ELEVATOR_TIMER_ID_12 12
-#define ELEVATOR_TIMER_ID_58 58
-#define ELEVATOR_TIMER_ID_89 89
-#define ELEVATOR_TIMER_ID_25 25
-
-#define DOOR_TIMER_ID_18 18
-#define DOOR_TIMER_ID_27 27
-#define DOOR_TIMER_ID_41 41
-#define DOOR_TIMER_ID_86 86
-
-/* Structure that will keep data for every field cube. 
- * 1) type can be: 'w' - wall, 'l' - lava, 'd' - door, 'e' - elevator,
- *    'k' - key, 's' - switch, 'X' - goal, '@' - player starting position
- * 2) color can be: 'r' - red, 'g' - green, 'b' - blue, 'y' - yellow, 'o' - orange,
- *    'p' - purple, 'c' - cyan, 'm' - magenta. In case of teleports this is also the type
- * 3) to_row and to_col will store indexes in map matrix for teleport-teleport, 
- *    key-door and switch/elevator that are connected
- * 4) height stores height of the cube: 0 height means floor */
-typedef struct field {
-    char type;
-    char color;
-    int to_row, to_col;
-    int height;
-}   FieldData;
+/* Timer that looks for game changes while no frames are drawn, and reports
+ * statistics (CPU use included) when frames don't */
+#define WATCH_TIMER_ID 0
+#define WATCH_INTERVAL 100
+
+/* Timer that draws ambient animation (spinning keys and switches, teleports)
+ * while nothing else moves, at about 30 frames per second */
+#define AMBIENT_TIMER_ID 1
+#define AMBIENT_INTERVAL 33
+
 
 /* Height and width of the map */
 static int map_rows, map_cols;
@@ -66,69 +78,160 @@ const static char map_dimensions_file[MAX_FILE_NAME] = "map_dimensions.txt";
 /* Map connections and teleport colors file */
 const static char map_connections_file[MAX_FILE_NAME] = "map_connections.txt";
 
+/* Compiled level file given on the command line, used instead of the text files */
+static const char* level_file = NULL;
+
 /* Every part of the field is made of cube of fixed size.
  * All other objects' size are relative to this size */
-const static float CUBE_SIZE = 3.6;
+const static float CUBE_SIZE = SIM_CUBE_SIZE;
 
 /* Material component coeffs that will be updated by support function */
 static GLfloat coeffs[] = {0, 0, 0, 1};
 
-/* Main game matrix that will store basic info about every game cube */
+/* Materials of everything on the map, in drawing order. Walls hide most of
+ * the floor, so they go first and floor materials last among opaque ones.
+ * Teleports are last since they set their own (unlit) state and are blended */
+enum material {
+    MATERIAL_WALL,
+    MATERIAL_DOOR,
+    MATERIAL_ELEVATOR,
+    MATERIAL_KEY,
+    MATERIAL_SWITCH,
+    MATERIAL_GRASS,
+    MATERIAL_LAVA,
+    MATERIAL_TELEPORT,
+    MATERIAL_COUNT
+};
+
+/* Materials of static world meshes */
+static const int world_materials[WORLD_MATERIAL_COUNT] = {
+    [WORLD_GRASS] = MATERIAL_GRASS,
+    [WORLD_WALL] = MATERIAL_WALL,
+    [WORLD_LAVA] = MATERIAL_LAVA
+};
+
+/* Diffuse colors of lit materials */
+static const GLfloat material_colors[MATERIAL_TELEPORT][4] = {
+    [MATERIAL_GRASS] = {0.2, 0.7, 0.1, 1},
+    [MATERIAL_WALL] = {0.7, 0.5, 0.2, 1},
+    [MATERIAL_LAVA] = {0.9, 0.2, 0.1, 1},
+    [MATERIAL_DOOR] = {0.5, 0.2, 0.1, 1},
+    [MATERIAL_ELEVATOR] = {0.7, 0.7, 0.4, 1},
+    [MATERIAL_KEY] = {0.8, 0.8, 0, 1},
+    [MATERIAL_SWITCH] = {0.5, 0.5, 0.7, 1}
+};
+
+/* Draw submissions of the current frame, sorted by material and camera distance
+ * before drawing. Static world mesh m is submitted as object -1 - m, animated
+ * objects by their cell */
+static RenderQueue render_queue;
+
+/* Window title, the time it was last updated with frame statistics and
+ * frames drawn since then */
+static char* window_title = NULL;
+static int title_time = 0;
+static int title_frames = 0;
+
+/* Processor time the program used up to the last statistics update */
+static clock_t title_cpu = 0;
+
+/* Game ticks run up to the last statistics update */
+static long title_ticks = 0;
+
+/* Redraw requests made before the frame is drawn are merged into it. Frames are
+ * drawn back to back only while something in the game moves: player, or animated
+ * objects (animated_objects in the last frame). Ambient animation alone (ambient
+ * objects in the last frame) is drawn by the ambient timer; otherwise the next
+ * frame waits for input or for the watch timer to notice a change */
+static bool redisplay_pending = false;
+static int animated_objects = 0;
+static int ambient_objects = 0;
+static bool ambient_timer_pending = false;
+static vec3 drawn_position = {0, 0, 0};
+
+/* Occlusion query counting fragments drawn by create_map(). Overdraw is the
+ * number of drawn fragments per window pixel, from the last finished query */
+static GLuint overdraw_query = 0;
+static bool overdraw_query_pending = false;
+static float overdraw = 0;
+
+/* Game simulation and the input gathered for it. Once the map is loaded the
+ * simulation runs on its own thread; input is handed to it on every timer callback,
+ * after which one-shot actions (teleport, reset, hack-collecting) are cleared */
+static SimState sim;
+static SimInput sim_input;
+static SimThread sim_thread;
+
+/* Game as the current frame shows it: the newest snapshot from the simulation
+ * thread, interpolated to the time of the frame. All drawing reads this */
+static SimState view;
+
+/* Main game matrix that will store basic info about every game cube.
+ * It's owned by the simulation and read here for drawing */
 static FieldData** map = NULL;
 
-/* Global timer flag and parameter: global timer is always active */
-static bool global_timer_active = true;
-static float global_time_parameter = 0;
-
-/* Teleport timer flag and parameter: used for teleport animation */
-static float teleport_parameter = 0;
-static bool teleport_timer_active = true;
-
-/* Switch/Elevator flags and parameters: they are connected respectively */
-static bool has_switch_98 = false;
-static float elevator_parameter_12 = 0;
-static bool elevator_timer_12_active = false;
-
-static bool has_switch_44 = false;
-static float elevator_parameter_58 = 0;
-static bool elevator_timer_58_active = false;
-
-static bool has_switch_73 = false;
-static float elevator_parameter_89 = 0;
-static bool elevator_timer_89_active = false;
-
-static bool has_switch_77 = false;
-static float elevator_parameter_25 = 0;
-static bool elevator_timer_25_active = false;
-
-/* Key/Door flags and parameters: they are connected respectively */
-static bool has_key_99 = false;
-static float door_parameter_18 = 0;
-static bool door_timer_18_active = false;
-
-static bool has_key_23 = false;
-static float door_parameter_27 = 0;
-static bool door_timer_27_active = false;
-
-static bool has_key_11 = false;
-static float door_parameter_41 = 0;
-static bool door_timer_41_active = false;
-
-static bool has_key_71 = false;
-static float door_parameter_86 = 0;
-static bool door_timer_86_active = false;
+/* Static world geometry (grass, walls and lava), built once after the map is stored.
+ * World is split into chunks and only chunks inside the view frustum are drawn,
+ * with a single call per material */
+static World world;
+
+/* Indexes (i * map_cols + j) of cells holding animated objects: only these
+ * are still emitted every frame. They are grouped by chunk - chunk k owns
+ * dynamic_cells[dynamic_chunk_start[k]] up to dynamic_cells[dynamic_chunk_start[k + 1]] */
+static int* dynamic_cells = NULL;
+static int* dynamic_chunk_start = NULL;
+
+/* Chunks that passed culling in the current frame and their vertex ranges */
+static int* visible_chunks = NULL;
+static float* visible_depth = NULL;
+static GLint* visible_first = NULL;
+static GLsizei* visible_count = NULL;
+
+/* Potentially visible set of every walkable cell, if the level has one */
+static Pvs pvs;
+
+/* What one worker found culling its chunks: visible chunks with their
+ * camera distance, and animated objects to draw */
+typedef struct cull_list {
+    int* chunks;
+    float* depth;
+    int count;
+    RenderQueue items;
+}   CullList;
+
+/* Culling job of one frame: chunks in range are tiles, numbered row by row
+ * from (ci0, cj0) in rows of width chunks */
+typedef struct cull_job {
+    Frustum frustum;
+    PvsWindow window;
+    bool use_pvs;
+    int ci0, cj0, width;
+}   CullJob;
+
+/* Workers culling chunks of the frame in parallel, every one into its own list */
+static TilePool cull_pool;
+static CullList cull_lists[TILE_POOL_MAX_WORKERS];
+
+/* Teleport colors in palette order; the terminating '\0' stands for the default color */
+static const char teleport_colors[TELEPORT_COLORS] = "brgyompc";
+
+/* Teleports animated in a shader and drawn instanced, if available */
+static TeleportRenderer teleports;
+static bool teleport_shaders_active = false;
+
+/* Key and switch geometry, shared by all keys and switches */
+static PropCache props;
+
+/* Scale of detail level distances: lower values favour speed, higher quality */
+static float lod_bias = 1;
 
 /* Camera position, target and up vectors */
 static vec3 camera_pos = (vec3){0.0f, 0.0f, 3.0f};
 static vec3 camera_front = (vec3){0.0f, 0.0f, -1.0f};
 static vec3 camera_up = (vec3){0.0f, 1.0f, 0.0f};
 
-/* Camera direction and right vectors */
+/* Camera direction vector */
 static vec3 camera_direction;
-static vec3 camera_right;
-
-/* Camera speed (player movement speed) */
-static float camera_speed = 0.15f;
 
 /* Keyboard press indicators */
 static int v_forward = 0;
@@ -145,8 +248,22 @@ static int center_y = 300;
 /* Flag - false after mouse is catched for the first time */
 static bool first_mouse = true;
 
-/* Flag - becomes true once player starting position is initialized */
-static bool starting_player_position = false;
+/* Mouse movement since the last frame. Motion events only add up here;
+ * the camera turns once per frame, right before drawing */
+static float mouse_x_offset = 0;
+static float mouse_y_offset = 0;
+
+/* Latency mode (-l): input events and frame presentation are timestamped,
+ * and latency percentiles are printed on exit. Game input (keys the game takes)
+ * is tagged with its sequence and shows once a tick has taken it; mouse look and
+ * detail level keys are applied by the frame itself and show in the next one */
+static bool latency_mode = false;
+static LatencyLog game_latency;
+static LatencyLog look_latency;
+
+/* Sequence of the last game input event, and of the last one the drawn frame shows */
+static long input_sequence = 0;
+static long drawn_sequence = 0;
 
 /* Pitch and Yaw angles used for camera rotation */
 static float theta = 0; // [-89, 89] deg 
@@ -156,21 +273,83 @@ static float phi = 0;   // [0, 180) deg
 static void on_keyboard(unsigned char key, int x, int y);
 static void on_keyboard_release(unsigned char key, int x, int y);
 static void on_mouse_passive(int x, int y);
-static void on_timer(int value);
+static void on_idle(void);
+static void on_watch_timer(int value);
+static void on_ambient_timer(int value);
 static void on_reshape(int width, int height);
 static void on_display(void);
 
-/* Function that alocates space for map matrix */
-static FieldData** allocate_map();
+/* Turns the camera by the mouse movement gathered since the last frame */
+static void apply_mouse();
+
+/* Timestamps input event in latency mode: game input if game is true,
+ * otherwise input the next frame applies itself */
+static void log_input(bool game);
+
+/* Prints latency percentiles at exit */
+static void report_latency();
+
+/* Hands the input gathered so far to the simulation thread */
+static void send_input();
+
+/* Asks for a frame unless one is asked for already */
+static void request_redisplay();
+
+/* Draws frames back to back again, after input or a change in the game */
+static void wake_display();
+
+/* Returns true if the object on the cell moves with the game: running elevators
+ * and sinking doors */
+static bool is_animated_cell(int i, int j);
+
+/* Returns true if the object on the cell animates only for show: spinning keys
+ * and switches, and teleports */
+static bool is_ambient_cell(int i, int j);
+
+/* Function that bakes static map geometry into vertex buffers */
+static void create_static_world();
 
-/* Function that frees dymanicly allocated space for map matrix */
-static FieldData** free_map();
+/* Function that frees static map geometry */
+static void free_static_world();
 
-/* Function that stores cube types and their heights, pulled from a .txt file. */
-static void store_map_data();
+/* Computes map matrix position (i, j) of the cell under the camera.
+ * Returns false if the camera is outside the map */
+static bool get_player_cell(int* i, int* j);
 
-/* Function that stores map field connections and teleport colors */
-static void store_map_connections();
+/* Fills window with the PVS of the camera cell. Returns false if PVS can't be used */
+static bool camera_pvs(PvsWindow* window);
+
+/* Culls chunks near the camera on the worker pool: chunks that intersect the
+ * view frustum and hold some cell from the PVS of the camera cell are merged
+ * into visible_chunks, nearest first, and their number is returned. Animated
+ * objects to draw are left in cull_lists */
+static int cull_world(const Frustum* frustum);
+
+/* Culls one chunk (tile of the CullJob context) into the worker's list */
+static void cull_chunk(void* context, int worker, int tile);
+
+/* Returns squared distance between the camera and (x, y, z) of the map frame */
+static float camera_distance2(float x, float y, float z);
+
+/* Returns detail level of an object at (x, y, z) of the map frame,
+ * based on its distance from the camera, or LOD_SKIP if it's too far to be seen */
+static int select_lod(float x, float y, float z);
+
+/* Returns material of the animated object on the cell (i, j) */
+static int cell_material(int i, int j);
+
+/* Sets material for the following draw calls */
+static void apply_material(int material);
+
+/* Updates overdraw from the last finished occlusion query */
+static void read_overdraw();
+
+/* Shows frame and tick rate, material changes per frame (in submission order
+ * and sorted) and overdraw in the window title, at most twice per second */
+static void show_frame_statistics();
+
+/* Draws animated object on the cell (i, j) with the current material */
+static void create_dynamic_cell(int i, int j);
 
 /* Function that physically creates map in the game */
 static void create_map();
@@ -178,14 +357,11 @@ static void create_map();
 /* Basic GL/glut initialization */
 static void glut_initialize();
 
-/* Other initialization */
+/* Other initialization: loads the map and puts the camera on the starting position */
 static void other_initialize();
 
-/* Sets player starting position */
-static void set_player_starting_position(int i, int j);
-
-/* Handles player movement */
-static void player_movement();
+/* Ends the game if the player has won or died */
+static void check_game_status();
 
 /* Support function that sets diffuse coeffs in a global vector and calls glMaterialfv */
 static void set_diffuse(float r, float g, float b, float a);
@@ -193,14 +369,6 @@ static void set_diffuse(float r, float g, float b, float a);
 /* Support function that draws coordinate system */
 static void draw_axis();
 
-/* Support functions that draw cylinder */
-static void set_norm_vert_cylinder(float r, float phi, float h);
-static void draw_cylinder(float r, float h);
-
-/* Creates wall with the given cube size and height.
- * Wall is constructed of height cubes piled on each other. */
-static void create_wall(float cube_size, int height);
-
 /* Support function used for coloring */
 static void set_vector4f(GLfloat* vector, float r, float g, float b, float a); 
 
@@ -213,14 +381,21 @@ static bool check_key_inventory(int i, int j);
 /* If door has moved beyond minimal point, it's no longer rendered on the map */
 static bool check_door_moved(int i, int j);
 
-/* Support function that checks the player height position */
-static bool check_height(float min_height, float max_height); 
 
-/* Creates key of fixed size */
-static void create_key();
+/* Draws cached key geometry at the given detail level */
+static void create_key(int lod);
+
+/* Draws cached switch geometry at the given detail level */
+static void create_switch(int lod);
+
+/* Sets inner and outer floor circle color and line color of the teleport color */
+static void set_teleport_colors(char color, GLfloat* inner, GLfloat* outer, GLfloat* lines);
 
-/* Creates switch of fixed size */
-static void create_switch();
+/* Returns palette index of the teleport color */
+static int teleport_color_index(char color);
+
+/* Builds teleport palette and geometry for the shader based teleports */
+static void create_teleport_renderer();
 
 /* Creates teleport with the given color */
 static void create_teleport(float x, float y, float z, char color);
@@ -231,16 +406,6 @@ static void move_elevator(int i, int j, float e_height);
 /* Moves doors if their connected keys are gathered */
 static void move_door(int i, int j);
 
-/* Checking player position upon camera_pos changes: 
- * function checks map matrix type and renders proper effect */
-static void check_player_position();
-
-/* Support function that checks if player is positioned inside teleport circle */
-static bool check_inside_circle(int i, int j);
-
-/* Function that handles teleportation if player is on right position
- * and activates the teleport */
-static void check_teleportation();
 
 
 int main(int argc, char** argv)
@@ -257,14 +422,29 @@ int main(int argc, char** argv)
     GLfloat specular_coeffs[] = {0.3, 0.3, 0.3, 1};
     GLfloat shininess = 20;
 
+    int k;
+
     /* Basic GLUT initialization */
     glutInit(&argc, argv);
+    for (k = 1; k < argc; k++) {
+        if (strcmp(argv[k], "-l") == 0) {
+            latency_mode = true;
+        } else {
+            level_file = argv[k];
+        }
+    }
+    if (latency_mode) {
+        latency_init(&game_latency);
+        latency_init(&look_latency);
+        atexit(report_latency);
+    }
     glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
 
     /* Window settings */
     glutInitWindowSize(800, 600);
     glutInitWindowPosition(100, 100);
-    glutCreateWindow(argv[0]);
+    window_title = argv[0];
+    glutCreateWindow(window_title);
 
     /* Registrating glut callback functions */
     glutKeyboardFunc(on_keyboard);
@@ -295,20 +475,31 @@ int main(int argc, char** argv)
     glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, specular_coeffs);
     glMateriali(GL_FRONT_AND_BACK, GL_SHININESS, shininess);
 
-    /* Storing map data */
-    map = allocate_map();
-    store_map_data();
-    store_map_connections();
+    /* Baking static geometry */
+    create_static_world();
+    create_teleport_renderer();
+    prop_cache_build(&props, CUBE_SIZE);
+    render_queue_init(&render_queue, MATERIAL_TELEPORT);
+    glGenQueries(1, &overdraw_query);
 
-    /* Activating global timer and teleport animation */
-    glutTimerFunc(TIMER_INTERVAL, on_timer, GLOBAL_TIMER_ID);
-    glutTimerFunc(TIMER_INTERVAL, on_timer, TELEPORT_TIMER_ID);
+    /* Starting the game on its own thread. Frames are drawn whenever GLUT is idle,
+     * as fast as buffer swaps allow, and don't depend on the game's tick rate */
+    sim_thread_start(&sim_thread, &sim);
+    glutIdleFunc(on_idle);
+    glutTimerFunc(WATCH_INTERVAL, on_watch_timer, WATCH_TIMER_ID);
 
     /* Entering OpenGL main loop */
     glutMainLoop();
 
-    /* Freeing dynamicly allocated space for map */
-    map = free_map(map);
+    /* Freeing static geometry and dynamicly allocated space for map */
+    free_static_world();
+    teleport_renderer_free(&teleports);
+    prop_cache_free(&props);
+    render_queue_free(&render_queue);
+    glDeleteQueries(1, &overdraw_query);
+    sim_thread_stop(&sim_thread);
+    sim_free(&sim);
+    map = NULL;
 
     /* Finishing program */
     return 0;
@@ -321,69 +512,22 @@ static void on_keyboard(unsigned char key, int x, int y)
         exit(EXIT_SUCCESS);
     } 
     /* Cases '1' - '8' are optional, used for hack-collecting :) */
-    else if (key == '1') {
-        has_switch_98 = true;
-        glutPostRedisplay();
-    } else if (key == '2') {
-        has_switch_44 = true;
-        glutPostRedisplay();
-    } else if (key == '3') {
-        has_switch_73 = true;
-        glutPostRedisplay();
-    } else if (key == '4') {
-        has_switch_77 = true;
-        glutPostRedisplay();
-    } else if (key == '5') {
-        has_key_11 = true;
-        glutPostRedisplay();
-    } else if (key == '6') {
-        has_key_23 = true;
-        glutPostRedisplay();
-    } else if (key == '7') {
-        has_key_71 = true;
-        glutPostRedisplay();
-    } else if (key == '8') {
-        has_key_99 = true;
-        glutPostRedisplay();
+    else if (key >= '1' && key <= '8') {
+        sim_input.collect = key - '0';
     } else if (key == 'r' || key == 'R') {
         /* Reseting all parameters */
-        global_time_parameter = 0;
-
-        elevator_parameter_12 = 0;
-        elevator_parameter_25 = 0;
-        elevator_parameter_58 = 0;
-        elevator_parameter_89 = 0;
-
-        elevator_timer_12_active = false;
-        elevator_timer_25_active = false;
-        elevator_timer_58_active = false;
-        elevator_timer_89_active = false;
-
-        has_switch_44 = false;
-        has_switch_73 = false;
-        has_switch_77 = false;
-        has_switch_98 = false;
-
-        door_parameter_18 = 0;
-        door_parameter_27 = 0;
-        door_parameter_41 = 0;
-        door_parameter_86 = 0;
-
-        door_timer_18_active = false;
-        door_timer_27_active = false;
-        door_timer_41_active = false;
-        door_timer_86_active = false;
-
-        has_key_11 = false;
-        has_key_23 = false;
-        has_key_71 = false;
-        has_key_99 = false;
-
-        glutPostRedisplay();
+        sim_input.reset = true;
+    } else if (key == '+') {
+        /* Raising detail level distances */
+        lod_bias += LOD_BIAS_STEP;
+    } else if (key == '-') {
+        /* Lowering detail level distances */
+        if (lod_bias > LOD_BIAS_STEP) {
+            lod_bias -= LOD_BIAS_STEP;
+        }
     } else if (key == 't' || key == 'T') {
         /* Teleportation if player is in proper position */
-        check_teleportation();
-        glutPostRedisplay();
+        sim_input.teleport = true;
     } else if (key == 'w' || key == 'W') {
         /* Moving forward */
         v_forward = 1;
@@ -398,6 +542,8 @@ static void on_keyboard(unsigned char key, int x, int y)
         v_right = 1;
     }
 
+    log_input(key != '+' && key != '-');
+    wake_display();
 }
 
 static void on_keyboard_release(unsigned char key, int x, int y)
@@ -409,12 +555,13 @@ static void on_keyboard_release(unsigned char key, int x, int y)
         /* Stopping left/right movement */
         v_right = 0;
     }
+
+    log_input(true);
+    wake_display();
 }
 
 static void on_mouse_passive(int x, int y)
 {
-    /* NOTE: code taken from https://learnopengl.com/Getting-started/Camera */
-
     /* First mouse register */
     if (first_mouse) {
         first_mouse = false;
@@ -423,20 +570,31 @@ static void on_mouse_passive(int x, int y)
         return;
     }
 
-    /* Calculating mouse move */
-    float x_offset = x - last_x;
-    float y_offset = last_y - y;
+    /* Only adding the move up: the camera turns once per frame */
+    mouse_x_offset += x - last_x;
+    mouse_y_offset += last_y - y;
     last_x = x;
     last_y = y;
 
+    log_input(false);
+    wake_display();
+}
+
+static void apply_mouse()
+{
+    /* NOTE: code taken from https://learnopengl.com/Getting-started/Camera */
+
     /* Rescaling offsets to minimize camera rotations */
     float sensitivity = 0.5f;
-    x_offset *= sensitivity;
-    y_offset *= sensitivity;
+
+    if (mouse_x_offset == 0 && mouse_y_offset == 0) {
+        return;
+    }
 
     /* Calculating Euler yaw (phi) and pitch (theta) angles */
-    phi += x_offset;
-    theta += y_offset;
+    phi += mouse_x_offset * sensitivity;
+    theta += mouse_y_offset * sensitivity;
+    mouse_x_offset = mouse_y_offset = 0;
 
     /* Fixing camera rotation to 'sky' and 'floor' */
     if (theta >= 89) {
@@ -459,132 +617,105 @@ static void on_mouse_passive(int x, int y)
     glm_vec3_copy(front, camera_front);
 }
 
-static void on_timer(int value)
+static void log_input(bool game)
 {
-    /* Activating timer based on timer id */
-    if (value == GLOBAL_TIMER_ID) {
-
-        global_time_parameter += 1;
-
-        /* Since global tiemr is always active, player movement is handled here */
-        player_movement();
-
-        glutPostRedisplay();
-
-        check_player_position();
-
-        if (global_timer_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, GLOBAL_TIMER_ID);
-        }
-    } else if (value == TELEPORT_TIMER_ID) {
-
-        teleport_parameter += PI/90;
-
-        glutPostRedisplay();
-
-        if (teleport_timer_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, TELEPORT_TIMER_ID);
-        }
-    } else if (value == ELEVATOR_TIMER_ID_12) {
-
-        elevator_parameter_12 += PI/180;
-
-        glutPostRedisplay();
-
-        if (elevator_timer_12_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_12);
-        }
-    } else if (value == ELEVATOR_TIMER_ID_58) {
-
-        elevator_parameter_58 += PI/180;
-
-        glutPostRedisplay();
-
-        if (elevator_timer_58_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_58);
-        }
-    } else if (value == ELEVATOR_TIMER_ID_89) {
-
-        elevator_parameter_89 += PI/180;
-
-        glutPostRedisplay();
-
-        if (elevator_timer_89_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_89);
-        }
-    } else if (value == ELEVATOR_TIMER_ID_25) {
-
-        elevator_parameter_25 += PI/180;
-
-        glutPostRedisplay();
-
-        if (elevator_timer_25_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_25);
-        }
-    } else if (value == DOOR_TIMER_ID_18) {
+    if (!latency_mode) {
+        return;
+    }
 
-        door_parameter_18 += CUBE_SIZE / 60;
-        if (door_parameter_18 >= CUBE_SIZE + 0.1) {
-            door_parameter_18 = -1;
-            door_timer_18_active = false;
-        }
+    if (game) {
+        sim_input.sequence = ++input_sequence;
+        latency_input(&game_latency, latency_now(), input_sequence);
+    } else {
+        latency_input(&look_latency, latency_now(), 0);
+    }
+}
 
-        glutPostRedisplay();
+static void report_latency()
+{
+    latency_report(&game_latency, "keyboard", stdout);
+    latency_report(&look_latency, "mouse look", stdout);
+    latency_free(&game_latency);
+    latency_free(&look_latency);
+
+    /* Dropped ticks are time the game stood still, which latency alone doesn't show */
+    printf("game ran %ld ticks, dropped %ld\n",
+           atomic_load(&sim_thread.ticks), atomic_load(&sim_thread.dropped));
+}
 
-        if (door_timer_18_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_18);
-        }
-    } else if (value == DOOR_TIMER_ID_27) {
+static void on_idle(void)
+{
+    send_input();
+    check_game_status();
 
-        door_parameter_27 += CUBE_SIZE / 60;
-        if (door_parameter_27 >= CUBE_SIZE + 0.1) {
-            door_parameter_27 = -1;
-            door_timer_27_active = false;
-        }
+    /* Every frame shows the game interpolated to its own time */
+    request_redisplay();
+}
 
-        glutPostRedisplay();
+static void on_watch_timer(int value)
+{
+    if (value != WATCH_TIMER_ID) {
+        return;
+    }
 
-        if (door_timer_27_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_27);
-        }
-    } else if (value == DOOR_TIMER_ID_41) {
+    /* Game may change without input only through animations, which keep frames
+     * coming anyway; this catches anything else */
+    sim_thread_view(&sim_thread, &view);
+    check_game_status();
+    if (glm_vec3_distance(view.position, drawn_position) > 0) {
+        wake_display();
+    }
 
-        door_parameter_41 += CUBE_SIZE / 60;
-        if (door_parameter_41 >= CUBE_SIZE + 0.1) {
-            door_parameter_41 = -1;
-            door_timer_41_active = false;
-        }
+    show_frame_statistics();
+    glutTimerFunc(WATCH_INTERVAL, on_watch_timer, WATCH_TIMER_ID);
+}
 
-        glutPostRedisplay();
+static void on_ambient_timer(int value)
+{
+    if (value != AMBIENT_TIMER_ID) {
+        return;
+    }
 
-        if (door_timer_41_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_41);
-        }
-    } else if (value == DOOR_TIMER_ID_86) {
+    ambient_timer_pending = false;
+    request_redisplay();
+}
 
-        door_parameter_86 += CUBE_SIZE / 60;
-        if (door_parameter_86 >= CUBE_SIZE + 0.1) {
-            door_parameter_86 = -1;
-            door_timer_86_active = false;
-        }
+static void send_input()
+{
+    /* Game runs on its own thread at a fixed rate, measured on the monotonic
+     * clock: here it only gets the input gathered since the last hand-over */
+    sim_input.forward = v_forward;
+    sim_input.right = v_right;
+    glm_vec3_copy(camera_front, sim_input.front);
+    sim_thread_input(&sim_thread, &sim_input);
+
+    /* One-shot actions are handed over once */
+    sim_input.teleport = false;
+    sim_input.reset = false;
+    sim_input.collect = 0;
+}
 
+static void request_redisplay()
+{
+    if (!redisplay_pending) {
+        redisplay_pending = true;
         glutPostRedisplay();
-
-        if (door_timer_86_active) {
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_86);
-        }
-    } else {
-        return;
     }
 }
 
+static void wake_display()
+{
+    glutIdleFunc(on_idle);
+    request_redisplay();
+}
+
 static void on_reshape(int width, int height)
 {
     /* Setting view port and view perspective */
     glViewport(0, 0, width, height);
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
-    gluPerspective(60, (float)width / height, 1, 20*CUBE_SIZE);
+    gluPerspective(60, (float)width / height, 1, VIEW_DISTANCE*CUBE_SIZE);
 }
 
 static void glut_initialize()
@@ -610,137 +741,42 @@ static void other_initialize()
     // glm_vec3((vec3){0.0f, 8*CUBE_SIZE, 0.0f}, camera_pos);
     // glm_vec3((vec3){1.0f, 0.0f, -1.0f}, camera_front);
 
-    /* Scanning map dimensions */
-    FILE* f = fopen(map_dimensions_file, "r");
-    osAssert(f != NULL, "Error opening file \"map_dimensions.txt\"\n");
-
-    fscanf(f, "%d %d", &map_rows, &map_cols);
-    fclose(f);
-
-    /* Seeding time */
-    srand(time(NULL));
-}
-
-static void set_player_starting_position(int i, int j)
-{
-    /* Calculating center of the cube and proper height */
-    float x = j * CUBE_SIZE + CUBE_SIZE / 2;
-    float z = -(map_rows - 1 - i) * CUBE_SIZE - CUBE_SIZE / 2;
-    float y = map[i][j].height * CUBE_SIZE - CUBE_SIZE / 2;
-
-    /* Setting player position via global vectors */
-    glm_vec3((vec3){x, y, z}, camera_pos);
-    glm_vec3((vec3){0, 0, z - 1}, camera_front);
-}
-
-static void player_movement()
-{
-    /* Checking global movement indicators */
-    if (v_forward != 0) {
-        glm_vec3_muladds(camera_front, v_forward * camera_speed, camera_pos);
+    /* Storing map data */
+    if (level_file != NULL) {
+        sim_load_level(&sim, level_file);
+    } else {
+        sim_load(&sim, map_dimensions_file, map_input_file, map_connections_file);
     }
 
-    if (v_right != 0) {
-        glm_vec3_muladds(camera_right, v_right * camera_speed, camera_pos);
+    /* Static world is baked from the whole map, which a streamed level doesn't keep */
+    if (sim.map == NULL) {
+        fprintf(stderr, "%s is a streamed level: it can only be run by headless\n", level_file);
+        exit(EXIT_FAILURE);
     }
+    map = sim.map;
+    map_rows = sim.rows;
+    map_cols = sim.cols;
 
-    /* Calculating right vector and directional vector */
-    glm_vec3_crossn(camera_front, camera_up, camera_right);
+    /* Camera starts on the player starting position */
+    glm_vec3_copy(sim.position, camera_pos);
+    glm_vec3_copy(sim.front, camera_front);
     glm_vec3_add(camera_pos, camera_front, camera_direction);
-}
 
-static FieldData** allocate_map()
-{
-    FieldData** m = NULL;
-    int i;
-
-    /* Allocating row space */
-    m = (FieldData**)malloc(map_rows * sizeof(FieldData*));
-    osAssert(m != NULL, "Allocating memory for map matrix rows failed\n");
-
-    for(i = 0; i < map_rows; i++) {
-        /* Allocating column space */
-        m[i] = (FieldData*)malloc(map_cols * sizeof(FieldData));
-        if (m[i] == NULL) {
-            int j;
-            for (j = 0; j < i; j++)
-                free(m[j]);
-
-            free(m);
-
-            fprintf(stderr, "Allocating memory for one of map matrix columns failed.");
-            exit(EXIT_FAILURE);
-        }
-    }
-
-    return m;
-}
-
-static FieldData** free_map()
-{
-    int i;
-
-    /* Freeing column space */
-    for(i = 0; i < map_rows; i++)
-        free(map[i]);
-
-    /* Freeing row space */
-    free(map);
-
-    return NULL;
-}
-
-static void store_map_data()
-{
-    FILE* f = NULL;
-    int i, j;
-
-    /* Opening map file */
-    f = fopen(map_input_file, "r");
-    osAssert(f != NULL, "Error opening file \"map.txt\"\n");
-
-    for (i = 0; i < map_rows; i++) {
-        for (j = 0; j < map_cols; j++) {
-            fscanf(f, "%c%d ", &(*(map + i) + j)->type, &(*(map + i) + j)->height);
-            /* Connection coords are initially 0: they will be updated later */
-            map[i][j].to_row = map[i][j].to_col = 0;
-            /* Color is initially the same as type - works for teleport colors */
-            map[i][j].color = map[i][j].type;
-        }
-    }
-
-    fclose(f);
+    /* Seeding time */
+    srand(time(NULL));
 }
 
-static void store_map_connections()
+static void check_game_status()
 {
-    FILE* f = NULL;
-    int n, row1, row2, col1, col2, i;
-    char c;
-
-    /* Opening map connections file */
-    f = fopen(map_connections_file, "r");
-    osAssert(f != NULL, "Error opening file \"map_connections.txt\"\n");
-
-    fscanf(f, "%d", &n);
-    fgetc(f); // collecting '\n'
-
-    /* Scanning data */
-    for (i = 0; i < n; i++) {
-        fscanf(f, "%c %d %d %d %d ", &c, &row1, &col1, &row2, &col2);
-
-        /* Connecting teleports, key/doors and switch/elevators */
-        map[row1][col1].color = c;
-        map[row1][col1].to_row = row2;
-        map[row1][col1].to_col = col2;
-
-        /* And also backwards! */
-        map[row2][col2].color = c;
-        map[row2][col2].to_row = row1;
-        map[row2][col2].to_col = col1;
+    if (view.status == SIM_DIED) {
+        /* Player stepped on lava */
+        fprintf(stdout, "You died!\n");
+        exit(EXIT_SUCCESS);
+    } else if (view.status == SIM_WON) {
+        /* Player has reached white teleport */
+        fprintf(stdout, "YOU WON !!!\n");
+        exit(EXIT_SUCCESS);
     }
-
-    fclose(f);
 }
 
 static void set_diffuse(float r, float g, float b, float a)
@@ -773,71 +809,14 @@ static void draw_axis()
     glEnable(GL_LIGHTING);
 }
 
-static void set_norm_vert_cylinder(float r, float phi, float h)
-{
-    glNormal3f(r*sin(phi), h, r*cos(phi));
-    glVertex3f(r*sin(phi), h, r*cos(phi));
-}
-
-static void draw_cylinder(float r, float h)
-{
-    float phi;
-
-    /* Drawing cylinder strip by strip */
-    glBegin(GL_TRIANGLE_STRIP);
-    for (phi = 0; phi <= 2*PI + EPS; phi += PI/20) {
-        set_norm_vert_cylinder(r, phi, 0);
-        set_norm_vert_cylinder(r, phi, h);
-    }
-    glEnd();
-}
-
-static void create_wall(float cube_size, int height)
+static void create_key(int lod)
 {
-    int i;
-
-    glPushMatrix();
-        glTranslatef(0, -cube_size, 0);
-
-        /* Drawing wall cube by cube */
-        for (i = 1; i <= height; i++) {
-            glTranslatef(0, cube_size, 0);
-            glutSolidCube(cube_size);
-        }
-    glPopMatrix();
-}
-
-static void create_key()
-{
-    float body_radius = CUBE_SIZE / 40;
-    float body_height = CUBE_SIZE / 3;
-
-    /* Key torus part */
-    glPushMatrix();
-        glTranslatef(CUBE_SIZE / 15, 0, 0);
-        glutSolidTorus(body_radius, CUBE_SIZE / 12, 10, 20);
-    glPopMatrix();
-
-    /* Key body */
-    glPushMatrix();
-        glRotatef(90, 0, 0, 1);
-        draw_cylinder(body_radius, body_height);
-    glPopMatrix();
-
-    /* "Teeth" */
-    glPushMatrix();
-        glTranslatef(-CUBE_SIZE / 3.5, -CUBE_SIZE / 10, 0);
-        draw_cylinder(body_radius/1.5, body_height/3);
-
-        glTranslatef(CUBE_SIZE / 12, 0, 0);
-        draw_cylinder(body_radius/1.5, body_height/3);
-    glPopMatrix();
-    
+    prop_cache_draw(&props, PROP_KEY, lod);
 }
 
-static void create_switch()
+static void create_switch(int lod)
 {
-    draw_cylinder(CUBE_SIZE / 20, CUBE_SIZE / 2);
+    prop_cache_draw(&props, PROP_SWITCH, lod);
 }
 
 static void set_vector4f(GLfloat* vector, float r, float g, float b, float a) 
@@ -848,20 +827,8 @@ static void set_vector4f(GLfloat* vector, float r, float g, float b, float a)
     vector[3] = a;
 }
 
-static void create_teleport(float x, float y, float z, char color)
+static void set_teleport_colors(char color, GLfloat* inner, GLfloat* outer, GLfloat* lines)
 {
-    /* Reminder: (x,y,z) are the coordinates of the center of the cube */
-    float r = 0.8 * CUBE_SIZE / 2; // 80% of CUBE_SIZE / 2
-    float r_in = CUBE_SIZE / 3.2;
-    float line_height = 0.9 * CUBE_SIZE;
-    float angle_scale = 2.1;
-    float phi;
-
-    GLfloat inner[4];
-    GLfloat outer[4];
-    GLfloat lines[4];
-
-    /* Setting teleport color */
     switch (color) {
         case 'b':   
             set_vector4f(inner, 0, 0.3, 1, 1);             
@@ -909,6 +876,49 @@ static void create_teleport(float x, float y, float z, char color)
             set_vector4f(lines, 1, 1, 1, 0.9);
             break;
     }
+}
+
+static int teleport_color_index(char color)
+{
+    int k;
+
+    /* Last palette entry is the default (white) teleport */
+    for (k = 0; k < TELEPORT_COLORS - 1; k++) {
+        if (teleport_colors[k] == color) {
+            return k;
+        }
+    }
+
+    return TELEPORT_COLORS - 1;
+}
+
+static void create_teleport_renderer()
+{
+    TeleportPalette palette;
+    int k;
+
+    for (k = 0; k < TELEPORT_COLORS; k++) {
+        set_teleport_colors(teleport_colors[k], palette[k][0], palette[k][1], palette[k][2]);
+    }
+
+    teleport_shaders_active = teleport_renderer_init(&teleports, CUBE_SIZE, palette);
+}
+
+static void create_teleport(float x, float y, float z, char color)
+{
+    /* Reminder: (x,y,z) are the coordinates of the center of the cube */
+    float r = 0.8 * CUBE_SIZE / 2; // 80% of CUBE_SIZE / 2
+    float r_in = CUBE_SIZE / 3.2;
+    float line_height = 0.9 * CUBE_SIZE;
+    float angle_scale = 2.1;
+    float phi;
+
+    GLfloat inner[4];
+    GLfloat outer[4];
+    GLfloat lines[4];
+
+    /* Setting teleport color */
+    set_teleport_colors(color, inner, outer, lines);
 
     glDisable(GL_LIGHTING);
 
@@ -928,7 +938,7 @@ static void create_teleport(float x, float y, float z, char color)
     glLineWidth(1.6);
     glColor4fv(lines);
 
-    glRotatef(0.5 * teleport_parameter * RAD_TO_DEG, 0, 1, 0);
+    glRotatef(0.5 * sim_teleport_angle(&view) * RAD_TO_DEG, 0, 1, 0);
     for (phi = 0; phi <= 2*PI + EPS; phi += PI / 20) {
         glBegin(GL_LINES);
             glVertex3f(x  + r_in * sin(angle_scale*phi), 
@@ -944,7 +954,7 @@ static void create_teleport(float x, float y, float z, char color)
     glLineWidth(2.2);
     glColor4fv(lines);
 
-    glRotatef(-teleport_parameter * RAD_TO_DEG, 0, 1, 0);
+    glRotatef(-sim_teleport_angle(&view) * RAD_TO_DEG, 0, 1, 0);
     for (phi = 0; phi <= 2*PI + EPS; phi += PI / 20) {
         glBegin(GL_LINES);
             glVertex3f(x  + r * sin(phi), 
@@ -964,10 +974,10 @@ static void create_teleport(float x, float y, float z, char color)
     float ring_height = CUBE_SIZE / 24;
 
     glPushMatrix();
-        glRotatef(-global_time_parameter, 0, 1, 0);
+        glRotatef(-sim_time(&view), 0, 1, 0);
         for (v = ring_height; v <= line_height; v += 2*ring_height) {
             glTranslatef(0, 2*ring_height, 0);
-            glTranslatef(0, 0.005 * sin(teleport_parameter), 0);
+            glTranslatef(0, 0.005 * sin(sim_teleport_angle(&view)), 0);
             draw_cylinder(r, ring_height);
         }
     glPopMatrix();
@@ -978,484 +988,590 @@ static void create_teleport(float x, float y, float z, char color)
 
 static void move_elevator(int i, int j, float e_height)
 {
-    /* Amplitude - defines how far will elevator move */
-    float amp = 0;
-    /* Move parameter e [0, 1] and changes with time */
-    float move_param = 0;
-
-    /* Moving elevator on position (1, 2) */
-    if (has_switch_98 && i == 1 && j == 2) {
-        if (!elevator_timer_12_active) {
-            elevator_timer_12_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_12);
-        }
+    const SimElevator* e = sim_elevator(&view, i, j);
 
-        amp = (1 - e_height + EPS) * CUBE_SIZE;
-        move_param = (1 + sin(elevator_parameter_12 - PI/2)) / 2;
+    /* Moving elevator whose switch is gathered */
+    if (e != NULL && e->has_switch) {
+        /* Amplitude - defines how far will elevator move */
+        float amp = (e->levels - e_height + EPS) * CUBE_SIZE;
 
-        glTranslatef(0, amp * move_param, 0);
+        glTranslatef(0, amp * sim_elevator_height(&view, e), 0);
     }
+}
 
-    /* Moving elevator on position (5, 8) */
-    if (has_switch_44 && i == 5 && j == 8) {
-        if (!elevator_timer_58_active) {
-            elevator_timer_58_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_58);
-        }
+static bool check_switch_inventory(int i, int j)
+{
+    /* If the proper switch is gathered, switch won't be rendered */
+    return !sim_switch_gathered(&view, i, j);
+}
 
-        amp = (1 - e_height + EPS) * CUBE_SIZE;
-        move_param = (1 + sin(elevator_parameter_58 - PI/2)) / 2;
+static void move_door(int i, int j)
+{
+    const SimDoor* d = sim_door(&view, i, j);
 
-        glTranslatef(0, amp * move_param, 0);
+    /* Moving door whose key is gathered */
+    if (d != NULL && d->has_key) {
+        glTranslatef(0, -sim_door_offset(&view, d), 0);
     }
+}
 
-    /* Moving elevator on position (8, 9) */
-    if (has_switch_73 && i == 8 && j == 9) {
-        if (!elevator_timer_89_active) {
-            elevator_timer_89_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_89);
-        }
+static bool check_key_inventory(int i, int j)
+{
+    /* If the proper key is gathered, key won't be rendered */
+    return !sim_key_gathered(&view, i, j);
+}
+
+static bool check_door_moved(int i, int j)
+{
+    const SimDoor* d = sim_door(&view, i, j);
+
+    /* If door was moved, offset will be -1 and doors won't be rendered */
+    return d != NULL && sim_door_offset(&view, d) < 0;
+}
 
-        amp = (1 - e_height + EPS) * CUBE_SIZE;
-        move_param = (1 + sin(elevator_parameter_89 - PI/2)) / 2;
+static bool is_animated_cell(int i, int j)
+{
+    const SimDoor* d = NULL;
+    const SimElevator* e = NULL;
+
+    switch (map[i][j].type) {
+        case 'd':
+            d = sim_door(&view, i, j);
+            return d != NULL && d->has_key && !d->open;
+        case 'e':
+            e = sim_elevator(&view, i, j);
+            return e != NULL && e->has_switch;
+        default:
+            return false;
+    }
+}
 
-        glTranslatef(0, amp * move_param, 0);
+static bool is_ambient_cell(int i, int j)
+{
+    switch (map[i][j].type) {
+        case 'd':
+        case 'e':
+            return false;
+        case 'k':
+            return check_key_inventory(i, j);
+        case 's':
+            return check_switch_inventory(i, j);
+        default:
+            return true;
     }
+}
 
-    /* Moving elevator on position (2, 5) */
-    if (has_switch_77 && i == 2 && j == 5) {
-        if (!elevator_timer_25_active) {
-            elevator_timer_25_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, ELEVATOR_TIMER_ID_25);
+static bool get_player_cell(int* i, int* j)
+{
+    return sim_cell_at(&view, camera_pos[0], camera_pos[2], i, j);
+}
+
+static void create_static_world()
+{
+    int i, j, c, k, n;
+    int* top = NULL;
+    unsigned char* floor_material = NULL;
+
+    /* Column description passed to the mesher */
+    top = (int*)malloc(map_rows * map_cols * sizeof(int));
+    floor_material = (unsigned char*)malloc(map_rows * map_cols * sizeof(unsigned char));
+    osAssert(top != NULL && floor_material != NULL, "Allocating memory for world columns failed\n");
+
+    for (i = map_rows - 1; i >= 0; i--) {
+        for (j = 0; j < map_cols; j++) {
+            c = i * map_cols + j;
+
+            top[c] = sim_column_top(&sim, i, j);
+            floor_material[c] = map[i][j].type == 'l' ? WORLD_LAVA : WORLD_GRASS;
         }
+    }
+
+    /* Merging faces and moving everything to the GPU */
+    world_build(&world, top, floor_material, map_rows, map_cols, CUBE_SIZE);
+
+    free(top);
+    free(floor_material);
+
+    /* Visible sets of walkable cells come with a compiled level. Without them (a text
+     * map, a level compiled with mapc -n or with other PVS settings) chunks are culled
+     * with the view frustum only: computing them here would take longer than the
+     * culling saves on any map big enough for it to matter */
+    if (sim.level_pvs != NULL
+        && !pvs_map(&pvs, sim.level_pvs, sim.level_pvs_size, map_rows, map_cols,
+                    sim_object_headroom(&sim))) {
+        fprintf(stderr, "%s has PVS that can't be used: culling with the view frustum only\n",
+                level_file);
+    }
+
+    n = world.chunk_rows * world.chunk_cols;
+
+    dynamic_cells = (int*)malloc(map_rows * map_cols * sizeof(int));
+    dynamic_chunk_start = (int*)malloc((n + 1) * sizeof(int));
+    visible_chunks = (int*)malloc(n * sizeof(int));
+    visible_depth = (float*)malloc(n * sizeof(float));
+    visible_first = (GLint*)malloc(n * sizeof(GLint));
+    visible_count = (GLsizei*)malloc(n * sizeof(GLsizei));
+    osAssert(dynamic_cells != NULL && dynamic_chunk_start != NULL && visible_chunks != NULL
+             && visible_depth != NULL && visible_first != NULL && visible_count != NULL,
+             "Allocating memory for world chunk lists failed\n");
+
+    /* Every worker may find any chunk */
+    tile_pool_init(&cull_pool, 0);
+    for (k = 0; k < cull_pool.worker_count; k++) {
+        cull_lists[k].chunks = (int*)malloc(n * sizeof(int));
+        cull_lists[k].depth = (float*)malloc(n * sizeof(float));
+        cull_lists[k].count = 0;
+        osAssert(cull_lists[k].chunks != NULL && cull_lists[k].depth != NULL,
+                 "Allocating memory for culling lists failed\n");
+        render_queue_init(&cull_lists[k].items, MATERIAL_TELEPORT);
+    }
+
+    /* Grouping animated objects by chunk. Objects move above their cells,
+     * so chunk bounding boxes are raised to contain them */
+    c = 0;
+    for (k = 0; k < n; k++) {
+        WorldChunk* chunk = &world.chunks[k];
+
+        dynamic_chunk_start[k] = c;
 
-        amp = (2 - e_height + EPS) * CUBE_SIZE;
-        move_param = (1 + sin(elevator_parameter_25 - PI/2)) / 2;
+        for (i = chunk->i0; i < chunk->i1; i++) {
+            for (j = chunk->j0; j < chunk->j1; j++) {
+                if (sim_has_object(&sim, i, j)) {
+                    float y = (map[i][j].height + sim_object_reach(&sim, i, j) + 0.5) * CUBE_SIZE;
 
-        glTranslatef(0, amp * move_param, 0);
+                    if (y > chunk->max[1]) {
+                        chunk->max[1] = y;
+                    }
+
+                    dynamic_cells[c++] = i * map_cols + j;
+                }
+            }
+        }
     }
+    dynamic_chunk_start[n] = c;
 }
 
-static bool check_switch_inventory(int i, int j)
+static void free_static_world()
 {
-    /* If the proper switch is gathered, switch won't be rendered */
-    if (has_switch_44 && i == 4 && j == 4) {
-        return false;
-    } else if (has_switch_73 && i == 7 && j == 3) {
-        return false;
-    } else if (has_switch_77 && i == 7 && j == 7) {
-        return false;
-    } else if (has_switch_98 && i == 9 && j == 8) {
-        return false;
-    } else {
-        // Ignore
-    }
+    int k;
+
+    world_free(&world);
+    pvs_free(&pvs);
 
-    /* Default: no switches are gathered and they are all rendered */
-    return true;
+    for (k = 0; k < cull_pool.worker_count; k++) {
+        free(cull_lists[k].chunks);
+        free(cull_lists[k].depth);
+        render_queue_free(&cull_lists[k].items);
+    }
+    tile_pool_free(&cull_pool);
+
+    free(dynamic_cells);
+    free(dynamic_chunk_start);
+    free(visible_chunks);
+    free(visible_depth);
+    free(visible_first);
+    free(visible_count);
+
+    dynamic_cells = dynamic_chunk_start = visible_chunks = NULL;
+    visible_depth = NULL;
+    visible_first = NULL;
+    visible_count = NULL;
 }
 
-static void move_door(int i, int j)
+static int cull_world(const Frustum* frustum)
 {
-    /* Moving door on position (4, 1) */
-    if (has_key_11 && i == 4 && j == 1) {
-        if (!door_timer_41_active) {
-            door_timer_41_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_41);
-        }
+    CullJob job;
+    int ci0, ci1, cj0, cj1, k, c, n = 0;
+
+    /* Camera position in the map local frame, in cells */
+    float cam_j = (camera_pos[0] - CUBE_SIZE / 2) / CUBE_SIZE;
+    float cam_i = (camera_pos[2] + CUBE_SIZE / 2) / CUBE_SIZE + map_rows - 1;
+
+    /* Only chunks closer than the far plane can be visible, so the cost
+     * doesn't depend on the map size */
+    ci0 = (int)floor(cam_i - VIEW_DISTANCE + 0.5) / WORLD_CHUNK_SIZE;
+    ci1 = (int)floor(cam_i + VIEW_DISTANCE + 0.5) / WORLD_CHUNK_SIZE;
+    cj0 = (int)floor(cam_j - VIEW_DISTANCE + 0.5) / WORLD_CHUNK_SIZE;
+    cj1 = (int)floor(cam_j + VIEW_DISTANCE + 0.5) / WORLD_CHUNK_SIZE;
+
+    ci0 = ci0 < 0 ? 0 : ci0;
+    cj0 = cj0 < 0 ? 0 : cj0;
+    ci1 = ci1 >= world.chunk_rows ? world.chunk_rows - 1 : ci1;
+    cj1 = cj1 >= world.chunk_cols ? world.chunk_cols - 1 : cj1;
+
+    job.frustum = *frustum;
+    job.use_pvs = camera_pvs(&job.window);
+    job.ci0 = ci0;
+    job.cj0 = cj0;
+    job.width = cj1 - cj0 + 1;
+
+    for (k = 0; k < cull_pool.worker_count; k++) {
+        cull_lists[k].count = 0;
+        render_queue_clear(&cull_lists[k].items);
+    }
 
-        glTranslatef(0, -door_parameter_41, 0);
+    if (ci1 >= ci0 && cj1 >= cj0) {
+        tile_pool_run(&cull_pool, (ci1 - ci0 + 1) * job.width, cull_chunk, &job);
     }
-    
-    /* Moving door on position (2, 7) */
-    if (has_key_23 && i == 2 && j == 7) {
-        if (!door_timer_27_active) {
-            door_timer_27_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_27);
-        }
 
-        glTranslatef(0, -door_parameter_27, 0);
-    } 
-    
-    /* Moving door on position (8, 6) */
-    if (has_key_71 && i == 8 && j == 6) {
-        if (!door_timer_86_active) {
-            door_timer_86_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_86);
+    /* Merging lists by distance: there are only a few dozen chunks in range */
+    for (k = 0; k < cull_pool.worker_count; k++) {
+        for (c = 0; c < cull_lists[k].count; c++) {
+            float depth = cull_lists[k].depth[c];
+            int m = n++;
+
+            for (; m > 0 && visible_depth[m - 1] > depth; m--) {
+                visible_chunks[m] = visible_chunks[m - 1];
+                visible_depth[m] = visible_depth[m - 1];
+            }
+            visible_chunks[m] = cull_lists[k].chunks[c];
+            visible_depth[m] = depth;
         }
+    }
 
-        glTranslatef(0, -door_parameter_86, 0);
-    } 
-    
-    /* Moving door on position (1, 8) */
-    if (has_key_99 && i == 1 && j == 8) {
-        if (!door_timer_18_active) {
-            door_timer_18_active = true;
-            glutTimerFunc(TIMER_INTERVAL, on_timer, DOOR_TIMER_ID_18);
+    return n;
+}
+
+static void cull_chunk(void* context, int worker, int tile)
+{
+    const CullJob* job = (const CullJob*)context;
+    CullList* list = &cull_lists[worker];
+    int chunk = (job->ci0 + tile / job->width) * world.chunk_cols + job->cj0 + tile % job->width;
+    WorldChunk* w = &world.chunks[chunk];
+    bool seen = !job->use_pvs;
+    int i, j, c, i0, i1, j0, j1;
+
+    if (!frustum_test_box(&job->frustum, w->min, w->max)) {
+        return;
+    }
+
+    /* Chunk can be seen only if it holds some cell from the PVS, which is
+     * all inside the window */
+    if (job->use_pvs) {
+        i0 = w->i0 > job->window.i0 ? w->i0 : job->window.i0;
+        j0 = w->j0 > job->window.j0 ? w->j0 : job->window.j0;
+        i1 = w->i1 < job->window.i0 + job->window.rows ? w->i1 : job->window.i0 + job->window.rows;
+        j1 = w->j1 < job->window.j0 + job->window.cols ? w->j1 : job->window.j0 + job->window.cols;
+
+        for (i = i0; i < i1 && !seen; i++) {
+            for (j = j0; j < j1 && !seen; j++) {
+                seen = pvs_window_test(&job->window, i, j);
+            }
         }
+    }
+    if (!seen) {
+        return;
+    }
+
+    list->chunks[list->count] = chunk;
+    list->depth[list->count] = camera_distance2((w->min[0] + w->max[0]) / 2,
+                                                (w->min[1] + w->max[1]) / 2,
+                                                (w->min[2] + w->max[2]) / 2);
+    list->count++;
+
+    /* Animated objects of the chunk */
+    for (c = dynamic_chunk_start[chunk]; c < dynamic_chunk_start[chunk + 1]; c++) {
+        i = dynamic_cells[c] / map_cols;
+        j = dynamic_cells[c] % map_cols;
 
-        glTranslatef(0, -door_parameter_18, 0);
+        if (!job->use_pvs || pvs_window_test(&job->window, i, j)) {
+            float depth = camera_distance2(j * CUBE_SIZE, map[i][j].height * CUBE_SIZE,
+                                           -(map_rows - 1 - i) * CUBE_SIZE);
+
+            render_queue_push(&list->items, cell_material(i, j), dynamic_cells[c], depth);
+        }
     }
 }
 
-static bool check_key_inventory(int i, int j)
+static bool camera_pvs(PvsWindow* window)
 {
-    /* If the proper key is gathered, key won't be rendered */
-    if (has_key_11 && i == 1 && j == 1) {
-        return false;
-    } else if (has_key_23 && i == 2 && j == 3) {
-        return false;
-    } else if (has_key_71 && i == 7 && j == 1) {
-        return false;
-    } else if (has_key_99 && i == 9 && j == 9) {
-        return false;
-    } else {
-        // Ignore
-    }
+    int i, j;
 
-    /* Default: no keys are gathered and they are all rendered */
-    return true;
+    /* PVS holds only for eye positions up to one cube above the floor of a walkable cell */
+    return get_player_cell(&i, &j) && pvs_window(&pvs, i, j, window)
+           && camera_pos[1] <= (sim_column_top(&view, i, j) + 1) * CUBE_SIZE;
 }
 
-static bool check_door_moved(int i, int j)
+static float camera_distance2(float x, float y, float z)
 {
-    /* If door was moved, parameter will be -1 and doors won't be rendered */
-    if (door_parameter_18 < 0 && i == 1 && j == 8) {
-        return true;
-    } else if (door_parameter_27 < 0 && i == 2 && j == 7) {
-        return true;
-    } else if (door_parameter_41 < 0 && i == 4 && j == 1) {
-        return true;
-    } else if (door_parameter_86 < 0 && i == 8 && j == 6) {
-        return true;
-    } else {
-        // Ignore
-    }
+    /* Map frame is moved by (CUBE_SIZE/2, -CUBE_SIZE/2, -CUBE_SIZE/2) from the world */
+    float dx = x + CUBE_SIZE / 2 - camera_pos[0];
+    float dy = y - CUBE_SIZE / 2 - camera_pos[1];
+    float dz = z - CUBE_SIZE / 2 - camera_pos[2];
 
-    /* Default: doors haven't moved and are all rendered */
-    return false;
+    return dx*dx + dy*dy + dz*dz;
 }
 
-static bool check_height(float min_height, float max_height) 
+static int select_lod(float x, float y, float z)
 {
-    /* Player height validation */
-    if (camera_pos[1] >= min_height && camera_pos[1] <= max_height) {
-        return true;
-    } else {
-        return false;
+    float d = sqrt(camera_distance2(x, y, z)) / (CUBE_SIZE * lod_bias);
+
+    if (d < LOD_NEAR_DISTANCE) {
+        return 0;
+    } else if (d < LOD_MID_DISTANCE) {
+        return 1;
+    } else if (d < LOD_FAR_DISTANCE) {
+        return 2;
+    } else if (d * lod_bias < VIEW_DISTANCE) {
+        return 3;
     }
+
+    return LOD_SKIP;
 }
 
-static void check_player_position()
+static void create_dynamic_cell(int i, int j)
 {
-    int i, j, tmp;
-    float min_height, max_height;
+    float elevator_scale_factor = 0.15;
 
-    tmp = map_rows + camera_pos[2] / CUBE_SIZE;
+    /* Special factor that fixes the elevator position since scaling
+     * will cause the elevator to float in space */
+    float e_scale_move_factor = 0.8 * elevator_scale_factor * CUBE_SIZE * CUBE_SIZE;
 
-    /* Map matrix positions */
-    i = tmp > 10 ? 10 : tmp; // Row 10 bug fix
-    j = camera_pos[0] / CUBE_SIZE;
+    /* x and z coordinates of the CENTER of the cube */
+    float x = j*CUBE_SIZE;
+    float z = -(map_rows - 1 - i) * CUBE_SIZE;
 
-    /* Setting up height interval used for proper height detection */
-    min_height = (map[i][j].height - 1) * CUBE_SIZE + CUBE_SIZE / 3;
-    max_height = map[i][j].height * CUBE_SIZE + CUBE_SIZE / 2;
+    int lod = select_lod(x, map[i][j].height * CUBE_SIZE, z);
+    if (lod == LOD_SKIP) {
+        return;
+    }
 
-    /* If player steps on lava, he dies */
-    if (map[i][j].type == 'l' && check_height(min_height, max_height + CUBE_SIZE / 3)) {
-        fprintf(stdout, "You died!\n");
-        exit(EXIT_SUCCESS);
-    } else if (map[i][j].type == 'k' && check_height(min_height, max_height)) {
-        /* Collecting proper key */
-        if (i == 1 && j == 1) {
-            has_key_11 = true;
-        } else if (i == 2 && j == 3) {
-            has_key_23 = true;
-        } else if (i == 7 && j == 1) {
-            has_key_71 = true;
-        } else if (i == 9 && j == 9) {
-            has_key_99 = true;
-        } else {
-            // Ignore
-        }
-    } else if (map[i][j].type == 's' && check_height(min_height, max_height)) {
-        /* Collecting proper switch */
-        if (i == 4 && j == 4) {
-            has_switch_44 = true;
-        } else if (i == 7 && j == 3) {
-            has_switch_73 = true;
-        } else if (i == 7 && j == 7) {
-            has_switch_77 = true;
-        } else if ( i == 9 && j == 8) {
-            has_switch_98 = true;
-        } else {
-            // Ignore
-        }
-    } else if (map[i][j].type == 'X' && check_height(min_height, max_height - CUBE_SIZE / 2) 
-        && check_inside_circle(i, j)) {
-        /* Player has reached white teleport - he wins the game! */
-        fprintf(stdout, "YOU WON !!!\n");
-        exit(EXIT_SUCCESS);
-    } else {
-        // Ignore
+    switch (map[i][j].type) {
+        /* Door case */
+        case 'd':
+            if (!check_door_moved(i, j)) {
+                glPushMatrix();
+                    glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
+
+                    move_door(i, j);
+
+                    glutSolidCube(CUBE_SIZE);
+                glPopMatrix();
+            }
+            break;
+
+        /* Elevator case */
+        case 'e':
+            glPushMatrix();
+                glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
+                glTranslatef(0, -e_scale_move_factor, 0);
+
+                move_elevator(i, j, elevator_scale_factor);
+
+                glScalef(1, elevator_scale_factor, 1);
+                glutSolidCube(CUBE_SIZE);
+            glPopMatrix();
+            break;
+
+        /* Key case */
+        case 'k':
+            if (check_key_inventory(i, j) && lod < PROP_LOD_COUNT) {
+                glPushMatrix();
+                    glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
+
+                    glTranslatef(0, CUBE_SIZE / 5 * sin(2 * sim_time(&view) * DEG_TO_RAD), 0);
+                    glRotatef(-sim_time(&view) * 2, 0, 1, 0);
+
+                    create_key(lod);
+                glPopMatrix();
+            }
+            break;
+
+        /* Switch case */
+        case 's':
+            if (check_switch_inventory(i, j) && lod < PROP_LOD_COUNT) {
+                glPushMatrix();
+                    glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
+                    glTranslatef(0, - CUBE_SIZE / 2.5, 0);
+
+                    /* Rotating switch around y-axis */
+                    glRotatef(sim_time(&view) * 2, 0, 1, 0);
+
+                    glRotatef(-25, 0, 0, 1);
+                    create_switch(lod);
+                glPopMatrix();
+            }
+            break;
+
+        /* Teleport case: queued and drawn together with all other teleports */
+        default:
+            if (teleport_shaders_active) {
+                teleport_renderer_add(&teleports, x, map[i][j].height*CUBE_SIZE - CUBE_SIZE/2 + EPS,
+                                      z, teleport_color_index(map[i][j].color), lod);
+                break;
+            }
+
+            glPushMatrix();
+                glTranslatef(x, map[i][j].height*CUBE_SIZE, z);
+
+                /* Teleport floating effect fix */
+                glTranslatef(0, -CUBE_SIZE/2 + EPS, 0);
+
+                create_teleport(0, 0, 0, map[i][j].color);
+            glPopMatrix();
+            break;
     }
+}
 
+static int cell_material(int i, int j)
+{
+    switch (map[i][j].type) {
+        case 'd':
+            return MATERIAL_DOOR;
+        case 'e':
+            return MATERIAL_ELEVATOR;
+        case 'k':
+            return MATERIAL_KEY;
+        case 's':
+            return MATERIAL_SWITCH;
+        default:
+            return MATERIAL_TELEPORT;
+    }
 }
 
-static bool check_inside_circle(int i, int j)
+static void apply_material(int material)
 {
-    /* Coordinates of the center of the cube */
-    float x_center = j * CUBE_SIZE + CUBE_SIZE / 2;
-    float z_center = -(map_rows - 1 - i) * CUBE_SIZE - CUBE_SIZE / 2;
+    /* Teleports disable lighting themselves. They are blended and sorted
+     * back-to-front, so they don't need to write depth */
+    if (material == MATERIAL_TELEPORT) {
+        glDepthMask(GL_FALSE);
+        return;
+    }
 
-    /* Player current position */
-    float x_player = camera_pos[0];
-    float z_player = camera_pos[2];
+    set_diffuse(material_colors[material][0], material_colors[material][1],
+                material_colors[material][2], material_colors[material][3]);
+}
 
-    /* Teleport inner radius, squared */
-    float r_in_square = (0.75 * CUBE_SIZE / 2) * (0.75 * CUBE_SIZE / 2);
+static void read_overdraw()
+{
+    GLuint available, samples;
+    int pixels = glutGet(GLUT_WINDOW_WIDTH) * glutGet(GLUT_WINDOW_HEIGHT);
 
-    /* Player distance, squared */
-    float d_square = (x_player - x_center) * (x_player - x_center) 
-                   + (z_player - z_center) * (z_player - z_center);
+    if (!overdraw_query_pending) {
+        return;
+    }
 
-    return d_square <= r_in_square ? true : false;
+    /* Waiting for the result would stall the pipeline, so it's skipped until ready */
+    glGetQueryObjectuiv(overdraw_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+        return;
+    }
+
+    glGetQueryObjectuiv(overdraw_query, GL_QUERY_RESULT, &samples);
+    overdraw_query_pending = false;
+    overdraw = pixels > 0 ? (float)samples / pixels : 0;
 }
 
-static void check_teleportation()
+static void show_frame_statistics()
 {
-    int i, j, tmp;
-    float min_height, max_height;
-
-    tmp = map_rows + camera_pos[2] / CUBE_SIZE;
-
-    /* Map matrix positions */
-    i = tmp > 10 ? 10 : tmp; // Row 10 bug fix
-    j = camera_pos[0] / CUBE_SIZE;
-
-    /* Setting up height interval used for proper inside-teleport height detection */
-    min_height = (map[i][j].height - 1) * CUBE_SIZE + CUBE_SIZE / 3;
-    max_height = map[i][j].height * CUBE_SIZE;
-
-    /* Checking player position map type. If teleport, teleports player to proper position */
-    if ( (map[i][j].type == 'g' || map[i][j].type == 'b' || map[i][j].type == 'p'
-         || map[i][j].type == 'r' || map[i][j].type == 'm' || map[i][j].type == 'c'
-         || map[i][j].type == 'y' || map[i][j].type == 'o') 
-         && check_inside_circle(i, j) && check_height(min_height, max_height) )
-    {
-        int to_row = map[i][j].to_row;
-        int to_col = map[i][j].to_col;
-
-        /* Calculating next player position via map matrix data (to_row and to_col values) */
-        float to_x = to_col * CUBE_SIZE + CUBE_SIZE / 2;
-        float to_z = -(map_rows - 1 - to_row) * CUBE_SIZE - CUBE_SIZE / 2;
-        float to_height = (map[to_row][to_col].height - 1) * CUBE_SIZE + CUBE_SIZE / 2;
-
-        /* Updating player position vector */
-        glm_vec3((vec3){to_x, to_height, to_z}, camera_pos);
+    char title[256];
+    int time = glutGet(GLUT_ELAPSED_TIME);
+    clock_t cpu = clock();
+    long ticks = atomic_load(&sim_thread.ticks);
+    float frame_rate, cpu_use, tick_rate;
+
+    if (time - title_time < 500) {
+        return;
     }
+
+    /* Processor time of all threads, as a share of one processor */
+    frame_rate = title_frames * 1000.0f / (time - title_time);
+    cpu_use = 100.0f * (cpu - title_cpu) / CLOCKS_PER_SEC * 1000 / (time - title_time);
+    tick_rate = (ticks - title_ticks) * 1000.0f / (time - title_time);
+    title_time = time;
+    title_frames = 0;
+    title_cpu = cpu;
+    title_ticks = ticks;
+
+    snprintf(title, sizeof(title),
+             "%s - %.0f fps, %.0f%% CPU - %.0f ticks/s, %ld dropped"
+             " - material changes per frame: %d unsorted, %d sorted - overdraw: %.2f",
+             window_title, frame_rate, cpu_use, tick_rate, atomic_load(&sim_thread.dropped),
+             render_queue.unsorted_changes, render_queue.sorted_changes, overdraw);
+    glutSetWindowTitle(title);
 }
 
 static void create_map()
 {
-    int i, j;
+    int c, k, m, n;
 
-    float elevator_scale_factor = 0.15;
-
-    /* Special factor that fixes the elevator position since scaling
-     * will cause the elevator to float in space */
-    float e_scale_move_factor = 0.8 * elevator_scale_factor * CUBE_SIZE * CUBE_SIZE;
+    GLfloat projection[16], modelview[16];
+    Frustum frustum;
 
     glPushMatrix();
 
         glTranslatef(CUBE_SIZE / 2, - CUBE_SIZE / 2, - CUBE_SIZE / 2);
 
-        for (i = map_rows - 1; i >= 0; i--) {
-            for (j = 0; j < map_cols; j++) {
-
-                /* x and z coordinates of the CENTER of the cube */
-                float x = j*CUBE_SIZE;
-                float z = -(map_rows - 1 - i) * CUBE_SIZE;
-
-                switch (map[i][j].type) {
-                    /* Wall case */
-                    case 'w':
-                        /* Grass */
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.2, 0.7, 0.1, 1);
-                            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, coeffs);
-                            glutSolidCube(CUBE_SIZE);
-
-                        /* Wall */
-                        if (map[i][j].height != 0) {
-                            glTranslatef(0, CUBE_SIZE, 0);
-                            set_diffuse(0.7, 0.5, 0.2, 1);                           
-                            create_wall(CUBE_SIZE, map[i][j].height);
-                        }
-
-                        glPopMatrix();
-                        break;
-
-                    /* Lava case - always with 0 height*/
-                    case 'l':
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.9, 0.2, 0.1, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        glPopMatrix();
-                        break;
-
-                    /* Door case */
-                    case 'd':
-                        /* Grass and wall */
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.2, 0.7, 0.1, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        
-                            glTranslatef(0, CUBE_SIZE, 0);
-                            set_diffuse(0.7, 0.5, 0.2, 1);                           
-                            create_wall(CUBE_SIZE, map[i][j].height - 1);
-                        glPopMatrix();
-
-                        /* Door */
-                        if (!check_door_moved(i, j)) {
-                            glPushMatrix();
-                                glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
-
-                                move_door(i, j);
-
-                                set_diffuse(0.5, 0.2, 0.1, 1);
-                                glutSolidCube(CUBE_SIZE);
-                            glPopMatrix();
-                        }
-                        break;
-
-                    /* Elevator case */
-                    case 'e':
-                        /* Grass and wall */
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.2, 0.7, 0.1, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        
-                            glTranslatef(0, CUBE_SIZE, 0);
-                            set_diffuse(0.7, 0.5, 0.2, 1);                           
-                            create_wall(CUBE_SIZE, map[i][j].height - 1);
-                        glPopMatrix();
-
-                        /* Elevator */
-                        glPushMatrix();
-                            glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
-                            glTranslatef(0, -e_scale_move_factor, 0);
-
-                            move_elevator(i, j, elevator_scale_factor);
-
-                            glScalef(1, elevator_scale_factor, 1);
-                            set_diffuse(0.7, 0.7, 0.4, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        glPopMatrix();
-                        break;
-
-                    /* Key case */
-                    case 'k':
-                        /* Grass and wall */
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.2, 0.7, 0.1, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        
-                            glTranslatef(0, CUBE_SIZE, 0);
-                            set_diffuse(0.7, 0.5, 0.2, 1);                           
-                            create_wall(CUBE_SIZE, map[i][j].height - 1);
-                        glPopMatrix();
-
-                        /* Key */
-                        if (check_key_inventory(i, j)) {
-                            glPushMatrix();
-                                glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
-                                set_diffuse(0.8, 0.8, 0, 1);
-
-                                glTranslatef(0, CUBE_SIZE / 5 * sin(2 * global_time_parameter * DEG_TO_RAD), 0);
-                                glRotatef(-global_time_parameter * 2, 0, 1, 0);
-
-                                create_key();
-                            glPopMatrix();
-                        }
-                        break;
-
-                    /* Switch case */
-                    case 's':
-                        /* Grass and wall */
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.2, 0.7, 0.1, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        
-                            glTranslatef(0, CUBE_SIZE, 0);
-                            set_diffuse(0.7, 0.5, 0.2, 1);                           
-                            create_wall(CUBE_SIZE, map[i][j].height - 1);
-                        glPopMatrix();
-
-                        /* Switch */
-                        if (check_switch_inventory(i, j)) {
-                            glPushMatrix();
-                                glTranslatef(x, map[i][j].height * CUBE_SIZE, z);
-                                glTranslatef(0, - CUBE_SIZE / 2.5, 0);
-
-                                /* Rotating switch around y-axis */
-                                glRotatef(global_time_parameter * 2, 0, 1, 0);
-
-                                glRotatef(-25, 0, 0, 1);
-                                set_diffuse(0.5, 0.5, 0.7, 1);
-                                create_switch();
-                            glPopMatrix();
-                        }
-                        break;
-
-                    case '@':
-                        /* Grass */
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.2, 0.7, 0.1, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        glPopMatrix();
-
-                        /* Setting starting player position */
-                        if (!starting_player_position) {
-                            starting_player_position = true;
-                            set_player_starting_position(i, j);
-                        }
-                        break;
-
-                    /* Teleport case */
-                    default:
-                        /* Grass and wall */
-                        glPushMatrix();
-                            glTranslatef(x, 0, z);
-                            set_diffuse(0.2, 0.7, 0.1, 1);
-                            glutSolidCube(CUBE_SIZE);
-                        
-                            glTranslatef(0, CUBE_SIZE, 0);
-                            set_diffuse(0.7, 0.5, 0.2, 1);                           
-                            create_wall(CUBE_SIZE, map[i][j].height - 1);
-                        glPopMatrix();
-
-                        /* Teleport */
-                        glPushMatrix();
-                            glTranslatef(x, map[i][j].height*CUBE_SIZE, z);
-
-                            /* Teleport floating effect fix */
-                            glTranslatef(0, -CUBE_SIZE/2 + EPS, 0);
-
-                            create_teleport(0, 0, 0, map[i][j].color);
-                        glPopMatrix();
-                        break;
+        /* Frustum in the map local frame */
+        glGetFloatv(GL_PROJECTION_MATRIX, projection);
+        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+        frustum_from_matrices(&frustum, projection, modelview);
+
+        n = cull_world(&frustum);
+
+        /* Counting drawn fragments, unless the last count isn't read yet */
+        read_overdraw();
+        if (!overdraw_query_pending) {
+            glBeginQuery(GL_SAMPLES_PASSED, overdraw_query);
+        }
+
+        /* Static geometry: one submission per material for all visible chunks.
+         * Its chunks are already ordered nearest first */
+        for (m = 0; m < WORLD_MATERIAL_COUNT; m++) {
+            render_queue_push(&render_queue, world_materials[m], -1 - m, 0);
+        }
+
+        /* Animated objects of visible chunks */
+        animated_objects = ambient_objects = 0;
+        for (k = 0; k < cull_pool.worker_count; k++) {
+            for (c = 0; c < cull_lists[k].items.count; c++) {
+                RenderItem* item = &cull_lists[k].items.items[c];
+
+                render_queue_push(&render_queue, item->material, item->object, item->depth);
+                animated_objects += is_animated_cell(item->object / map_cols, item->object % map_cols);
+                ambient_objects += is_ambient_cell(item->object / map_cols, item->object % map_cols);
+            }
+        }
+
+        /* Drawing submissions grouped by material, so every material is set once:
+         * opaque objects front-to-back, then translucent teleports back-to-front */
+        render_queue_sort(&render_queue);
+
+        for (c = 0; c < render_queue.count; c++) {
+            RenderItem* item = &render_queue.items[c];
+
+            if (c == 0 || item->material != render_queue.items[c - 1].material) {
+                apply_material(item->material);
+            }
+
+            if (item->object < 0) {
+                /* Static geometry: one draw call for all visible chunks */
+                m = -1 - item->object;
+                for (k = 0; k < n; k++) {
+                    WorldChunk* chunk = &world.chunks[visible_chunks[k]];
+
+                    visible_first[k] = chunk->first[m];
+                    visible_count[k] = chunk->count[m];
                 }
+
+                mesh_draw_ranges(&world.meshes[m], visible_first, visible_count, n);
+            } else {
+                create_dynamic_cell(item->object / map_cols, item->object % map_cols);
             }
         }
 
+        /* Teleports queued above, already back-to-front */
+        teleport_renderer_draw(&teleports, sim_teleport_angle(&view));
+        glDepthMask(GL_TRUE);
+
+        if (!overdraw_query_pending) {
+            glEndQuery(GL_SAMPLES_PASSED);
+            overdraw_query_pending = true;
+        }
+
+        render_queue_clear(&render_queue);
+        show_frame_statistics();
+
     glPopMatrix();
 
 }
@@ -1467,6 +1583,16 @@ static void on_display(void)
     /* Clearing the previous window appearance */
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    /* Input of the whole frame at once: mouse turns the camera, and the
+     * simulation gets it together with the keys */
+    apply_mouse();
+    send_input();
+
+    /* Game as of now; camera follows the player */
+    drawn_sequence = sim_thread_view(&sim_thread, &view);
+    glm_vec3_copy(view.position, camera_pos);
+    glm_vec3_add(camera_pos, camera_front, camera_direction);
+
     /* Cammera settings */
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
@@ -1480,4 +1606,32 @@ static void on_display(void)
     create_map();
 
     glutSwapBuffers();
+    title_frames++;
+
+    /* Frame is presented once the swap is done: waiting for it costs some
+     * throughput, which is why it's done only in latency mode */
+    if (latency_mode) {
+        double time;
+
+        glFinish();
+        time = latency_now();
+        latency_frame(&game_latency, time, drawn_sequence);
+        latency_frame(&look_latency, time, 0);
+    }
+
+    /* Nothing in the game moves (and no game input waits for a tick to show): no
+     * more frames until something changes, except those of ambient animation,
+     * which don't have to come faster than the timer */
+    redisplay_pending = false;
+    if (v_forward == 0 && v_right == 0 && animated_objects == 0
+        && glm_vec3_distance(camera_pos, drawn_position) == 0
+        && drawn_sequence == input_sequence) {
+        glutIdleFunc(NULL);
+
+        if (ambient_objects > 0 && !ambient_timer_pending) {
+            ambient_timer_pending = true;
+            glutTimerFunc(AMBIENT_INTERVAL, on_ambient_timer, AMBIENT_TIMER_ID);
+        }
+    }
+    glm_vec3_copy(camera_pos, drawn_position);
 }
\ No newline at end of file
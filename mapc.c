@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim.h"
+#include "pvs.h"
+#include "tile_pool.h"
+
+/* Map compiler: reads map from the text files the game uses (dimensions, map and
+ * connections) and writes it as one compiled level file, which the game and the
+ * headless driver map into memory instead of parsing. Visible sets the game culls
+ * with are computed here too, on worker threads (one per processor, or as many as
+ * -j tells). They take a while on big maps, so -n leaves them out: the game then
+ * culls with the view frustum only. With -s, cells are written in compressed chunks
+ * and streamed in around the player while playing (only headless runs such a
+ * level, so it has no PVS either).
+ *
+ * Usage: mapc [-s] [-n] [-j workers] dimensions_file map_file connections_file level_file */
+
+/* Returns monotonic time in seconds */
+static double now();
+
+int main(int argc, char** argv)
+{
+    SimState sim;
+    Pvs pvs;
+    TilePool pool;
+    void* packed = NULL;
+    size_t packed_size = 0;
+    bool streamed = false, visible_sets = true;
+    int workers = 0, k = 1;
+    double start;
+
+    for (; k < argc && argv[k][0] == '-'; k++) {
+        if (strcmp(argv[k], "-s") == 0) {
+            streamed = true;
+        } else if (strcmp(argv[k], "-n") == 0) {
+            visible_sets = false;
+        } else if (strcmp(argv[k], "-j") == 0 && k + 1 < argc) {
+            workers = atoi(argv[++k]);
+        } else {
+            break;
+        }
+    }
+
+    if (argc - k != 4) {
+        fprintf(stderr, "Usage: %s [-s] [-n] [-j workers] dimensions_file map_file connections_file"
+                " level_file\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    sim_load(&sim, argv[k], argv[k + 1], argv[k + 2]);
+
+    if (!streamed && visible_sets) {
+        tile_pool_init(&pool, workers);
+
+        start = now();
+        pvs_build_level(&pvs, &sim, &pool);
+        printf("PVS computed in %.1f ms on %d workers, %d rows stolen\n",
+               (now() - start) * 1000, pool.worker_count, atomic_load(&pool.steals));
+
+        tile_pool_free(&pool);
+        packed = pvs_pack(&pvs, &packed_size);
+        pvs_free(&pvs);
+    }
+
+    sim_save_level(&sim, argv[k + 3], streamed, packed, packed_size);
+
+    printf("%s: %dx%d cells%s, %d doors, %d elevators, %zu bytes of PVS\n", argv[k + 3],
+           sim.rows, sim.cols, streamed ? " (streamed)" : "", sim.door_count,
+           sim.elevator_count, packed_size);
+
+    free(packed);
+    sim_free(&sim);
+
+    return 0;
+}
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+/* Map generator: carves a random maze of the given size and writes it in the
+ * same text format the game reads (map, dimensions and connections files).
+ * Maze corridors are made of grass ('w0'), maze walls are 1 to 3 cubes tall
+ * and the map is surrounded by 4 cubes tall border walls.
+ * Player starts in the bottom left corner, goal is in the top right corner.
+ * Optionally, up to the given number of doors is put on maze corridors, each with
+ * its key just before it, and as many elevators in dead ends, each with its switch
+ * on the corridor leading to it.
+ *
+ * Usage: mapgen rows cols map_file dimensions_file connections_file [seed [objects]] */
+
+/* Error-checking function. Used for technical C details */
+#define osAssert(condition, msg) osError(condition, msg)
+void osError(bool condition, const char* msg) {
+    if (!condition) {
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Cell of the generated map: type and height, just like in map.txt */
+typedef struct cell {
+    char type;
+    int height;
+}   Cell;
+
+/* Connection of two cells, written to the connections file */
+typedef struct connection {
+    char type;
+    int from, to;
+}   Connection;
+
+static int rows, cols;
+static Cell* cells = NULL;
+
+/* Every carved corridor cell, the node it was carved from and the node it leads to.
+ * Carving starts from the player, so the first node is always closer to the start */
+static int* corridors = NULL;
+static int* corridor_from = NULL;
+static int* corridor_to = NULL;
+static int corridor_count = 0;
+
+static Connection* connections = NULL;
+static int connection_count = 0;
+
+/* Carves maze corridors with iterative randomized depth-first search */
+static void carve_maze();
+
+/* Puts up to n key/door and n switch/elevator pairs on the maze */
+static void place_objects(int n);
+
+/* Writes generated map to the given files */
+static void write_map(const char* map_file, const char* dimensions_file,
+                      const char* connections_file);
+
+int main(int argc, char** argv)
+{
+    int i, start, goal;
+    unsigned seed;
+
+    if (argc < 6) {
+        fprintf(stderr, "Usage: %s rows cols map_file dimensions_file connections_file "
+                "[seed [objects]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    rows = atoi(argv[1]);
+    cols = atoi(argv[2]);
+    if (rows < 5 || cols < 5) {
+        fprintf(stderr, "Map has to be at least 5x5\n");
+        exit(EXIT_FAILURE);
+    }
+
+    seed = argc > 6 ? (unsigned)atoi(argv[6]) : (unsigned)time(NULL);
+    srand(seed);
+
+    cells = (Cell*)malloc((size_t)rows * cols * sizeof(Cell));
+    osAssert(cells != NULL, "Allocating memory for generated map failed\n");
+
+    /* Everything starts as a wall */
+    for (i = 0; i < rows * cols; i++) {
+        cells[i].type = 'w';
+        cells[i].height = 1 + rand() % 3;
+    }
+
+    carve_maze();
+
+    /* Border walls */
+    for (i = 0; i < rows; i++) {
+        cells[i * cols].height = cells[i * cols + cols - 1].height = 4;
+    }
+    for (i = 0; i < cols; i++) {
+        cells[i].height = cells[(rows - 1) * cols + i].height = 4;
+    }
+
+    /* Starting position and goal are placed on the corner maze nodes */
+    start = (rows - 2 - (rows % 2 == 0)) * cols + 1;
+    goal = cols + cols - 2 - (cols % 2 == 0);
+
+    cells[start].type = '@';
+    cells[start].height = 1;
+    cells[goal].type = 'X';
+    cells[goal].height = 1;
+
+    place_objects(argc > 7 ? atoi(argv[7]) : 0);
+
+    write_map(argv[3], argv[4], argv[5]);
+
+    free(cells);
+    free(corridors);
+    free(corridor_from);
+    free(corridor_to);
+    free(connections);
+    return 0;
+}
+
+static void carve_maze()
+{
+    /* Maze nodes are cells with odd coordinates, corridors connect neighbouring nodes */
+    int node_rows = (rows - 1) / 2;
+    int node_cols = (cols - 1) / 2;
+    int* stack = NULL;
+    bool* visited = NULL;
+    int top = 0;
+
+    int di[] = {-1, 1, 0, 0};
+    int dj[] = {0, 0, -1, 1};
+
+    stack = (int*)malloc((size_t)node_rows * node_cols * sizeof(int));
+    visited = (bool*)calloc((size_t)node_rows * node_cols, sizeof(bool));
+    corridors = (int*)malloc((size_t)node_rows * node_cols * sizeof(int));
+    corridor_from = (int*)malloc((size_t)node_rows * node_cols * sizeof(int));
+    corridor_to = (int*)malloc((size_t)node_rows * node_cols * sizeof(int));
+    osAssert(stack != NULL && visited != NULL && corridors != NULL
+             && corridor_from != NULL && corridor_to != NULL,
+             "Allocating memory for maze carving failed\n");
+
+    /* Starting from the node in the bottom left corner */
+    stack[top++] = (node_rows - 1) * node_cols;
+    visited[(node_rows - 1) * node_cols] = true;
+
+    while (top > 0) {
+        int node = stack[top - 1];
+        int ni = node / node_cols;
+        int nj = node % node_cols;
+        int candidates[4];
+        int n = 0, d, ti, tj;
+
+        /* Collecting unvisited neighbours */
+        for (d = 0; d < 4; d++) {
+            ti = ni + di[d];
+            tj = nj + dj[d];
+
+            if (ti >= 0 && ti < node_rows && tj >= 0 && tj < node_cols
+                && !visited[ti * node_cols + tj]) {
+                candidates[n++] = d;
+            }
+        }
+
+        /* Dead end: backtracking */
+        if (n == 0) {
+            top--;
+            continue;
+        }
+
+        /* Carving corridor to the random neighbour */
+        d = candidates[rand() % n];
+        ti = ni + di[d];
+        tj = nj + dj[d];
+
+        cells[(2*ni + 1) * cols + 2*nj + 1].height = 0;
+        cells[(2*ni + 1 + di[d]) * cols + 2*nj + 1 + dj[d]].height = 0;
+        cells[(2*ti + 1) * cols + 2*tj + 1].height = 0;
+
+        corridors[corridor_count] = (2*ni + 1 + di[d]) * cols + 2*nj + 1 + dj[d];
+        corridor_from[corridor_count] = (2*ni + 1) * cols + 2*nj + 1;
+        corridor_to[corridor_count] = (2*ti + 1) * cols + 2*tj + 1;
+        corridor_count++;
+
+        visited[ti * node_cols + tj] = true;
+        stack[top++] = ti * node_cols + tj;
+    }
+
+    free(stack);
+    free(visited);
+}
+
+static void place_objects(int n)
+{
+    int* order = NULL;
+    int* children = NULL;
+    int doors = 0, elevators = 0;
+    int k;
+
+    if (n <= 0) {
+        return;
+    }
+
+    order = (int*)malloc((size_t)corridor_count * sizeof(int));
+    children = (int*)calloc((size_t)rows * cols, sizeof(int));
+    connections = (Connection*)malloc(2 * (size_t)corridor_count * sizeof(Connection));
+    osAssert(order != NULL && children != NULL && connections != NULL,
+             "Allocating memory for objects failed\n");
+
+    /* Corridors in random order; nodes nothing was carved from are dead ends */
+    for (k = 0; k < corridor_count; k++) {
+        int r = rand() % (k + 1);
+
+        order[k] = order[r];
+        order[r] = k;
+        children[corridor_from[k]]++;
+    }
+
+    for (k = 0; k < corridor_count && (doors < n || elevators < n); k++) {
+        int c = order[k];
+        int corridor = corridors[c];
+        int from = corridor_from[c];
+        int to = corridor_to[c];
+
+        if (cells[corridor].type != 'w') {
+            continue;
+        }
+
+        if (children[to] == 0 && elevators < n && cells[to].type == 'w') {
+            /* Elevator in the dead end, switch on the way there */
+            cells[corridor].type = 's';
+            cells[to].type = 'e';
+            cells[corridor].height = cells[to].height = 1;
+
+            connections[connection_count].type = 'q';
+            connections[connection_count].from = corridor;
+            connections[connection_count].to = to;
+            connection_count++;
+            elevators++;
+        } else if (doors < n && cells[from].type == 'w') {
+            /* Door on the corridor, key on the node just before it */
+            cells[from].type = 'k';
+            cells[corridor].type = 'd';
+            cells[from].height = cells[corridor].height = 1;
+
+            connections[connection_count].type = 'z';
+            connections[connection_count].from = from;
+            connections[connection_count].to = corridor;
+            connection_count++;
+            doors++;
+        }
+    }
+
+    free(order);
+    free(children);
+}
+
+static void write_map(const char* map_file, const char* dimensions_file,
+                      const char* connections_file)
+{
+    FILE* f = NULL;
+    int i, j;
+
+    f = fopen(dimensions_file, "w");
+    osAssert(f != NULL, "Error opening dimensions file\n");
+    fprintf(f, "%d %d", rows, cols);
+    fclose(f);
+
+    f = fopen(map_file, "w");
+    osAssert(f != NULL, "Error opening map file\n");
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            fprintf(f, "%c%d%c", cells[i * cols + j].type, cells[i * cols + j].height,
+                    j == cols - 1 ? '\n' : ' ');
+        }
+    }
+    fclose(f);
+
+    /* Generated mazes have no teleports */
+    f = fopen(connections_file, "w");
+    osAssert(f != NULL, "Error opening connections file\n");
+    fprintf(f, "%d\n", connection_count);
+    for (i = 0; i < connection_count; i++) {
+        fprintf(f, "%c %d %d %d %d\n", connections[i].type,
+                connections[i].from / cols, connections[i].from % cols,
+                connections[i].to / cols, connections[i].to % cols);
+    }
+    fclose(f);
+}
@@ -0,0 +1,142 @@
+#include "mesh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Initial vertex capacity of a mesh; it doubles whenever it's filled */
+#define MESH_INITIAL_CAPACITY 1024
+
+void mesh_init(Mesh* m)
+{
+    m->data = NULL;
+    m->vertex_count = 0;
+    m->capacity = 0;
+    m->vbo = 0;
+}
+
+void mesh_add_vertex(Mesh* m, float nx, float ny, float nz, float x, float y, float z)
+{
+    GLfloat* v;
+
+    /* Growing vertex storage if needed */
+    if (m->vertex_count == m->capacity) {
+        int capacity = m->capacity == 0 ? MESH_INITIAL_CAPACITY : 2 * m->capacity;
+        GLfloat* data = (GLfloat*)realloc(m->data,
+                capacity * MESH_VERTEX_FLOATS * sizeof(GLfloat));
+        if (data == NULL) {
+            fprintf(stderr, "Allocating memory for mesh vertices failed.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        m->data = data;
+        m->capacity = capacity;
+    }
+
+    v = m->data + m->vertex_count * MESH_VERTEX_FLOATS;
+    v[0] = nx;
+    v[1] = ny;
+    v[2] = nz;
+    v[3] = x;
+    v[4] = y;
+    v[5] = z;
+
+    m->vertex_count++;
+}
+
+void mesh_add_quad(Mesh* m, const float n[3],
+                   const float a[3], const float b[3], const float c[3], const float d[3])
+{
+    /* Triangles (a, b, c) and (a, c, d) */
+    mesh_add_vertex(m, n[0], n[1], n[2], a[0], a[1], a[2]);
+    mesh_add_vertex(m, n[0], n[1], n[2], b[0], b[1], b[2]);
+    mesh_add_vertex(m, n[0], n[1], n[2], c[0], c[1], c[2]);
+
+    mesh_add_vertex(m, n[0], n[1], n[2], a[0], a[1], a[2]);
+    mesh_add_vertex(m, n[0], n[1], n[2], c[0], c[1], c[2]);
+    mesh_add_vertex(m, n[0], n[1], n[2], d[0], d[1], d[2]);
+}
+
+void mesh_add_box(Mesh* m, float x0, float y0, float z0, float x1, float y1, float z1)
+{
+    /* Right and left faces */
+    mesh_add_quad(m, (float[]){1, 0, 0},
+            (float[]){x1, y0, z0}, (float[]){x1, y1, z0},
+            (float[]){x1, y1, z1}, (float[]){x1, y0, z1});
+    mesh_add_quad(m, (float[]){-1, 0, 0},
+            (float[]){x0, y0, z0}, (float[]){x0, y0, z1},
+            (float[]){x0, y1, z1}, (float[]){x0, y1, z0});
+
+    /* Top and bottom faces */
+    mesh_add_quad(m, (float[]){0, 1, 0},
+            (float[]){x0, y1, z0}, (float[]){x0, y1, z1},
+            (float[]){x1, y1, z1}, (float[]){x1, y1, z0});
+    mesh_add_quad(m, (float[]){0, -1, 0},
+            (float[]){x0, y0, z0}, (float[]){x1, y0, z0},
+            (float[]){x1, y0, z1}, (float[]){x0, y0, z1});
+
+    /* Front and back faces */
+    mesh_add_quad(m, (float[]){0, 0, 1},
+            (float[]){x0, y0, z1}, (float[]){x1, y0, z1},
+            (float[]){x1, y1, z1}, (float[]){x0, y1, z1});
+    mesh_add_quad(m, (float[]){0, 0, -1},
+            (float[]){x0, y0, z0}, (float[]){x0, y1, z0},
+            (float[]){x1, y1, z0}, (float[]){x1, y0, z0});
+}
+
+void mesh_upload(Mesh* m)
+{
+    if (m->vertex_count == 0) {
+        return;
+    }
+
+    glGenBuffers(1, &m->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    glBufferData(GL_ARRAY_BUFFER, m->vertex_count * MESH_VERTEX_FLOATS * sizeof(GLfloat),
+                 m->data, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    /* Geometry now lives on the GPU */
+    free(m->data);
+    m->data = NULL;
+    m->capacity = 0;
+}
+
+void mesh_draw(const Mesh* m)
+{
+    GLint first = 0;
+    GLsizei count = m->vertex_count;
+
+    mesh_draw_ranges(m, &first, &count, 1);
+}
+
+void mesh_draw_ranges(const Mesh* m, const GLint* first, const GLsizei* count, int n)
+{
+    GLsizei stride = MESH_VERTEX_FLOATS * sizeof(GLfloat);
+
+    if (m->vbo == 0 || n == 0) {
+        return;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m->vbo);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    /* Offsets into the bound buffer: normal first, then position */
+    glNormalPointer(GL_FLOAT, stride, (const GLvoid*)0);
+    glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*)(3 * sizeof(GLfloat)));
+
+    glMultiDrawArrays(GL_TRIANGLES, first, count, n);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void mesh_free(Mesh* m)
+{
+    if (m->vbo != 0) {
+        glDeleteBuffers(1, &m->vbo);
+    }
+
+    free(m->data);
+    mesh_init(m);
+}
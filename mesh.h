@@ -0,0 +1,46 @@
+#ifndef MESH_H
+#define MESH_H
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glut.h>
+
+/* Retained-mode triangle mesh. Every vertex is stored interleaved as
+ * normal (nx, ny, nz) followed by position (x, y, z). Vertices are collected
+ * on the CPU while the mesh is being built and moved to a vertex buffer object
+ * by mesh_upload(), after which the CPU copy is released. */
+typedef struct mesh {
+    GLfloat* data;
+    int vertex_count;
+    int capacity;
+    GLuint vbo;
+}   Mesh;
+
+/* Number of floats per interleaved vertex */
+#define MESH_VERTEX_FLOATS 6
+
+/* Initializes an empty mesh */
+void mesh_init(Mesh* m);
+
+/* Appends one vertex to the mesh */
+void mesh_add_vertex(Mesh* m, float nx, float ny, float nz, float x, float y, float z);
+
+/* Appends quad (a, b, c, d) given counter-clockwise as two triangles */
+void mesh_add_quad(Mesh* m, const float n[3],
+                   const float a[3], const float b[3], const float c[3], const float d[3]);
+
+/* Appends axis aligned box [x0, x1] x [y0, y1] x [z0, z1] with outward normals */
+void mesh_add_box(Mesh* m, float x0, float y0, float z0, float x1, float y1, float z1);
+
+/* Moves collected vertices to a vertex buffer object */
+void mesh_upload(Mesh* m);
+
+/* Draws the whole mesh with a single draw call */
+void mesh_draw(const Mesh* m);
+
+/* Draws n vertex ranges (first[k], count[k]) of the mesh with a single call */
+void mesh_draw_ranges(const Mesh* m, const GLint* first, const GLsizei* count, int n);
+
+/* Releases CPU and GPU side data of the mesh */
+void mesh_free(Mesh* m);
+
+#endif
@@ -0,0 +1,138 @@
+#include "props.h"
+#include <stdbool.h>
+#include <math.h>
+
+/* Same constant as in main.c */
+#define PI 3.14159265359
+
+/* Tessellation of every detail level. Level 0 matches the old immediate mode
+ * props: glutSolidTorus(..., 10, 20) and 40 segment cylinders */
+static const int torus_sides[PROP_LOD_COUNT] = {10, 6, 4};
+static const int torus_rings[PROP_LOD_COUNT] = {20, 12, 8};
+static const int cylinder_segments[PROP_LOD_COUNT] = {40, 16, 6};
+
+/* Appends open cylinder of radius r and height h standing on the xz plane,
+ * moved by (dx, dy, dz). If lying is set, it's first rotated 90 degrees around z */
+static void add_cylinder(Mesh* m, float r, float h, int segments, bool lying,
+                         float dx, float dy, float dz);
+
+/* Appends torus around the z axis with tube radius r and ring radius R, moved by dx along x */
+static void add_torus(Mesh* m, float r, float R, int sides, int rings, float dx);
+
+/* Appends vertex with normal n and position p, optionally rotated 90 degrees around z */
+static void add_vertex(Mesh* m, const float n[3], const float p[3], bool lying,
+                       float dx, float dy, float dz);
+
+void prop_cache_build(PropCache* c, float cube_size)
+{
+    /* Same dimensions as create_key() and create_switch() had */
+    float body_radius = cube_size / 40;
+    float body_height = cube_size / 3;
+    int l;
+
+    mesh_init(&c->mesh);
+
+    for (l = 0; l < PROP_LOD_COUNT; l++) {
+        int segments = cylinder_segments[l];
+
+        /* Key: torus, body and two "teeth" */
+        c->first[PROP_KEY][l] = c->mesh.vertex_count;
+        add_torus(&c->mesh, body_radius, cube_size / 12, torus_sides[l], torus_rings[l],
+                  cube_size / 15);
+        add_cylinder(&c->mesh, body_radius, body_height, segments, true, 0, 0, 0);
+        add_cylinder(&c->mesh, body_radius/1.5, body_height/3, segments, false,
+                     -cube_size / 3.5, -cube_size / 10, 0);
+        add_cylinder(&c->mesh, body_radius/1.5, body_height/3, segments, false,
+                     -cube_size / 3.5 + cube_size / 12, -cube_size / 10, 0);
+        c->count[PROP_KEY][l] = c->mesh.vertex_count - c->first[PROP_KEY][l];
+
+        /* Switch */
+        c->first[PROP_SWITCH][l] = c->mesh.vertex_count;
+        add_cylinder(&c->mesh, cube_size / 20, cube_size / 2, segments, false, 0, 0, 0);
+        c->count[PROP_SWITCH][l] = c->mesh.vertex_count - c->first[PROP_SWITCH][l];
+    }
+
+    mesh_upload(&c->mesh);
+}
+
+void prop_cache_draw(const PropCache* c, enum prop p, int lod)
+{
+    mesh_draw_ranges(&c->mesh, &c->first[p][lod], &c->count[p][lod], 1);
+}
+
+void prop_cache_free(PropCache* c)
+{
+    mesh_free(&c->mesh);
+}
+
+static void add_cylinder(Mesh* m, float r, float h, int segments, bool lying,
+                         float dx, float dy, float dz)
+{
+    int k;
+
+    /* Quads between neighbouring strip positions of the old draw_cylinder().
+     * Normals keep the old (unnormalized) values; GL_NORMALIZE fixes their length */
+    for (k = 0; k < segments; k++) {
+        float phi0 = 2*PI * k / segments;
+        float phi1 = 2*PI * (k + 1) / segments;
+
+        float b0[3] = {r*sin(phi0), 0, r*cos(phi0)};
+        float t0[3] = {r*sin(phi0), h, r*cos(phi0)};
+        float b1[3] = {r*sin(phi1), 0, r*cos(phi1)};
+        float t1[3] = {r*sin(phi1), h, r*cos(phi1)};
+
+        add_vertex(m, b0, b0, lying, dx, dy, dz);
+        add_vertex(m, b1, b1, lying, dx, dy, dz);
+        add_vertex(m, t1, t1, lying, dx, dy, dz);
+
+        add_vertex(m, b0, b0, lying, dx, dy, dz);
+        add_vertex(m, t1, t1, lying, dx, dy, dz);
+        add_vertex(m, t0, t0, lying, dx, dy, dz);
+    }
+}
+
+static void add_torus(Mesh* m, float r, float R, int sides, int rings, float dx)
+{
+    int i, j, k;
+
+    for (j = 0; j < rings; j++) {
+        for (i = 0; i < sides; i++) {
+            float n[4][3], p[4][3];
+
+            /* Corners (j, i), (j + 1, i), (j + 1, i + 1), (j, i + 1), counter-clockwise */
+            for (k = 0; k < 4; k++) {
+                int ring = j + (k == 1 || k == 2);
+                int side = i + (k >= 2);
+                float phi = 2*PI * ring / rings;
+                float theta = 2*PI * side / sides;
+
+                n[k][0] = cos(phi) * cos(theta);
+                n[k][1] = sin(phi) * cos(theta);
+                n[k][2] = sin(theta);
+
+                p[k][0] = cos(phi) * (R + r * cos(theta));
+                p[k][1] = sin(phi) * (R + r * cos(theta));
+                p[k][2] = r * sin(theta);
+            }
+
+            add_vertex(m, n[0], p[0], false, dx, 0, 0);
+            add_vertex(m, n[1], p[1], false, dx, 0, 0);
+            add_vertex(m, n[2], p[2], false, dx, 0, 0);
+
+            add_vertex(m, n[0], p[0], false, dx, 0, 0);
+            add_vertex(m, n[2], p[2], false, dx, 0, 0);
+            add_vertex(m, n[3], p[3], false, dx, 0, 0);
+        }
+    }
+}
+
+static void add_vertex(Mesh* m, const float n[3], const float p[3], bool lying,
+                       float dx, float dy, float dz)
+{
+    /* Rotation by 90 degrees around z: (x, y, z) -> (-y, x, z) */
+    if (lying) {
+        mesh_add_vertex(m, -n[1], n[0], n[2], -p[1] + dx, p[0] + dy, p[2] + dz);
+    } else {
+        mesh_add_vertex(m, n[0], n[1], n[2], p[0] + dx, p[1] + dy, p[2] + dz);
+    }
+}
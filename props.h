@@ -0,0 +1,34 @@
+#ifndef PROPS_H
+#define PROPS_H
+
+#include "mesh.h"
+
+/* Procedural props whose geometry is shared by all their instances */
+enum prop {
+    PROP_KEY,
+    PROP_SWITCH,
+    PROP_COUNT
+};
+
+/* Number of detail levels of every prop; level 0 is the most detailed one */
+#define PROP_LOD_COUNT 3
+
+/* Geometry of every prop, tessellated once and kept in one vertex buffer.
+ * Level l of prop p occupies vertices [first[p][l], first[p][l] + count[p][l]) of the mesh */
+typedef struct prop_cache {
+    Mesh mesh;
+    GLint first[PROP_COUNT][PROP_LOD_COUNT];
+    GLsizei count[PROP_COUNT][PROP_LOD_COUNT];
+}   PropCache;
+
+/* Tessellates all props at every detail level with dimensions derived
+ * from the cube size and uploads them */
+void prop_cache_build(PropCache* c, float cube_size);
+
+/* Draws detail level lod of prop p with the current modelview matrix and material */
+void prop_cache_draw(const PropCache* c, enum prop p, int lod);
+
+/* Releases prop geometry */
+void prop_cache_free(PropCache* c);
+
+#endif
@@ -0,0 +1,710 @@
+#include "pvs.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Number of bits in one word of a window bitset, and of the source and object bitmaps */
+#define PVS_WORD_BITS 32
+#define PVS_MAP_BITS 64
+
+/* Blocks a window touches on a side, and bytes of their bits. A record is at most
+ * 1 + PVS_BLOCK_BYTES + PVS_WINDOW_WORDS * 4 bytes, so its length fits in a byte */
+#define PVS_BLOCK_SPAN ((2 * PVS_RADIUS + PVS_BLOCK - 1) / PVS_BLOCK + 1)
+#define PVS_BLOCK_BYTES ((PVS_BLOCK_SPAN * PVS_BLOCK_SPAN + 7) / 8)
+
+/* Working state used while PVS of one source cell is computed. Stamp buffers are
+ * side x side windows centered in the source cell: a cell is marked if its stamp
+ * equals the current pass (lit) or source (visible, dilated) number, so they never
+ * have to be cleared. Marked cells are also collected in lists */
+typedef struct pvs_builder {
+    Pvs* p;
+    const int* top;
+    const int* target_top;
+    int si, sj;
+    int side;
+    int threshold;
+    int pass, source;
+    int* lit;
+    int* visible;
+    int* dilated;
+    int* lit_list;
+    int* dilated_list;
+    int lit_count, dilated_count;
+    int max_level;
+    int* level_sums;
+
+    /* Records of the rows this builder computed */
+    unsigned char* bytes;
+    size_t byte_count, capacity;
+}   PvsBuilder;
+
+/* PVS computed on a tile pool, one map row per tile. Every worker has a builder of
+ * its own and packs records into its own bytes; rows are joined in order at the end */
+typedef struct pvs_job {
+    PvsBuilder builders[TILE_POOL_MAX_WORKERS];
+    const bool* source;
+
+    /* Row i is bytes [row_begin[i], row_end[i]) of the builder of row_worker[i] */
+    int* row_worker;
+    size_t* row_begin;
+    size_t* row_end;
+}   PvsJob;
+
+/* Allocates working state of a builder */
+static void init_builder(PvsBuilder* b, Pvs* p, const int* top, const int* target_top);
+
+/* Releases working state and bytes of a builder */
+static void free_builder(PvsBuilder* b);
+
+/* Computes PVS of all source cells of the map row (tile of the PvsJob context) */
+static void build_row(void* context, int worker, int tile);
+
+/* Builds prefix sums that count target tops of every level in any map rectangle */
+static void build_level_sums(PvsBuilder* b);
+
+/* Returns true if some cell in the source window has target top equal to level */
+static bool level_in_window(const PvsBuilder* b, int level);
+
+/* Returns true if cell (i, j) blocks the view in the current pass */
+static bool is_opaque(const PvsBuilder* b, int i, int j);
+
+/* Recursive shadowcasting over one octant, as described on RogueBasin
+ * ("FOV using recursive shadowcasting"). Lit cells are stamped with the pass number */
+static void cast_light(PvsBuilder* b, int row, float start, float end,
+                       int xx, int xy, int yx, int yy);
+
+/* Computes PVS of the source cell into b->dilated and b->dilated_list */
+static void compute_cell(PvsBuilder* b);
+
+/* Packs b->dilated_list of the source cell into the builder's bytes */
+static void store_cell(PvsBuilder* b);
+
+/* Appends one byte to the builder's bytes */
+static void push_byte(PvsBuilder* b, unsigned char byte);
+
+/* Number of bitmap words of a map row */
+static size_t row_words(int cols);
+
+/* Returns bit of cell (i, j) in the source or object bitmap */
+static bool map_bit(const Pvs* p, const uint64_t* bitmap, int i, int j);
+
+/* Fills window position and size of source cell (i, j) */
+static void window_of(const Pvs* p, int i, int j, PvsWindow* w);
+
+/* Returns bit of the block of cell (i, j) in the record of window w */
+static int block_bit(const PvsWindow* w, int i, int j);
+
+/* Returns true if the record at offset is all inside the bytes */
+static bool record_fits(const Pvs* p, size_t offset);
+
+void pvs_build(Pvs* p, const int* top, const int* target_top, const bool* source,
+               const bool* object, int rows, int cols, int radius, TilePool* pool)
+{
+    PvsJob job;
+    size_t byte_count = 0, base, words = (size_t)rows * row_words(cols), w;
+    int i, j, k;
+
+    if (radius > PVS_RADIUS) {
+        fprintf(stderr, "PVS radius can be at most %d.\n", PVS_RADIUS);
+        exit(EXIT_FAILURE);
+    }
+
+    p->rows = rows;
+    p->cols = cols;
+    p->radius = radius;
+    p->headroom = 0;
+    p->bytes = NULL;
+    p->byte_count = 0;
+    p->mapped = false;
+    p->source = (uint64_t*)calloc(words + 1, sizeof(uint64_t));
+    p->object = (uint64_t*)calloc(words + 1, sizeof(uint64_t));
+    p->offset = (uint64_t*)malloc((words + 1) * sizeof(uint64_t));
+
+    job.source = source;
+    job.row_worker = (int*)malloc(rows * sizeof(int));
+    job.row_begin = (size_t*)malloc(rows * sizeof(size_t));
+    job.row_end = (size_t*)malloc(rows * sizeof(size_t));
+    if (p->source == NULL || p->object == NULL || p->offset == NULL
+        || job.row_worker == NULL || job.row_begin == NULL || job.row_end == NULL) {
+        fprintf(stderr, "Allocating memory for PVS failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            w = i * row_words(cols) + j / PVS_MAP_BITS;
+            p->source[w] |= (uint64_t)source[(size_t)i * cols + j] << (j % PVS_MAP_BITS);
+            p->object[w] |= (uint64_t)object[(size_t)i * cols + j] << (j % PVS_MAP_BITS);
+        }
+    }
+
+    /* Level sums are only read, so all builders share those of the first one */
+    for (k = 0; k < pool->worker_count; k++) {
+        init_builder(&job.builders[k], p, top, target_top);
+    }
+    build_level_sums(&job.builders[0]);
+    for (k = 1; k < pool->worker_count; k++) {
+        job.builders[k].max_level = job.builders[0].max_level;
+        job.builders[k].level_sums = job.builders[0].level_sums;
+    }
+
+    tile_pool_run(pool, rows, build_row, &job);
+
+    /* Joining rows in order: offsets move from the worker's bytes to the pool */
+    for (i = 0; i < rows; i++) {
+        byte_count += job.row_end[i] - job.row_begin[i];
+    }
+    p->bytes = (unsigned char*)malloc(byte_count + 1);
+    if (p->bytes == NULL) {
+        fprintf(stderr, "Allocating memory for PVS failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < rows; i++) {
+        const PvsBuilder* b = &job.builders[job.row_worker[i]];
+
+        base = p->byte_count;
+        memcpy(p->bytes + base, b->bytes + job.row_begin[i], job.row_end[i] - job.row_begin[i]);
+        p->byte_count += job.row_end[i] - job.row_begin[i];
+
+        for (w = i * row_words(cols); w < (i + 1) * row_words(cols); w++) {
+            p->offset[w] = p->offset[w] - job.row_begin[i] + base;
+        }
+    }
+
+    free(job.builders[0].level_sums);
+    for (k = 0; k < pool->worker_count; k++) {
+        free_builder(&job.builders[k]);
+    }
+    free(job.row_worker);
+    free(job.row_begin);
+    free(job.row_end);
+}
+
+void pvs_build_level(Pvs* p, const SimState* s, TilePool* pool)
+{
+    size_t cells = (size_t)s->rows * s->cols;
+    int* top = (int*)malloc(cells * sizeof(int));
+    int* target_top = (int*)malloc(cells * sizeof(int));
+    bool* walkable = (bool*)malloc(cells * sizeof(bool));
+    bool* object = (bool*)malloc(cells * sizeof(bool));
+    FieldData field;
+    int i, j, c;
+
+    if (top == NULL || target_top == NULL || walkable == NULL || object == NULL) {
+        fprintf(stderr, "Allocating memory for PVS input failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Moving objects reach above the static geometry of their cells, so they
+     * are seen from further away */
+    for (i = 0; i < s->rows; i++) {
+        for (j = 0; j < s->cols; j++) {
+            c = i * s->cols + j;
+            field = sim_field(s, i, j);
+
+            top[c] = sim_column_top(s, i, j);
+            object[c] = sim_has_object(s, i, j);
+            target_top[c] = object[c] ? top[c] + 1 + sim_object_reach(s, i, j) : top[c];
+            walkable[c] = field.type != 'w' || field.height == 0;
+        }
+    }
+
+    pvs_build(p, top, target_top, walkable, object, s->rows, s->cols, PVS_RADIUS, pool);
+    p->headroom = sim_object_headroom(s);
+
+    free(top);
+    free(target_top);
+    free(walkable);
+    free(object);
+}
+
+void* pvs_pack(const Pvs* p, size_t* size)
+{
+    size_t words = (size_t)p->rows * row_words(p->cols);
+    PvsHeader header;
+    char* data = NULL;
+
+    *size = sizeof(PvsHeader) + 3 * words * sizeof(uint64_t) + p->byte_count;
+    data = (char*)malloc(*size);
+    if (data == NULL) {
+        fprintf(stderr, "Allocating memory for packed PVS failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.rows = p->rows;
+    header.cols = p->cols;
+    header.radius = p->radius;
+    header.headroom = p->headroom;
+    header.block = PVS_BLOCK;
+    header.byte_count = p->byte_count;
+
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), p->source, words * sizeof(uint64_t));
+    memcpy(data + sizeof(header) + words * sizeof(uint64_t), p->object, words * sizeof(uint64_t));
+    memcpy(data + sizeof(header) + 2 * words * sizeof(uint64_t), p->offset,
+           words * sizeof(uint64_t));
+    memcpy(data + sizeof(header) + 3 * words * sizeof(uint64_t), p->bytes, p->byte_count);
+
+    return data;
+}
+
+bool pvs_map(Pvs* p, const void* data, size_t size, int rows, int cols, int headroom)
+{
+    const PvsHeader* header = (const PvsHeader*)data;
+    size_t words = (size_t)rows * row_words(cols);
+
+    /* Records themselves are checked as they're read, in pvs_window() */
+    if (size < sizeof(PvsHeader) || (uintptr_t)data % sizeof(uint64_t) != 0
+        || header->rows != rows || header->cols != cols
+        || header->radius != PVS_RADIUS || header->headroom != headroom
+        || header->block != PVS_BLOCK || header->byte_count > size
+        || size != sizeof(PvsHeader) + 3 * words * sizeof(uint64_t) + header->byte_count) {
+        return false;
+    }
+
+    p->rows = rows;
+    p->cols = cols;
+    p->radius = header->radius;
+    p->headroom = header->headroom;
+    p->source = (uint64_t*)((const char*)data + sizeof(PvsHeader));
+    p->object = p->source + words;
+    p->offset = p->object + words;
+    p->bytes = (unsigned char*)(p->offset + words);
+    p->byte_count = header->byte_count;
+    p->mapped = true;
+
+    return true;
+}
+
+bool pvs_window(const Pvs* p, int i, int j, PvsWindow* w)
+{
+    const unsigned char* record = NULL;
+    size_t word, offset;
+    int k, ci, cj, bit, objects = 0;
+    bool seen;
+
+    if (p->source == NULL || i < 0 || i >= p->rows || j < 0 || j >= p->cols
+        || !map_bit(p, p->source, i, j)) {
+        return false;
+    }
+
+    /* Records of the sources before the cell in its word come first */
+    word = i * row_words(p->cols) + j / PVS_MAP_BITS;
+    offset = p->offset[word];
+    for (k = __builtin_popcountll(p->source[word] & ((1ull << (j % PVS_MAP_BITS)) - 1)); k > 0; k--) {
+        if (!record_fits(p, offset)) {
+            return false;
+        }
+        offset += p->bytes[offset];
+    }
+    if (!record_fits(p, offset)) {
+        return false;
+    }
+    record = p->bytes + offset;
+
+    window_of(p, i, j, w);
+    memset(w->bits, 0, sizeof(w->bits));
+
+    for (ci = w->i0; ci < w->i0 + w->rows; ci++) {
+        for (cj = w->j0; cj < w->j0 + w->cols; cj++) {
+            if (map_bit(p, p->object, ci, cj)) {
+                bit = 8 * (1 + PVS_BLOCK_BYTES) + objects++;
+                if (bit >= 8 * record[0]) {
+                    return false;
+                }
+            } else {
+                bit = 8 + block_bit(w, ci, cj);
+            }
+            seen = (record[bit / 8] >> (bit % 8)) & 1;
+
+            bit = (ci - w->i0) * w->cols + (cj - w->j0);
+            w->bits[bit / PVS_WORD_BITS] |= (unsigned)seen << (bit % PVS_WORD_BITS);
+        }
+    }
+
+    return true;
+}
+
+bool pvs_window_test(const PvsWindow* w, int i, int j)
+{
+    int bit;
+
+    if (i < w->i0 || i >= w->i0 + w->rows || j < w->j0 || j >= w->j0 + w->cols) {
+        return false;
+    }
+
+    bit = (i - w->i0) * w->cols + (j - w->j0);
+    return (w->bits[bit / PVS_WORD_BITS] >> (bit % PVS_WORD_BITS)) & 1;
+}
+
+void pvs_free(Pvs* p)
+{
+    /* Mapped PVS belongs to the level */
+    if (!p->mapped) {
+        free(p->source);
+        free(p->object);
+        free(p->offset);
+        free(p->bytes);
+    }
+
+    p->source = NULL;
+    p->object = NULL;
+    p->offset = NULL;
+    p->bytes = NULL;
+    p->byte_count = 0;
+    p->mapped = false;
+}
+
+static void init_builder(PvsBuilder* b, Pvs* p, const int* top, const int* target_top)
+{
+    b->p = p;
+    b->top = top;
+    b->target_top = target_top;
+    b->side = 2 * p->radius + 1;
+    b->pass = b->source = 0;
+    b->lit = (int*)calloc(b->side * b->side, sizeof(int));
+    b->visible = (int*)calloc(b->side * b->side, sizeof(int));
+    b->dilated = (int*)calloc(b->side * b->side, sizeof(int));
+    b->lit_list = (int*)malloc(b->side * b->side * sizeof(int));
+    b->dilated_list = (int*)malloc(b->side * b->side * sizeof(int));
+    b->bytes = NULL;
+    b->byte_count = b->capacity = 0;
+
+    if (b->lit == NULL || b->visible == NULL || b->dilated == NULL
+        || b->lit_list == NULL || b->dilated_list == NULL) {
+        fprintf(stderr, "Allocating memory for PVS failed.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void free_builder(PvsBuilder* b)
+{
+    free(b->lit);
+    free(b->visible);
+    free(b->dilated);
+    free(b->lit_list);
+    free(b->dilated_list);
+    free(b->bytes);
+}
+
+static void build_row(void* context, int worker, int tile)
+{
+    PvsJob* job = (PvsJob*)context;
+    PvsBuilder* b = &job->builders[worker];
+    int cols = b->p->cols;
+    int j;
+
+    job->row_worker[tile] = worker;
+    job->row_begin[tile] = b->byte_count;
+
+    for (j = 0; j < cols; j++) {
+        if (j % PVS_MAP_BITS == 0) {
+            b->p->offset[tile * row_words(cols) + j / PVS_MAP_BITS] = b->byte_count;
+        }
+        if (!job->source[(size_t)tile * cols + j]) {
+            continue;
+        }
+
+        b->si = tile;
+        b->sj = j;
+        compute_cell(b);
+        store_cell(b);
+    }
+
+    job->row_end[tile] = b->byte_count;
+}
+
+static void build_level_sums(PvsBuilder* b)
+{
+    int rows = b->p->rows;
+    int cols = b->p->cols;
+    size_t plane = (size_t)(rows + 1) * (cols + 1);
+    int i, j, level;
+
+    b->max_level = 0;
+    for (i = 0; i < rows * cols; i++) {
+        if (b->target_top[i] > b->max_level) {
+            b->max_level = b->target_top[i];
+        }
+    }
+
+    /* One summed-area table per level */
+    b->level_sums = (int*)calloc((b->max_level + 1) * plane, sizeof(int));
+    if (b->level_sums == NULL) {
+        fprintf(stderr, "Allocating memory for PVS level sums failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (level = 0; level <= b->max_level; level++) {
+        int* sums = b->level_sums + level * plane;
+
+        for (i = 0; i < rows; i++) {
+            for (j = 0; j < cols; j++) {
+                sums[(i + 1) * (cols + 1) + j + 1] = (b->target_top[i * cols + j] == level)
+                        + sums[i * (cols + 1) + j + 1] + sums[(i + 1) * (cols + 1) + j]
+                        - sums[i * (cols + 1) + j];
+            }
+        }
+    }
+}
+
+static bool level_in_window(const PvsBuilder* b, int level)
+{
+    int cols = b->p->cols;
+    int radius = b->p->radius;
+    const int* sums = b->level_sums + level * (size_t)(b->p->rows + 1) * (cols + 1);
+
+    /* Window clipped to the map, as a half-open rectangle in summed-area table */
+    int i0 = b->si - radius < 0 ? 0 : b->si - radius;
+    int j0 = b->sj - radius < 0 ? 0 : b->sj - radius;
+    int i1 = b->si + radius + 1 > b->p->rows ? b->p->rows : b->si + radius + 1;
+    int j1 = b->sj + radius + 1 > cols ? cols : b->sj + radius + 1;
+
+    return sums[i1 * (cols + 1) + j1] - sums[i0 * (cols + 1) + j1]
+         - sums[i1 * (cols + 1) + j0] + sums[i0 * (cols + 1) + j0] > 0;
+}
+
+static bool is_opaque(const PvsBuilder* b, int i, int j)
+{
+    /* Everything outside the map blocks the view */
+    if (i < 0 || i >= b->p->rows || j < 0 || j >= b->p->cols) {
+        return true;
+    }
+
+    return b->top[i * b->p->cols + j] >= b->threshold;
+}
+
+static void cast_light(PvsBuilder* b, int row, float start, float end,
+                       int xx, int xy, int yx, int yy)
+{
+    int radius = b->p->radius;
+    float new_start = 0;
+    int distance;
+
+    if (start < end) {
+        return;
+    }
+
+    for (distance = row; distance <= radius; distance++) {
+        int dx = -distance - 1;
+        int dy = -distance;
+        bool blocked = false;
+
+        while (dx <= 0) {
+            int x, y;
+            float l_slope, r_slope;
+
+            dx++;
+
+            /* Octant coordinates to map offsets from the source */
+            x = dx * xx + dy * xy;
+            y = dx * yx + dy * yy;
+
+            l_slope = (dx - 0.5) / (dy + 0.5);
+            r_slope = (dx + 0.5) / (dy - 0.5);
+
+            if (start < r_slope) {
+                continue;
+            } else if (end > l_slope) {
+                break;
+            }
+
+            /* Cell is lit, even if it's opaque (walls are seen) */
+            if (b->lit[(y + radius) * b->side + x + radius] != b->pass) {
+                b->lit[(y + radius) * b->side + x + radius] = b->pass;
+                b->lit_list[b->lit_count++] = (y + radius) * b->side + x + radius;
+            }
+
+            if (blocked) {
+                /* Scanning along a wall */
+                if (is_opaque(b, b->si + y, b->sj + x)) {
+                    new_start = r_slope;
+                    continue;
+                } else {
+                    blocked = false;
+                    start = new_start;
+                }
+            } else if (is_opaque(b, b->si + y, b->sj + x) && distance < radius) {
+                /* Wall starts: scanning the next row of the visible part */
+                blocked = true;
+                cast_light(b, distance + 1, start, l_slope, xx, xy, yx, yy);
+                new_start = r_slope;
+            }
+        }
+
+        if (blocked) {
+            break;
+        }
+    }
+}
+
+static void compute_cell(PvsBuilder* b)
+{
+    /* Octant transformations */
+    static const int mult[4][8] = {
+        {1, 0, 0, -1, -1, 0, 0, 1},
+        {0, 1, -1, 0, 0, -1, 1, 0},
+        {0, 1, 1, 0, 0, -1, -1, 0},
+        {1, 0, 0, 1, -1, 0, 0, -1}
+    };
+
+    int radius = b->p->radius;
+    int cols = b->p->cols;
+    int eye = b->top[b->si * cols + b->sj] + 1;
+    int k, l, th;
+
+    b->source++;
+    b->dilated_count = 0;
+
+    /* A target is blocked only by columns at least max(eye, target top) high, so
+     * every distinct threshold present in the window needs its own pass. Targets
+     * lower than the eye all share the first pass */
+    for (th = eye; th <= b->max_level || th == eye; th++) {
+        if (th > eye && !level_in_window(b, th)) {
+            continue;
+        }
+
+        /* Shadowcasting from the source cell center */
+        b->threshold = th;
+        b->pass++;
+        b->lit_count = 0;
+        b->lit[radius * b->side + radius] = b->pass;
+        b->lit_list[b->lit_count++] = radius * b->side + radius;
+        for (k = 0; k < 8; k++) {
+            cast_light(b, 1, 1.0, 0.0, mult[0][k], mult[1][k], mult[2][k], mult[3][k]);
+        }
+
+        /* Lit cells count only for targets belonging to this threshold */
+        for (l = 0; l < b->lit_count; l++) {
+            int w = b->lit_list[l];
+            int i = b->si + w / b->side - radius;
+            int j = b->sj + w % b->side - radius;
+            int t, di, dj;
+
+            /* Lit cells outside the map are only there to block the view */
+            if (i < 0 || i >= b->p->rows || j < 0 || j >= cols) {
+                continue;
+            }
+
+            t = b->target_top[i * cols + j];
+            if ((t < eye ? eye : t) != th || b->visible[w] == b->source) {
+                continue;
+            }
+            b->visible[w] = b->source;
+
+            /* Eye isn't always in the cell center: dilating the set by one cell
+             * covers the view from the rest of the cell */
+            for (di = -1; di <= 1; di++) {
+                for (dj = -1; dj <= 1; dj++) {
+                    int wi = w / b->side + di;
+                    int wj = w % b->side + dj;
+                    int d = wi * b->side + wj;
+
+                    if (wi >= 0 && wi < b->side && wj >= 0 && wj < b->side
+                        && i + di >= 0 && i + di < b->p->rows && j + dj >= 0 && j + dj < cols
+                        && b->dilated[d] != b->source) {
+                        b->dilated[d] = b->source;
+                        b->dilated_list[b->dilated_count++] = d;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void store_cell(PvsBuilder* b)
+{
+    unsigned char record[1 + PVS_BLOCK_BYTES + PVS_WINDOW_WORDS * 4];
+    int radius = b->p->radius;
+    int length = 1 + PVS_BLOCK_BYTES, objects = 0;
+    int i, j, k, bit;
+    PvsWindow w;
+
+    window_of(b->p, b->si, b->sj, &w);
+    memset(record, 0, sizeof(record));
+
+    /* Blocks with any visible cell */
+    for (k = 0; k < b->dilated_count; k++) {
+        i = b->si + b->dilated_list[k] / b->side - radius;
+        j = b->sj + b->dilated_list[k] % b->side - radius;
+        bit = 8 + block_bit(&w, i, j);
+        record[bit / 8] |= 1 << (bit % 8);
+    }
+
+    /* Object cells of the window, in row order: set bits of the object bitmap, a
+     * word at a time */
+    for (i = w.i0; i < w.i0 + w.rows; i++) {
+        for (j = w.j0; j < w.j0 + w.cols; j += PVS_MAP_BITS - j % PVS_MAP_BITS) {
+            uint64_t bits = b->p->object[i * row_words(b->p->cols) + j / PVS_MAP_BITS]
+                            >> (j % PVS_MAP_BITS);
+            int count = w.j0 + w.cols - j;
+
+            if (count < PVS_MAP_BITS) {
+                bits &= (1ull << count) - 1;
+            }
+            for (; bits != 0; bits &= bits - 1) {
+                int cj = j + __builtin_ctzll(bits);
+
+                if (b->dilated[(i - b->si + radius) * b->side + cj - b->sj + radius] == b->source) {
+                    record[length + objects / 8] |= 1 << (objects % 8);
+                }
+                objects++;
+            }
+        }
+    }
+    length += (objects + 7) / 8;
+    record[0] = (unsigned char)length;
+
+    for (k = 0; k < length; k++) {
+        push_byte(b, record[k]);
+    }
+}
+
+static void push_byte(PvsBuilder* b, unsigned char byte)
+{
+    if (b->byte_count == b->capacity) {
+        size_t capacity = b->capacity == 0 ? 4096 : 2 * b->capacity;
+        unsigned char* bytes = (unsigned char*)realloc(b->bytes, capacity);
+
+        if (bytes == NULL) {
+            fprintf(stderr, "Allocating memory for PVS failed.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        b->bytes = bytes;
+        b->capacity = capacity;
+    }
+
+    b->bytes[b->byte_count++] = byte;
+}
+
+static size_t row_words(int cols)
+{
+    return ((size_t)cols + PVS_MAP_BITS - 1) / PVS_MAP_BITS;
+}
+
+static bool map_bit(const Pvs* p, const uint64_t* bitmap, int i, int j)
+{
+    return (bitmap[i * row_words(p->cols) + j / PVS_MAP_BITS] >> (j % PVS_MAP_BITS)) & 1;
+}
+
+static void window_of(const Pvs* p, int i, int j, PvsWindow* w)
+{
+    w->i0 = i - p->radius > 0 ? i - p->radius : 0;
+    w->j0 = j - p->radius > 0 ? j - p->radius : 0;
+    w->rows = (i + p->radius + 1 < p->rows ? i + p->radius + 1 : p->rows) - w->i0;
+    w->cols = (j + p->radius + 1 < p->cols ? j + p->radius + 1 : p->cols) - w->j0;
+}
+
+static int block_bit(const PvsWindow* w, int i, int j)
+{
+    return (i / PVS_BLOCK - w->i0 / PVS_BLOCK) * PVS_BLOCK_SPAN + j / PVS_BLOCK - w->j0 / PVS_BLOCK;
+}
+
+static bool record_fits(const Pvs* p, size_t offset)
+{
+    return offset < p->byte_count && p->bytes[offset] >= 1 + PVS_BLOCK_BYTES
+           && p->bytes[offset] <= p->byte_count - offset;
+}
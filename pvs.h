@@ -0,0 +1,100 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim.h"
+#include "tile_pool.h"
+
+/* Visible sets of a level reach this many cells away, the view distance of the game */
+#define PVS_RADIUS 20
+
+/* Cells without objects are kept visible by blocks of PVS_BLOCK x PVS_BLOCK cells,
+ * as big as the world chunks the game draws whole anyway (WORLD_CHUNK_SIZE) */
+#define PVS_BLOCK 16
+
+/* Words of the biggest window bitset: 2 * PVS_RADIUS + 1 cells on a side */
+#define PVS_WINDOW_WORDS (((2 * PVS_RADIUS + 1) * (2 * PVS_RADIUS + 1) + 31) / 32)
+
+/* Potentially visible set of every walkable (source) cell, computed by mapc.
+ * Visible cells of a source cell are all in its window, the cells at most radius
+ * away that are inside the map. Static geometry is only culled by chunks, so its
+ * cells are kept by blocks, and only cells with objects one by one: the record of
+ * a source is a length byte (the record's), a bit for every block the window
+ * touches, then a bit for every object cell of the window in row order.
+ *
+ * source and object have a bit for every cell, rows starting at whole words.
+ * Records are packed in one byte array in row order, and offset[w] is the record
+ * of the first source in word w of source (the others follow it). headroom of a
+ * level's PVS is how high its objects reach, which the PVS is only valid for.
+ *
+ * Packed PVS, as mapc stores it in a compiled level, is a PvsHeader followed by
+ * source words, object words, offsets and the bytes. A PVS mapped from a level
+ * points right into it */
+typedef struct pvs {
+    int rows, cols;
+    int radius;
+    int headroom;
+    uint64_t* source;
+    uint64_t* object;
+    uint64_t* offset;
+    unsigned char* bytes;
+    size_t byte_count;
+    bool mapped;
+}   Pvs;
+
+typedef struct pvs_header {
+    int32_t rows, cols;
+    int32_t radius, headroom;
+    int32_t block, reserved;
+    uint64_t byte_count;
+}   PvsHeader;
+
+/* Visible cells of one source cell: cells [i0, i0 + rows) x [j0, j0 + cols) of the
+ * map, bit (i - i0) * cols + (j - j0) is set if cell (i, j) is potentially visible,
+ * or its block is for a cell without objects */
+typedef struct pvs_window {
+    int i0, j0;
+    int rows, cols;
+    unsigned bits[PVS_WINDOW_WORDS];
+}   PvsWindow;
+
+/* Computes visible sets for all cells with source[i * cols + j] set, up to radius
+ * (at most PVS_RADIUS) cells away. Cells with object[i * cols + j] set are kept one
+ * by one, the others by blocks.
+ * top[c] is the static column top level of the cell and target_top[c] is the highest
+ * level anything on the cell can reach (moving objects included). A column blocks the
+ * view between two cells only if it is not lower than both the target and the highest
+ * eye position above the source (one level above source column top).
+ * Doors and elevators aren't part of top[], so they never block the view.
+ * Map rows are spread over the workers of the pool. */
+void pvs_build(Pvs* p, const int* top, const int* target_top, const bool* source,
+               const bool* object, int rows, int cols, int radius, TilePool* pool);
+
+/* Computes visible sets of all walkable cells of the level (it has to be in memory,
+ * not streamed), up to PVS_RADIUS cells away, on the workers of the pool. Objects
+ * are seen as high as they reach (sim_object_reach), and the highest of them is
+ * kept as the headroom of the PVS */
+void pvs_build_level(Pvs* p, const SimState* s, TilePool* pool);
+
+/* Returns PVS packed into one allocated block (the caller frees it) of *size bytes */
+void* pvs_pack(const Pvs* p, size_t* size);
+
+/* Maps packed PVS of a rows x cols level whose objects reach headroom cubes high
+ * (sim_object_headroom). Returns false if it's damaged, or built with different
+ * PVS_RADIUS, PVS_BLOCK or headroom */
+bool pvs_map(Pvs* p, const void* data, size_t size, int rows, int cols, int headroom);
+
+/* Unpacks window of visible cells of cell (i, j). Returns false if the cell has no
+ * PVS, or its record is damaged */
+bool pvs_window(const Pvs* p, int i, int j, PvsWindow* w);
+
+/* Returns true if cell (i, j) is in the window's visible set */
+bool pvs_window_test(const PvsWindow* w, int i, int j);
+
+/* Releases PVS data */
+void pvs_free(Pvs* p);
+
+#endif
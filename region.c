@@ -0,0 +1,319 @@
+#include "region.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Error-checking function. Used for technical C details */
+#define osAssert(condition, msg) osError(condition, msg)
+static void osError(bool condition, const char* msg)
+{
+    if (!condition) {
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Connection before it's sorted by region it starts from */
+typedef struct region_link {
+    int from;
+    RegionEdge edge;
+}   RegionLink;
+
+/* Returns true if the cell is walked on as part of a region */
+static bool region_walkable(FieldData field);
+
+/* Gives regions to walkable cells after doors, which already have theirs.
+ * Cells are labelled by runs of walkable cells in a row: a run is joined with runs
+ * of the previous row it touches, and labels are replaced by regions at the end */
+static void label_cells(RegionIndex* r, const SimState* s);
+
+/* Returns provisional label all the labels joined with the given one have */
+static int find_label(int* labels, int label);
+
+/* Adds connection from region from, unless it's to itself */
+static void add_region_link(RegionLink* links, int* count, int from, int to, int door);
+
+/* Joins two sets of regions */
+static void join_regions(RegionIndex* r, int a, int b);
+
+void region_build(RegionIndex* r, const SimState* s)
+{
+    RegionLink* links = NULL;
+    int di[] = {-1, 1, 0, 0};
+    int dj[] = {0, 0, -1, 1};
+    int i, j, k, d, link_count = 0, region;
+    size_t c, cell_count = (size_t)s->rows * s->cols;
+
+    r->rows = s->rows;
+    r->cols = s->cols;
+    r->region_count = 0;
+    r->goal_count = 0;
+    r->door_count = s->door_count;
+
+    r->cells = (int*)malloc(cell_count * sizeof(int));
+    r->door_regions = (int*)malloc((s->door_count + 1) * sizeof(int));
+    osAssert(r->cells != NULL && r->door_regions != NULL,
+             "Allocating memory for map regions failed\n");
+
+    /* Doors first, every one on its own, then regions in row order */
+    for (d = 0; d < s->door_count; d++) {
+        r->door_regions[d] = r->region_count++;
+    }
+    label_cells(r, s);
+
+    /* Goals */
+    for (c = 0; c < cell_count; c++) {
+        if (s->map[0][c].type == 'X') {
+            r->goal_count++;
+        }
+    }
+
+    r->goals = (int*)malloc((r->goal_count + 1) * sizeof(int));
+    osAssert(r->goals != NULL, "Allocating memory for map regions failed\n");
+
+    r->goal_count = 0;
+    for (c = 0; c < cell_count; c++) {
+        if (s->map[0][c].type == 'X' && r->cells[c] >= 0) {
+            r->goals[r->goal_count++] = r->cells[c];
+        }
+    }
+
+    /* Teleports (every link is there both ways) and doors with both of their sides */
+    links = (RegionLink*)malloc((s->link_mask + 1 + 8 * (size_t)s->door_count)
+                                * sizeof(RegionLink));
+    osAssert(links != NULL, "Allocating memory for region connections failed\n");
+
+    for (k = 0; k <= s->link_mask; k++) {
+        const SimLink* l = &s->links[k];
+
+        if (l->cell >= 0 && l->entity < 0) {
+            add_region_link(links, &link_count, r->cells[l->cell], r->cells[l->to], -1);
+        }
+    }
+
+    for (d = 0; d < s->door_count; d++) {
+        for (k = 0; k < 4; k++) {
+            i = s->doors[d].row + di[k];
+            j = s->doors[d].col + dj[k];
+
+            if (i >= 0 && i < s->rows && j >= 0 && j < s->cols
+                && (region = r->cells[i * s->cols + j]) >= 0) {
+                add_region_link(links, &link_count, r->door_regions[d], region, d);
+                add_region_link(links, &link_count, region, r->door_regions[d], d);
+            }
+        }
+    }
+
+    /* Sorting connections by region they start from */
+    r->edge_offsets = (int*)calloc(r->region_count + 1, sizeof(int));
+    r->edges = (RegionEdge*)malloc((link_count + 1) * sizeof(RegionEdge));
+    r->parent = (int*)malloc((r->region_count + 1) * sizeof(int));
+    r->rank = (unsigned char*)malloc(r->region_count + 1);
+    osAssert(r->edge_offsets != NULL && r->edges != NULL && r->parent != NULL && r->rank != NULL,
+             "Allocating memory for region connections failed\n");
+
+    for (k = 0; k < link_count; k++) {
+        r->edge_offsets[links[k].from + 1]++;
+    }
+    for (k = 0; k < r->region_count; k++) {
+        r->edge_offsets[k + 1] += r->edge_offsets[k];
+    }
+
+    /* Parent temporarily keeps where the next connection of every region goes */
+    for (k = 0; k < r->region_count; k++) {
+        r->parent[k] = r->edge_offsets[k];
+    }
+    for (k = 0; k < link_count; k++) {
+        r->edges[r->parent[links[k].from]++] = links[k].edge;
+    }
+
+    free(links);
+
+    region_reset(r);
+}
+
+void region_reset(RegionIndex* r)
+{
+    int k, e;
+
+    for (k = 0; k < r->region_count; k++) {
+        r->parent[k] = k;
+        r->rank[k] = 0;
+    }
+
+    /* Teleports work no matter what */
+    for (k = 0; k < r->region_count; k++) {
+        for (e = r->edge_offsets[k]; e < r->edge_offsets[k + 1]; e++) {
+            if (r->edges[e].door < 0) {
+                join_regions(r, k, r->edges[e].to);
+            }
+        }
+    }
+}
+
+void region_open_door(RegionIndex* r, int door)
+{
+    int region, e;
+
+    if (door < 0 || door >= r->door_count) {
+        return;
+    }
+    region = r->door_regions[door];
+
+    for (e = r->edge_offsets[region]; e < r->edge_offsets[region + 1]; e++) {
+        if (r->edges[e].door == door) {
+            join_regions(r, region, r->edges[e].to);
+        }
+    }
+}
+
+int region_find(const RegionIndex* r, int region)
+{
+    /* Trees are balanced by rank, so they are at most log n deep */
+    while (r->parent[region] != region) {
+        region = r->parent[region];
+    }
+
+    return region;
+}
+
+void region_free(RegionIndex* r)
+{
+    free(r->cells);
+    free(r->door_regions);
+    free(r->edge_offsets);
+    free(r->edges);
+    free(r->goals);
+    free(r->parent);
+    free(r->rank);
+}
+
+static bool region_walkable(FieldData field)
+{
+    return (field.type != 'w' || field.height == 0) && field.type != 'l' && field.type != 'd';
+}
+
+static void label_cells(RegionIndex* r, const SimState* s)
+{
+    int* labels = NULL;
+    int* runs = NULL;
+    int* previous = NULL;
+    int* current = NULL;
+    int* swap = NULL;
+    int label_count = 0, label_capacity = 1024, previous_count = 0, current_count;
+    int i, j, k, m, d, start;
+    size_t c, cell_count = (size_t)s->rows * s->cols;
+
+    /* Runs of a row as start, end and label triples, for this and the previous row */
+    labels = (int*)malloc(label_capacity * sizeof(int));
+    runs = (int*)malloc(2 * 3 * (s->cols / 2 + 1) * sizeof(int));
+    osAssert(labels != NULL && runs != NULL, "Allocating memory for map regions failed\n");
+    previous = runs;
+    current = runs + 3 * (s->cols / 2 + 1);
+
+    for (i = 0; i < s->rows; i++) {
+        const FieldData* row = s->map[i];
+        int* cells = &r->cells[(size_t)i * s->cols];
+
+        current_count = 0;
+        k = 0;
+        for (j = 0; j < s->cols;) {
+            if (!region_walkable(row[j])) {
+                cells[j++] = -1;
+                continue;
+            }
+
+            for (start = j; j < s->cols && region_walkable(row[j]); j++) {
+                cells[j] = label_count;
+            }
+
+            if (label_count == label_capacity) {
+                label_capacity *= 2;
+                labels = (int*)realloc(labels, label_capacity * sizeof(int));
+                osAssert(labels != NULL, "Allocating memory for map regions failed\n");
+            }
+            labels[label_count] = label_count;
+
+            /* Joining with runs of the previous row that share a column with it */
+            while (k < previous_count && previous[3 * k + 1] <= start) {
+                k++;
+            }
+            for (m = k; m < previous_count && previous[3 * m] < j; m++) {
+                int a = find_label(labels, label_count);
+                int b = find_label(labels, previous[3 * m + 2]);
+
+                labels[a > b ? a : b] = a < b ? a : b;
+            }
+
+            current[3 * current_count] = start;
+            current[3 * current_count + 1] = j;
+            current[3 * current_count + 2] = label_count++;
+            current_count++;
+        }
+
+        swap = previous;
+        previous = current;
+        current = swap;
+        previous_count = current_count;
+    }
+
+    /* Every label gets the region of its set, numbered in order of the first label.
+     * Labels only point to smaller ones, which already have their region by then,
+     * kept as -1 - region */
+    for (k = 0; k < label_count; k++) {
+        labels[k] = labels[k] == k ? -1 - r->region_count++ : labels[labels[k]];
+    }
+
+    for (c = 0; c < cell_count; c++) {
+        if (r->cells[c] >= 0) {
+            r->cells[c] = -1 - labels[r->cells[c]];
+        }
+    }
+
+    for (d = 0; d < s->door_count; d++) {
+        r->cells[s->doors[d].row * s->cols + s->doors[d].col] = r->door_regions[d];
+    }
+
+    free(labels);
+    free(runs);
+}
+
+static int find_label(int* labels, int label)
+{
+    /* Halving the path on the way */
+    while (labels[label] != label) {
+        labels[label] = labels[labels[label]];
+        label = labels[label];
+    }
+
+    return label;
+}
+
+static void add_region_link(RegionLink* links, int* count, int from, int to, int door)
+{
+    if (from >= 0 && to >= 0 && from != to) {
+        links[*count].from = from;
+        links[*count].edge.to = to;
+        links[*count].edge.door = door;
+        (*count)++;
+    }
+}
+
+static void join_regions(RegionIndex* r, int a, int b)
+{
+    a = region_find(r, a);
+    b = region_find(r, b);
+
+    if (a == b) {
+        return;
+    }
+
+    /* Lower tree goes under the higher one */
+    if (r->rank[a] < r->rank[b]) {
+        r->parent[a] = b;
+    } else {
+        r->parent[b] = a;
+        if (r->rank[a] == r->rank[b]) {
+            r->rank[a]++;
+        }
+    }
+}
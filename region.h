@@ -0,0 +1,64 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <stdbool.h>
+
+#include "sim.h"
+
+/* Walkable regions of the map and how they connect. A region is a set of cells
+ * connected by walking: everything but walls (except height 0 floors), lava and
+ * doors. Every door that has a key is a region of its own, connected to regions
+ * next to it once its key is gathered. Teleports always connect regions of their cells.
+ *
+ * Regions joined by teleports and open doors are kept in a union-find forest
+ * (union by rank), so opening a door only joins the regions around it and
+ * reachability is a walk up two trees, O(log n) */
+
+/* Connection to region to, through the door with the given index (its key has
+ * to be gathered), or through a teleport if door is -1 */
+typedef struct region_edge {
+    int to;
+    int door;
+}   RegionEdge;
+
+typedef struct region_index {
+    /* Region of every cell, -1 if it can't be walked on */
+    int rows, cols;
+    int* cells;
+    int region_count;
+
+    /* Region of every door cell */
+    int* door_regions;
+    int door_count;
+
+    /* Connections of region k are edges[edge_offsets[k]] up to edges[edge_offsets[k + 1]] */
+    int* edge_offsets;
+    RegionEdge* edges;
+
+    /* Regions of 'X' goal cells */
+    int* goals;
+    int goal_count;
+
+    /* Union-find forest of regions joined so far */
+    int* parent;
+    unsigned char* rank;
+}   RegionIndex;
+
+/* Builds regions of the map of s (it has to be in memory, not streamed) and
+ * their connections, with all doors closed. Exits with a message if there's
+ * no memory for it */
+void region_build(RegionIndex* r, const SimState* s);
+
+/* Closes all doors again */
+void region_reset(RegionIndex* r);
+
+/* Joins regions on both sides of the door with the given index */
+void region_open_door(RegionIndex* r, int door);
+
+/* Returns representative of all regions joined with the given one */
+int region_find(const RegionIndex* r, int region);
+
+/* Releases the index */
+void region_free(RegionIndex* r);
+
+#endif
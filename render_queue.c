@@ -0,0 +1,99 @@
+#include "render_queue.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Initial item capacity of a queue; it doubles whenever it's filled */
+#define RENDER_QUEUE_INITIAL_CAPACITY 256
+
+/* Returns number of material changes needed to draw items in their current order */
+static int count_changes(const RenderQueue* q);
+
+/* Orders items by material, then by depth, then by submission order */
+static int compare_items(const void* a, const void* b);
+
+/* Translucency threshold used by compare_items(), since qsort has no context argument */
+static int sorted_first_translucent;
+
+void render_queue_init(RenderQueue* q, int first_translucent)
+{
+    q->items = NULL;
+    q->count = 0;
+    q->capacity = 0;
+    q->first_translucent = first_translucent;
+    q->unsorted_changes = 0;
+    q->sorted_changes = 0;
+}
+
+void render_queue_push(RenderQueue* q, int material, int object, float depth)
+{
+    if (q->count == q->capacity) {
+        int capacity = q->capacity == 0 ? RENDER_QUEUE_INITIAL_CAPACITY : 2 * q->capacity;
+        RenderItem* items = (RenderItem*)realloc(q->items, capacity * sizeof(RenderItem));
+        if (items == NULL) {
+            fprintf(stderr, "Allocating memory for render queue failed.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        q->items = items;
+        q->capacity = capacity;
+    }
+
+    q->items[q->count].material = material;
+    q->items[q->count].object = object;
+    q->items[q->count].depth = depth;
+    q->items[q->count].order = q->count;
+    q->count++;
+}
+
+void render_queue_sort(RenderQueue* q)
+{
+    q->unsorted_changes = count_changes(q);
+    sorted_first_translucent = q->first_translucent;
+    qsort(q->items, q->count, sizeof(RenderItem), compare_items);
+    q->sorted_changes = count_changes(q);
+}
+
+void render_queue_clear(RenderQueue* q)
+{
+    q->count = 0;
+}
+
+void render_queue_free(RenderQueue* q)
+{
+    free(q->items);
+    render_queue_init(q, q->first_translucent);
+}
+
+static int count_changes(const RenderQueue* q)
+{
+    int changes = 0;
+    int k;
+
+    for (k = 0; k < q->count; k++) {
+        if (k == 0 || q->items[k].material != q->items[k - 1].material) {
+            changes++;
+        }
+    }
+
+    return changes;
+}
+
+static int compare_items(const void* a, const void* b)
+{
+    const RenderItem* x = (const RenderItem*)a;
+    const RenderItem* y = (const RenderItem*)b;
+
+    if (x->material != y->material) {
+        return x->material < y->material ? -1 : 1;
+    }
+
+    if (x->depth != y->depth) {
+        bool closer_first = x->material < sorted_first_translucent;
+
+        return (x->depth < y->depth) == closer_first ? -1 : 1;
+    }
+
+    /* qsort isn't stable, so submission order is compared explicitly */
+    return x->order - y->order;
+}
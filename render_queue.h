@@ -0,0 +1,46 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+/* One draw submission: material (or other render state) it needs,
+ * the object to draw, whose meaning is up to the caller, its distance
+ * from the camera (any monotonic measure) and submission order */
+typedef struct render_item {
+    int material;
+    int object;
+    float depth;
+    int order;
+}   RenderItem;
+
+/* Draw submissions of one frame. Items are collected in any order and
+ * sorted by material before they are drawn, so every material is set once.
+ * Materials from first_translucent on are blended: they are drawn after all
+ * opaque ones and their items back-to-front, while items of opaque materials
+ * go front-to-back so that hidden fragments fail the depth test early */
+typedef struct render_queue {
+    RenderItem* items;
+    int count;
+    int capacity;
+    int first_translucent;
+
+    /* Material changes in submission order and after sorting, for the last sorted frame */
+    int unsorted_changes;
+    int sorted_changes;
+}   RenderQueue;
+
+/* Initializes an empty queue where materials from first_translucent on are translucent */
+void render_queue_init(RenderQueue* q, int first_translucent);
+
+/* Appends submission of the object with the given material and camera distance */
+void render_queue_push(RenderQueue* q, int material, int object, float depth);
+
+/* Sorts submissions by material and then by depth (front-to-back for opaque and
+ * back-to-front for translucent materials) and counts material changes before and after */
+void render_queue_sort(RenderQueue* q);
+
+/* Removes all submissions */
+void render_queue_clear(RenderQueue* q);
+
+/* Releases queue storage */
+void render_queue_free(RenderQueue* q);
+
+#endif
@@ -0,0 +1,1870 @@
+#include "sim.h"
+#include "stream.h"
+#include "region.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Same constants as in main.c */
+#define PI 3.14159265359
+#define EPS 0.01
+
+#define CUBE_SIZE SIM_CUBE_SIZE
+
+/* Error-checking function. Used for technical C details */
+#define osAssert(condition, msg) osError(condition, msg)
+static void osError(bool condition, const char* msg)
+{
+    if (!condition) {
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Number of keys/switches that can be hack-collected with '5' - '8'/'1' - '4' */
+#define SIM_HACK_KEYS 4
+
+/* Collision: the player is kept this far from surfaces it slides along, and the
+ * move is redirected along surfaces at most this many times per tick */
+#define COLLISION_SKIN 0.001
+#define COLLISION_SLIDES 3
+
+/* Points of the way the player takes in one tick: where it started, where it
+ * fell to and where every slide ended. Triggers are checked along all of it */
+#define PATH_POINTS (COLLISION_SLIDES + 2)
+
+/* Compiled level file: header, then links (SimLink hash table), doors (row, col,
+ * key_row, key_col) and elevators (row, col, switch_row, switch_col, levels) as
+ * int32_t, packed PVS (see pvs.h, it may be empty), and cells last: either FieldData row by row, or compressed chunks
+ * (see stream.h) if the level is streamed. Every section starts at an offset
+ * aligned to LEVEL_ALIGNMENT. Numbers are in native byte order; files written
+ * on a machine with a different one are rejected */
+#define LEVEL_MAGIC "TPLEVEL"
+#define LEVEL_VERSION 3
+#define LEVEL_STREAMED 1
+#define LEVEL_BYTE_ORDER 0x01020304
+#define LEVEL_ALIGNMENT 8
+#define LEVEL_DOOR_FIELDS 4
+#define LEVEL_ELEVATOR_FIELDS 5
+
+typedef struct level_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    int32_t rows, cols;
+    int32_t start_row, start_col;
+    int32_t door_count, elevator_count;
+    int32_t link_mask;
+    uint32_t cell_size, link_size;
+    uint32_t flags;
+    uint64_t cells_offset, links_offset;
+    uint64_t doors_offset, elevators_offset;
+    uint64_t pvs_offset, pvs_size;
+    uint64_t file_size;
+}   LevelHeader;
+
+/* Text map files are mapped into memory and parsed in place. The map file is split
+ * into up to PARSE_THREADS parts of at least PARSE_PART_SIZE bytes: every thread
+ * first counts cells starting in its part, and once it's known which cell each part
+ * starts with, parses them right into the map */
+#define PARSE_THREADS 16
+#define PARSE_PART_SIZE (1 << 20)
+
+/* Part of the map file: cells whose text starts in [begin, end) */
+typedef struct map_part {
+    SimState* s;
+    const char* text;
+    const char* text_end;
+    const char* begin;
+    const char* end;
+    size_t first_cell;
+    size_t cells;
+    /* Index of the first cell that couldn't be read, or SIZE_MAX */
+    size_t error;
+    int doors, elevators;
+}   MapPart;
+
+/* Walk through map cells crossed by the segment from (u, v) by (du, dv), in cell
+ * units (u along columns, v along rows), in the order they are crossed (DDA) */
+typedef struct grid_walk {
+    /* Current cell and the number of cells after it */
+    int i, j;
+    int steps;
+    int step_i, step_j;
+    /* Part of the segment at which the next row/column boundary is crossed,
+     * and the part between two boundaries */
+    float next_i, next_j;
+    float delta_i, delta_j;
+}   GridWalk;
+
+/* Function that allocates space for map matrix: row pointers and all cells in one block */
+static FieldData** allocate_map(int rows, int cols);
+
+/* Returns connection of the cell (i, j), or NULL if it's not connected */
+static const SimLink* find_link(const SimState* s, int i, int j);
+
+/* Connects cell (i, j) to cell (to_i, to_j), replacing its old connection */
+static void add_link(SimState* s, int i, int j, int to_i, int to_j, int entity);
+
+/* Returns door or elevator index of the cell (i, j), or -1 if it's not connected
+ * or the index isn't below count */
+static int cell_entity(const SimState* s, int i, int j, int count);
+
+/* Returns true if the type is one of teleport colors */
+static bool is_teleport(char type);
+
+/* Maps the whole file into memory read-only. Returns NULL for an empty file */
+static const char* map_text(const char* file, size_t* size, const char* msg);
+
+/* Returns true for characters that separate values in text map files */
+static bool is_blank(char c);
+
+/* Reads the (optionally negative) integer that follows blanks at *p, up to end,
+ * and moves *p past it. Returns false if there's no integer or it's too big */
+static bool parse_int(const char** p, const char* end, int* value);
+
+/* Counts cells whose text starts in the part (MapPart*) */
+static void* count_cells(void* part);
+
+/* Reads cells of the part (MapPart*) into the map, and counts doors and elevators */
+static void* parse_cells(void* part);
+
+/* Runs work on every part: count - 1 threads and the calling one */
+static void run_parts(MapPart* parts, int count, void* (*work)(void*));
+
+/* Function that stores cube types and their heights, pulled from a .txt file.
+ * Every cell is a type character followed by its height, cells are separated by
+ * blanks. Parts of the file are parsed by several threads */
+static void store_map_data(SimState* s, const char* map_file);
+
+/* Allocates doors, elevators and the list of opening doors for the given counts */
+static void allocate_objects(SimState* s, int doors, int elevators);
+
+/* Finds the first '@' cube from the bottom left. Returns false if there's none */
+static bool find_start(const SimState* s, int* start_row, int* start_col);
+
+/* Puts the player on the center of the starting cube (or in the origin if there's
+ * none) and resets the game */
+static void start_game(SimState* s, int start_row, int start_col);
+
+/* Returns offset rounded up to LEVEL_ALIGNMENT */
+static uint64_t level_align(uint64_t offset);
+
+/* Writes size bytes to the level file */
+static void write_level(FILE* f, const void* data, size_t size);
+
+/* Pads section of the given size to LEVEL_ALIGNMENT */
+static void pad_level(FILE* f, uint64_t size);
+
+/* Returns true if every link of the mapped level is inside the map and
+ * the table has an empty slot, so that lookups end */
+static bool check_level_links(const SimState* s);
+
+/* Returns true if every door, elevator and their key/switch cells of the mapped
+ * level are inside the map, elevators don't rise below their floor, and the
+ * starting cell is either inside the map or (-1, -1), which means there's none */
+static bool check_level_objects(const SimState* s, int start_row, int start_col);
+
+/* Function that stores map field connections and teleport colors.
+ * Key/door and switch/elevator connections become doors and elevators */
+static void store_map_connections(SimState* s, const char* connections_file);
+
+/* Builds walkable regions of the map if they aren't built yet, unless it's streamed */
+static void index_regions(SimState* s);
+
+/* Returns true if (i, j) is inside the map and of the given type */
+static bool cell_is(const SimState* s, int i, int j, char type);
+
+/* Returns how many cubes the elevator on (i, j) rises: from its floor up to
+ * the highest floor next to it, at least one */
+static int elevator_levels(const SimState* s, int i, int j);
+
+/* Puts doors and elevators in their initial state */
+static void reset_objects(SimState* s);
+
+/* Gathering key/switch opens its door/starts its elevator */
+static void gather_key(SimState* s, int door);
+static void gather_switch(SimState* s, SimElevator* e);
+
+/* Marks doors that have sunk completely as open */
+static void finish_doors(SimState* s);
+
+/* Moves player according to the input. The way it took is put in path */
+static void player_movement(SimState* s, const SimInput* input, float scale,
+                            float path[PATH_POINTS][3], int* points);
+
+/* Returns top of the solid column of the cell (i, j): sim_cell_top(), with a door
+ * that isn't open yet sunk as far as it has, and an elevator platform wherever it
+ * has risen to. Returns -INFINITY outside the map */
+static float solid_top(const SimState* s, int i, int j);
+
+/* Sweeps circle of radius r from (x, z) by (dx, dz) against the cell (i, j).
+ * Returns true if it hits it on the way, with the part of the way before the
+ * hit in t and the normal of the hit surface. A circle that already touches
+ * the cell hits it right away if it moves further in, and can always get out */
+static bool sweep_cell(const SimState* s, int i, int j, float x, float z, float dx, float dz,
+                       float r, float* t, float normal[2]);
+
+/* Finds the first solid cell the player sphere hits moving by (dx, dz) from its
+ * position. Only cells next to the ones the move goes through are tested: they
+ * are visited with DDA along the move. Returns false if there's none */
+static bool sweep_player(const SimState* s, float dx, float dz, float* t, float normal[2]);
+
+/* Starts walk from the cell of the point (u, v), moving by (du, dv) */
+static void walk_start(GridWalk* w, float u, float v, float du, float dv);
+
+/* Returns part of the segment at which the walk leaves the current cell (at most 1) */
+static float walk_exit(const GridWalk* w);
+
+/* Steps into the next cell. Returns false if the walk is over */
+static bool walk_next(GridWalk* w);
+
+/* Moves player by move, stopping on top of solid columns and sliding along their sides.
+ * Points the player went through are put in path */
+static void move_player(SimState* s, const float move[3], float path[PATH_POINTS][3], int* points);
+
+/* Appends player position to the path */
+static void add_path_point(const SimState* s, float path[PATH_POINTS][3], int* points);
+
+/* Support function that checks the player height position */
+static bool check_height(const SimState* s, float min_height, float max_height);
+
+/* Checking player position upon position changes: every cell the player went
+ * through on its path is checked in order, and proper effect applied */
+static void check_player_position(SimState* s, float path[PATH_POINTS][3], int points);
+
+/* Applies effect of every cell crossed on the way from `from` to `to`, in order,
+ * until the game is over */
+static void check_player_path(SimState* s, const float from[3], const float to[3]);
+
+/* Applies effect of the cell (i, j), which the player crossed between parts
+ * t_in and t_out of the way from `from` to `to` */
+static void check_cell(SimState* s, int i, int j, const float from[3], const float to[3],
+                       float t_in, float t_out);
+
+/* Support function that checks if player is positioned inside teleport circle */
+static bool check_inside_circle(const SimState* s, int i, int j);
+
+/* Function that handles teleportation if player is on right position
+ * and activates the teleport */
+static void check_teleportation(SimState* s);
+
+void sim_load(SimState* s, const char* dimensions_file, const char* map_file,
+              const char* connections_file)
+{
+    FILE* f = NULL;
+    int start_row, start_col;
+
+    /* Scanning map dimensions */
+    f = fopen(dimensions_file, "r");
+    osAssert(f != NULL, "Error opening map dimensions file\n");
+
+    osAssert(fscanf(f, "%d %d", &s->rows, &s->cols) == 2, "Error reading map dimensions\n");
+    fclose(f);
+
+    /* Storing map data */
+    s->map = allocate_map(s->rows, s->cols);
+    s->stream = NULL;
+    s->level = NULL;
+    s->level_size = 0;
+    s->level_pvs = NULL;
+    s->level_pvs_size = 0;
+    store_map_data(s, map_file);
+    store_map_connections(s, connections_file);
+    s->regions = NULL;
+
+    if (!find_start(s, &start_row, &start_col)) {
+        start_row = start_col = -1;
+    }
+
+    start_game(s, start_row, start_col);
+}
+
+void sim_load_level(SimState* s, const char* level_file)
+{
+    const LevelHeader* header = NULL;
+    const int32_t* doors = NULL;
+    const int32_t* elevators = NULL;
+    FieldData* cells = NULL;
+    struct stat st;
+    uint64_t cells_size;
+    int fd, i, k;
+
+    fd = open(level_file, O_RDONLY);
+    osAssert(fd != -1, "Error opening level file\n");
+    osAssert(fstat(fd, &st) == 0, "Error reading level file size\n");
+
+    if ((size_t)st.st_size < sizeof(LevelHeader)) {
+        fprintf(stderr, "%s is not a level file\n", level_file);
+        exit(EXIT_FAILURE);
+    }
+
+    s->level_size = st.st_size;
+    s->level = mmap(NULL, s->level_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    osAssert(s->level != MAP_FAILED, "Error mapping level file\n");
+
+    header = (const LevelHeader*)s->level;
+    if (memcmp(header->magic, LEVEL_MAGIC, sizeof(LEVEL_MAGIC)) != 0
+        || header->byte_order != LEVEL_BYTE_ORDER) {
+        fprintf(stderr, "%s is not a level file for this machine\n", level_file);
+        exit(EXIT_FAILURE);
+    }
+
+    if (header->version != LEVEL_VERSION || header->cell_size != sizeof(FieldData)
+        || header->link_size != sizeof(SimLink)) {
+        fprintf(stderr, "%s has level format version %u, expected %d: compile it again\n",
+                level_file, header->version, LEVEL_VERSION);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Every section has to be inside the file */
+    cells_size = header->flags & LEVEL_STREAMED ? 0
+               : (uint64_t)header->rows * header->cols * sizeof(FieldData);
+    if (header->rows <= 0 || header->cols <= 0 || header->door_count < 0
+        || header->elevator_count < 0 || header->link_mask < 0
+        || (header->link_mask & (header->link_mask + 1)) != 0
+        || header->file_size != s->level_size
+        || (uint64_t)header->rows * header->cols > INT32_MAX
+        || header->links_offset < sizeof(LevelHeader)
+        || header->links_offset + (uint64_t)(header->link_mask + 1) * sizeof(SimLink)
+           > header->doors_offset
+        || header->doors_offset + (uint64_t)header->door_count * LEVEL_DOOR_FIELDS
+           * sizeof(int32_t) > header->elevators_offset
+        || header->elevators_offset + (uint64_t)header->elevator_count * LEVEL_ELEVATOR_FIELDS
+           * sizeof(int32_t) > header->pvs_offset
+        || header->pvs_size > s->level_size
+        || header->pvs_offset + header->pvs_size > header->cells_offset
+        || header->cells_offset + cells_size > s->level_size
+        || header->links_offset % LEVEL_ALIGNMENT != 0
+        || header->doors_offset % LEVEL_ALIGNMENT != 0
+        || header->elevators_offset % LEVEL_ALIGNMENT != 0
+        || header->pvs_offset % LEVEL_ALIGNMENT != 0) {
+        fprintf(stderr, "%s is damaged\n", level_file);
+        exit(EXIT_FAILURE);
+    }
+
+    s->rows = header->rows;
+    s->cols = header->cols;
+
+    /* The game checks PVS itself (see pvs_map()) */
+    s->level_pvs = header->pvs_size > 0 ? (char*)s->level + header->pvs_offset : NULL;
+    s->level_pvs_size = header->pvs_size;
+
+    if (header->flags & LEVEL_STREAMED) {
+        /* Cells are read chunk by chunk as the player moves */
+        s->map = NULL;
+        s->stream = (WorldStream*)malloc(sizeof(WorldStream));
+        osAssert(s->stream != NULL, "Allocating memory for map stream failed\n");
+
+        if (!stream_open(s->stream, fd, header->cells_offset,
+                         s->level_size - header->cells_offset, s->rows, s->cols)) {
+            fprintf(stderr, "%s has damaged map chunks\n", level_file);
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        /* Rows point right into the file */
+        cells = (FieldData*)((char*)s->level + header->cells_offset);
+        s->map = (FieldData**)malloc(s->rows * sizeof(FieldData*));
+        osAssert(s->map != NULL, "Allocating memory for map matrix failed\n");
+
+        for (i = 0; i < s->rows; i++) {
+            s->map[i] = cells + (size_t)i * s->cols;
+        }
+
+        s->stream = NULL;
+        close(fd);
+    }
+
+    s->links = (SimLink*)((char*)s->level + header->links_offset);
+    s->link_mask = header->link_mask;
+
+    if (!check_level_links(s)) {
+        fprintf(stderr, "%s has damaged connections\n", level_file);
+        exit(EXIT_FAILURE);
+    }
+
+    /* Doors and elevators also keep game state, so they are copied */
+    allocate_objects(s, header->door_count, header->elevator_count);
+    doors = (const int32_t*)((char*)s->level + header->doors_offset);
+    elevators = (const int32_t*)((char*)s->level + header->elevators_offset);
+
+    for (k = 0; k < header->door_count; k++, doors += LEVEL_DOOR_FIELDS) {
+        s->doors[k].row = doors[0];
+        s->doors[k].col = doors[1];
+        s->doors[k].key_row = doors[2];
+        s->doors[k].key_col = doors[3];
+    }
+    s->door_count = header->door_count;
+
+    for (k = 0; k < header->elevator_count; k++, elevators += LEVEL_ELEVATOR_FIELDS) {
+        s->elevators[k].row = elevators[0];
+        s->elevators[k].col = elevators[1];
+        s->elevators[k].switch_row = elevators[2];
+        s->elevators[k].switch_col = elevators[3];
+        s->elevators[k].levels = elevators[4];
+    }
+    s->elevator_count = header->elevator_count;
+
+    if (!check_level_objects(s, header->start_row, header->start_col)) {
+        fprintf(stderr, "%s is damaged\n", level_file);
+        exit(EXIT_FAILURE);
+    }
+
+    s->regions = NULL;
+    start_game(s, header->start_row, header->start_col);
+}
+
+void sim_save_level(const SimState* s, const char* level_file, bool streamed,
+                    const void* pvs, size_t pvs_size)
+{
+    LevelHeader header;
+    FILE* f = NULL;
+    int32_t* objects = NULL;
+    int i, k;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEVEL_MAGIC, sizeof(LEVEL_MAGIC));
+    header.version = LEVEL_VERSION;
+    header.byte_order = LEVEL_BYTE_ORDER;
+    header.flags = streamed ? LEVEL_STREAMED : 0;
+    header.rows = s->rows;
+    header.cols = s->cols;
+    header.door_count = s->door_count;
+    header.elevator_count = s->elevator_count;
+    header.link_mask = s->link_mask;
+    header.cell_size = sizeof(FieldData);
+    header.link_size = sizeof(SimLink);
+
+    if (!find_start(s, &header.start_row, &header.start_col)) {
+        header.start_row = header.start_col = -1;
+    }
+
+    /* Sections follow one another; size of streamed cells is known only once they're written */
+    header.links_offset = level_align(sizeof(LevelHeader));
+    header.doors_offset = level_align(header.links_offset
+                                      + (uint64_t)(s->link_mask + 1) * sizeof(SimLink));
+    header.elevators_offset = level_align(header.doors_offset
+                                          + (uint64_t)s->door_count * LEVEL_DOOR_FIELDS
+                                          * sizeof(int32_t));
+    header.pvs_offset = level_align(header.elevators_offset
+                                    + (uint64_t)s->elevator_count * LEVEL_ELEVATOR_FIELDS
+                                    * sizeof(int32_t));
+    header.pvs_size = pvs != NULL ? pvs_size : 0;
+    header.cells_offset = level_align(header.pvs_offset + header.pvs_size);
+
+    f = fopen(level_file, "wb");
+    osAssert(f != NULL, "Error opening level file\n");
+
+    write_level(f, &header, sizeof(header));
+    pad_level(f, sizeof(header));
+
+    write_level(f, s->links, (s->link_mask + 1) * sizeof(SimLink));
+    pad_level(f, (s->link_mask + 1) * sizeof(SimLink));
+
+    /* Doors and elevators as plain numbers */
+    objects = (int32_t*)malloc(((size_t)s->door_count * LEVEL_DOOR_FIELDS
+                                + (size_t)s->elevator_count * LEVEL_ELEVATOR_FIELDS + 1)
+                               * sizeof(int32_t));
+    osAssert(objects != NULL, "Allocating memory for level objects failed\n");
+
+    for (k = 0; k < s->door_count; k++) {
+        objects[LEVEL_DOOR_FIELDS * k] = s->doors[k].row;
+        objects[LEVEL_DOOR_FIELDS * k + 1] = s->doors[k].col;
+        objects[LEVEL_DOOR_FIELDS * k + 2] = s->doors[k].key_row;
+        objects[LEVEL_DOOR_FIELDS * k + 3] = s->doors[k].key_col;
+    }
+    write_level(f, objects, (size_t)s->door_count * LEVEL_DOOR_FIELDS * sizeof(int32_t));
+    pad_level(f, (size_t)s->door_count * LEVEL_DOOR_FIELDS * sizeof(int32_t));
+
+    for (k = 0; k < s->elevator_count; k++) {
+        objects[LEVEL_ELEVATOR_FIELDS * k] = s->elevators[k].row;
+        objects[LEVEL_ELEVATOR_FIELDS * k + 1] = s->elevators[k].col;
+        objects[LEVEL_ELEVATOR_FIELDS * k + 2] = s->elevators[k].switch_row;
+        objects[LEVEL_ELEVATOR_FIELDS * k + 3] = s->elevators[k].switch_col;
+        objects[LEVEL_ELEVATOR_FIELDS * k + 4] = s->elevators[k].levels;
+    }
+    write_level(f, objects, (size_t)s->elevator_count * LEVEL_ELEVATOR_FIELDS * sizeof(int32_t));
+    pad_level(f, (size_t)s->elevator_count * LEVEL_ELEVATOR_FIELDS * sizeof(int32_t));
+
+    free(objects);
+
+    if (header.pvs_size > 0) {
+        write_level(f, pvs, header.pvs_size);
+        pad_level(f, header.pvs_size);
+    }
+
+    if (streamed) {
+        header.file_size = header.cells_offset + stream_write(f, s);
+    } else {
+        for (i = 0; i < s->rows; i++) {
+            write_level(f, s->map[i], s->cols * sizeof(FieldData));
+        }
+        header.file_size = header.cells_offset + (uint64_t)s->rows * s->cols * sizeof(FieldData);
+    }
+
+    /* Header again, now complete */
+    osAssert(fseek(f, 0, SEEK_SET) == 0, "Error writing level file\n");
+    write_level(f, &header, sizeof(header));
+    osAssert(fclose(f) == 0, "Error writing level file\n");
+}
+
+void sim_free(SimState* s)
+{
+    /* Freeing rows and cells, all at once. Cells and links of a compiled
+     * level belong to the mapped file */
+    free(s->map);
+    s->map = NULL;
+
+    if (s->stream != NULL) {
+        stream_close(s->stream);
+        free(s->stream);
+        s->stream = NULL;
+    }
+
+    if (s->level != NULL) {
+        munmap(s->level, s->level_size);
+        s->level = NULL;
+        s->level_pvs = NULL;
+    } else {
+        free(s->links);
+    }
+    s->links = NULL;
+
+    if (s->regions != NULL) {
+        region_free(s->regions);
+        free(s->regions);
+        s->regions = NULL;
+    }
+
+    free(s->doors);
+    free(s->elevators);
+    free(s->opening);
+    s->doors = NULL;
+    s->elevators = NULL;
+    s->opening = NULL;
+}
+
+void sim_tick(SimState* s, const SimInput* input, float dt)
+{
+    float scale = dt / SIM_TICK;
+    float path[PATH_POINTS][3];
+    int points;
+
+    if (s->status != SIM_PLAYING) {
+        return;
+    }
+
+    /* One-shot actions */
+    if (input->reset) {
+        reset_objects(s);
+    }
+
+    if (input->collect >= 1 && input->collect <= SIM_HACK_KEYS) {
+        if (input->collect - 1 < s->elevator_count) {
+            gather_switch(s, &s->elevators[input->collect - 1]);
+        }
+    } else if (input->collect > SIM_HACK_KEYS && input->collect <= 2 * SIM_HACK_KEYS) {
+        if (input->collect - SIM_HACK_KEYS - 1 < s->door_count) {
+            gather_key(s, input->collect - SIM_HACK_KEYS - 1);
+        }
+    }
+
+    if (input->teleport) {
+        check_teleportation(s);
+    }
+
+    /* Time and animations: objects that aren't moving cost nothing */
+    s->clock += scale;
+    finish_doors(s);
+
+    /* Player */
+    player_movement(s, input, scale, path, &points);
+    check_player_position(s, path, points);
+}
+
+void sim_respawn(SimState* s)
+{
+    reset_objects(s);
+
+    s->position[0] = s->start[0];
+    s->position[1] = s->start[1];
+    s->position[2] = s->start[2];
+
+    s->status = SIM_PLAYING;
+}
+
+bool sim_cell_at(const SimState* s, float x, float z, int* i, int* j)
+{
+    /* Map matrix positions */
+    *i = (int)floor(s->rows + z / CUBE_SIZE);
+    *j = (int)floor(x / CUBE_SIZE);
+
+    return *i >= 0 && *i < s->rows && *j >= 0 && *j < s->cols;
+}
+
+FieldData sim_field(const SimState* s, int i, int j)
+{
+    if (s->map != NULL) {
+        return s->map[i][j];
+    }
+
+    return stream_cell(s->stream, i, j);
+}
+
+int sim_column_top(const SimState* s, int i, int j)
+{
+    FieldData field = sim_field(s, i, j);
+
+    switch (field.type) {
+        case 'w':
+            return field.height;
+
+        case 'l':
+        case '@':
+            return 0;
+
+        default:
+            return field.height > 0 ? field.height - 1 : 0;
+    }
+}
+
+int sim_cell_top(const SimState* s, int i, int j, bool open)
+{
+    FieldData field = sim_field(s, i, j);
+
+    if ((field.type == 'd' && (!open || sim_door(s, i, j) == NULL)) || field.type == 'e') {
+        return field.height;
+    }
+
+    return sim_column_top(s, i, j);
+}
+
+bool sim_has_object(const SimState* s, int i, int j)
+{
+    char type = sim_field(s, i, j).type;
+
+    return type != 'w' && type != 'l' && type != '@';
+}
+
+int sim_object_reach(const SimState* s, int i, int j)
+{
+    const SimElevator* e = sim_elevator(s, i, j);
+
+    if (!sim_has_object(s, i, j)) {
+        return 0;
+    }
+
+    return e != NULL && e->levels > 1 ? e->levels : 1;
+}
+
+int sim_object_headroom(const SimState* s)
+{
+    int k, headroom = 1;
+
+    for (k = 0; k < s->elevator_count; k++) {
+        if (s->elevators[k].levels > headroom) {
+            headroom = s->elevators[k].levels;
+        }
+    }
+
+    return headroom;
+}
+
+const SimLink* sim_link(const SimState* s, int i, int j)
+{
+    return find_link(s, i, j);
+}
+
+int sim_region(SimState* s, int i, int j)
+{
+    index_regions(s);
+    if (s->regions == NULL || i < 0 || i >= s->rows || j < 0 || j >= s->cols) {
+        return -1;
+    }
+
+    return s->regions->cells[i * s->cols + j];
+}
+
+bool sim_reachable(SimState* s, int a, int b)
+{
+    index_regions(s);
+    return s->regions != NULL && a >= 0 && b >= 0
+           && region_find(s->regions, a) == region_find(s->regions, b);
+}
+
+bool sim_goal_reachable(SimState* s)
+{
+    int i, j, k, region;
+
+    if (!sim_cell_at(s, s->position[0], s->position[2], &i, &j)
+        || (region = sim_region(s, i, j)) < 0) {
+        return false;
+    }
+
+    for (k = 0; k < s->regions->goal_count; k++) {
+        if (sim_reachable(s, region, s->regions->goals[k])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool sim_key_gathered(const SimState* s, int i, int j)
+{
+    return cell_is(s, i, j, 'k') && cell_entity(s, i, j, s->door_count) >= 0
+           && s->doors[cell_entity(s, i, j, s->door_count)].has_key;
+}
+
+bool sim_switch_gathered(const SimState* s, int i, int j)
+{
+    return cell_is(s, i, j, 's') && cell_entity(s, i, j, s->elevator_count) >= 0
+           && s->elevators[cell_entity(s, i, j, s->elevator_count)].has_switch;
+}
+
+const SimDoor* sim_door(const SimState* s, int i, int j)
+{
+    if (cell_is(s, i, j, 'd') && cell_entity(s, i, j, s->door_count) >= 0) {
+        return &s->doors[cell_entity(s, i, j, s->door_count)];
+    }
+
+    return NULL;
+}
+
+const SimElevator* sim_elevator(const SimState* s, int i, int j)
+{
+    if (cell_is(s, i, j, 'e') && cell_entity(s, i, j, s->elevator_count) >= 0) {
+        return &s->elevators[cell_entity(s, i, j, s->elevator_count)];
+    }
+
+    return NULL;
+}
+
+double sim_time(const SimState* s)
+{
+    return s->clock - s->reset_clock;
+}
+
+float sim_teleport_angle(const SimState* s)
+{
+    return PI/90 * s->clock;
+}
+
+float sim_door_offset(const SimState* s, const SimDoor* d)
+{
+    if (!d->has_key) {
+        return 0;
+    }
+
+    if (d->open) {
+        return -1;
+    }
+
+    /* Door sinks CUBE_SIZE / 60 per tick */
+    return CUBE_SIZE / 60 * (s->clock - d->start);
+}
+
+float sim_elevator_height(const SimState* s, const SimElevator* e)
+{
+    /* Phase grows by PI/180 per tick */
+    float phase = e->has_switch ? PI/180 * (s->clock - e->start) : 0;
+
+    /* Move parameter in [0, 1], starting at the bottom */
+    return (1 + sin(phase - PI/2)) / 2;
+}
+
+static FieldData** allocate_map(int rows, int cols)
+{
+    FieldData** m = NULL;
+    FieldData* cells = NULL;
+    int i;
+
+    /* Allocating row space, followed by cells of all rows */
+    m = (FieldData**)malloc(rows * sizeof(FieldData*) + (size_t)rows * cols * sizeof(FieldData));
+    osAssert(m != NULL, "Allocating memory for map matrix failed\n");
+
+    cells = (FieldData*)(m + rows);
+    for (i = 0; i < rows; i++) {
+        m[i] = cells + (size_t)i * cols;
+    }
+
+    return m;
+}
+
+static const char* map_text(const char* file, size_t* size, const char* msg)
+{
+    struct stat st;
+    void* text = NULL;
+    int fd;
+
+    fd = open(file, O_RDONLY);
+    osAssert(fd != -1, msg);
+    osAssert(fstat(fd, &st) == 0, msg);
+
+    *size = st.st_size;
+    if (*size > 0) {
+        text = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        osAssert(text != MAP_FAILED, msg);
+        /* Parsing goes through the file once, front to back */
+        madvise(text, *size, MADV_SEQUENTIAL);
+    }
+
+    close(fd);
+
+    return (const char*)text;
+}
+
+static bool is_blank(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+static bool parse_int(const char** p, const char* end, int* value)
+{
+    const char* q = *p;
+    bool negative = false;
+    long long n = 0;
+
+    while (q < end && is_blank(*q)) {
+        q++;
+    }
+
+    if (q < end && *q == '-') {
+        negative = true;
+        q++;
+    }
+
+    if (q == end || *q < '0' || *q > '9') {
+        return false;
+    }
+
+    for (; q < end && *q >= '0' && *q <= '9'; q++) {
+        n = 10 * n + (*q - '0');
+        if (n > INT_MAX) {
+            return false;
+        }
+    }
+
+    if (q < end && !is_blank(*q)) {
+        return false;
+    }
+
+    *value = negative ? -(int)n : (int)n;
+    *p = q;
+
+    return true;
+}
+
+static void* count_cells(void* part)
+{
+    MapPart* m = (MapPart*)part;
+    const char* p = m->begin;
+    bool blank = p == m->text || is_blank(p[-1]);
+
+    /* Cell starts where a blank is followed by something else */
+    m->cells = 0;
+    for (; p < m->end; p++) {
+        if (blank && !is_blank(*p)) {
+            m->cells++;
+        }
+        blank = is_blank(*p);
+    }
+
+    return NULL;
+}
+
+static void* parse_cells(void* part)
+{
+    MapPart* m = (MapPart*)part;
+    SimState* s = m->s;
+    /* Cells of all rows are in one block after row pointers */
+    FieldData* cells = s->map[0];
+    size_t total = (size_t)s->rows * s->cols;
+    size_t k = m->first_cell, last = m->first_cell + m->cells;
+    const char* p = m->begin;
+    int height;
+
+    m->error = SIZE_MAX;
+    m->doors = m->elevators = 0;
+
+    if (last > total) {
+        last = total;
+    }
+
+    for (; k < last; k++) {
+        /* Next cell of the part; the first one might be right at its beginning */
+        while (!(!is_blank(*p) && (p == m->text || is_blank(p[-1])))) {
+            p++;
+        }
+
+        /* Type and height right after it */
+        cells[k].type = *p++;
+        height = 0;
+        if (p == m->text_end || *p < '0' || *p > '9') {
+            m->error = k;
+            return NULL;
+        }
+        for (; p < m->text_end && *p >= '0' && *p <= '9' && height <= 255; p++) {
+            height = 10 * height + (*p - '0');
+        }
+        if (height > 255 || (p < m->text_end && !is_blank(*p))) {
+            m->error = k;
+            return NULL;
+        }
+
+        cells[k].height = height;
+        /* Color is initially the same as type - works for teleport colors */
+        cells[k].color = cells[k].type;
+
+        if (cells[k].type == 'd') {
+            m->doors++;
+        } else if (cells[k].type == 'e') {
+            m->elevators++;
+        }
+    }
+
+    return NULL;
+}
+
+static void run_parts(MapPart* parts, int count, void* (*work)(void*))
+{
+    pthread_t threads[PARSE_THREADS];
+    int i;
+
+    for (i = 0; i < count - 1; i++) {
+        osAssert(pthread_create(&threads[i], NULL, work, &parts[i]) == 0,
+                 "Starting map parsing thread failed\n");
+    }
+
+    work(&parts[count - 1]);
+
+    for (i = 0; i < count - 1; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static void store_map_data(SimState* s, const char* map_file)
+{
+    MapPart parts[PARSE_THREADS];
+    const char* text = NULL;
+    size_t size, total = (size_t)s->rows * s->cols, cells = 0, error = SIZE_MAX;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int count, i, doors = 0, elevators = 0;
+
+    /* Mapping map file */
+    text = map_text(map_file, &size, "Error opening map file\n");
+
+    /* As many threads as there are processors, if there's enough text for them */
+    count = size / PARSE_PART_SIZE + 1;
+    if (count > processors) {
+        count = processors;
+    }
+    if (count > PARSE_THREADS) {
+        count = PARSE_THREADS;
+    }
+    if (count < 1) {
+        count = 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        parts[i].s = s;
+        parts[i].text = text;
+        parts[i].text_end = text + size;
+        parts[i].begin = text + size / count * i;
+        parts[i].end = i == count - 1 ? text + size : text + size / count * (i + 1);
+    }
+
+    /* Counting cells of every part gives the cell every part starts with */
+    run_parts(parts, count, count_cells);
+    for (i = 0; i < count; i++) {
+        parts[i].first_cell = cells;
+        cells += parts[i].cells;
+    }
+
+    if (total > 0) {
+        run_parts(parts, count, parse_cells);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (parts[i].error < error) {
+            error = parts[i].error;
+        }
+        doors += parts[i].doors;
+        elevators += parts[i].elevators;
+    }
+
+    /* Cells past the last one of the map are ignored, missing ones are an error */
+    if (error == SIZE_MAX && cells < total) {
+        error = cells;
+    }
+
+    if (error != SIZE_MAX) {
+        fprintf(stderr, "Error reading map cell (%d, %d)\n",
+                (int)(error / s->cols), (int)(error % s->cols));
+        exit(EXIT_FAILURE);
+    }
+
+    if (size > 0) {
+        munmap((void*)text, size);
+    }
+
+    /* Every door and elevator cell can become at most one entity */
+    allocate_objects(s, doors, elevators);
+}
+
+static void allocate_objects(SimState* s, int doors, int elevators)
+{
+    s->doors = (SimDoor*)malloc((doors + 1) * sizeof(SimDoor));
+    s->elevators = (SimElevator*)malloc((elevators + 1) * sizeof(SimElevator));
+    s->opening = (int*)malloc((doors + 1) * sizeof(int));
+    osAssert(s->doors != NULL && s->elevators != NULL && s->opening != NULL,
+             "Allocating memory for doors and elevators failed\n");
+
+    s->door_count = s->elevator_count = s->opening_count = 0;
+}
+
+static bool find_start(const SimState* s, int* start_row, int* start_col)
+{
+    int i, j;
+
+    for (i = s->rows - 1; i >= 0; i--) {
+        for (j = 0; j < s->cols; j++) {
+            if (s->map[i][j].type == '@') {
+                *start_row = i;
+                *start_col = j;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void start_game(SimState* s, int start_row, int start_col)
+{
+    /* Calculating starting position: center of the starting cube and proper height */
+    s->start[0] = s->start[1] = s->start[2] = 0;
+    if (start_row >= 0 && start_row < s->rows && start_col >= 0 && start_col < s->cols) {
+        s->start[0] = start_col * CUBE_SIZE + CUBE_SIZE / 2;
+        s->start[1] = sim_field(s, start_row, start_col).height * CUBE_SIZE - CUBE_SIZE / 2;
+        s->start[2] = -(s->rows - 1 - start_row) * CUBE_SIZE - CUBE_SIZE / 2;
+    }
+
+    s->speed = 0.15f;
+    s->clock = 0;
+
+    s->front[0] = 0;
+    s->front[1] = 0;
+    s->front[2] = -1;
+
+    sim_respawn(s);
+}
+
+static uint64_t level_align(uint64_t offset)
+{
+    return (offset + LEVEL_ALIGNMENT - 1) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+}
+
+static void write_level(FILE* f, const void* data, size_t size)
+{
+    osAssert(fwrite(data, 1, size, f) == size, "Error writing level file\n");
+}
+
+static void pad_level(FILE* f, uint64_t size)
+{
+    static const char zeros[LEVEL_ALIGNMENT] = {0};
+
+    write_level(f, zeros, level_align(size) - size);
+}
+
+static bool check_level_links(const SimState* s)
+{
+    int cells = s->rows * s->cols;
+    int k;
+    bool empty_found = false;
+
+    /* Entity indices are checked when they're used */
+    for (k = 0; k <= s->link_mask; k++) {
+        const SimLink* link = &s->links[k];
+
+        if (link->cell == -1) {
+            empty_found = true;
+        } else if (link->cell < 0 || link->cell >= cells || link->to < 0 || link->to >= cells) {
+            return false;
+        }
+    }
+
+    return empty_found;
+}
+
+static bool check_level_objects(const SimState* s, int start_row, int start_col)
+{
+    int k;
+
+    for (k = 0; k < s->door_count; k++) {
+        const SimDoor* d = &s->doors[k];
+
+        if (d->row < 0 || d->row >= s->rows || d->col < 0 || d->col >= s->cols
+            || d->key_row < 0 || d->key_row >= s->rows || d->key_col < 0 || d->key_col >= s->cols) {
+            return false;
+        }
+    }
+
+    for (k = 0; k < s->elevator_count; k++) {
+        const SimElevator* e = &s->elevators[k];
+
+        if (e->row < 0 || e->row >= s->rows || e->col < 0 || e->col >= s->cols
+            || e->switch_row < 0 || e->switch_row >= s->rows
+            || e->switch_col < 0 || e->switch_col >= s->cols
+            || e->levels < 0 || e->levels > UCHAR_MAX) {
+            return false;
+        }
+    }
+
+    return (start_row == -1 && start_col == -1)
+           || (start_row >= 0 && start_row < s->rows && start_col >= 0 && start_col < s->cols);
+}
+
+static void store_map_connections(SimState* s, const char* connections_file)
+{
+    const char* text = NULL;
+    const char* p = NULL;
+    const char* end = NULL;
+    size_t size;
+    int n, row1, row2, col1, col2, i, entity;
+    char c;
+
+    /* Mapping map connections file */
+    text = map_text(connections_file, &size, "Error opening map connections file\n");
+    p = text;
+    end = text + size;
+
+    /* Every connection takes more than one character */
+    if (!parse_int(&p, end, &n) || n < 0 || (size_t)n > size) {
+        fprintf(stderr, "Error reading number of map connections\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Table is kept at most half full: every connection links two cells */
+    s->link_mask = 1;
+    while (s->link_mask + 1 < 4 * n) {
+        s->link_mask = 2 * s->link_mask + 1;
+    }
+
+    s->links = (SimLink*)malloc((s->link_mask + 1) * sizeof(SimLink));
+    osAssert(s->links != NULL, "Allocating memory for map connections failed\n");
+
+    for (i = 0; i <= s->link_mask; i++) {
+        s->links[i].cell = -1;
+    }
+
+    /* Scanning data */
+    for (i = 0; i < n; i++) {
+        while (p < end && is_blank(*p)) {
+            p++;
+        }
+        c = p < end ? *p++ : '\0';
+
+        if (c == '\0' || (p < end && !is_blank(*p))
+            || !parse_int(&p, end, &row1) || !parse_int(&p, end, &col1)
+            || !parse_int(&p, end, &row2) || !parse_int(&p, end, &col2)) {
+            fprintf(stderr, "Error reading map connection %d\n", i + 1);
+            exit(EXIT_FAILURE);
+        }
+
+        if (row1 < 0 || row1 >= s->rows || col1 < 0 || col1 >= s->cols
+            || row2 < 0 || row2 >= s->rows || col2 < 0 || col2 >= s->cols) {
+            fprintf(stderr, "Map connection %d is outside the map\n", i + 1);
+            exit(EXIT_FAILURE);
+        }
+
+        entity = -1;
+        if (c == 'z') {
+            /* Key on (row1, col1) opens the door on (row2, col2) */
+            SimDoor* d = &s->doors[s->door_count];
+
+            if (!cell_is(s, row1, col1, 'k') || !cell_is(s, row2, col2, 'd')
+                || cell_entity(s, row1, col1, s->door_count) >= 0
+                || cell_entity(s, row2, col2, s->door_count) >= 0) {
+                fprintf(stderr, "Ignoring map connection %d: no free key on (%d, %d) "
+                        "or door on (%d, %d)\n", i + 1, row1, col1, row2, col2);
+                continue;
+            }
+
+            d->row = row2;
+            d->col = col2;
+            d->key_row = row1;
+            d->key_col = col1;
+            entity = s->door_count++;
+        } else if (c == 'q') {
+            /* Switch on (row1, col1) starts the elevator on (row2, col2) */
+            SimElevator* e = &s->elevators[s->elevator_count];
+
+            if (!cell_is(s, row1, col1, 's') || !cell_is(s, row2, col2, 'e')
+                || cell_entity(s, row1, col1, s->elevator_count) >= 0
+                || cell_entity(s, row2, col2, s->elevator_count) >= 0) {
+                fprintf(stderr, "Ignoring map connection %d: no free switch on (%d, %d) "
+                        "or elevator on (%d, %d)\n", i + 1, row1, col1, row2, col2);
+                continue;
+            }
+
+            e->row = row2;
+            e->col = col2;
+            e->switch_row = row1;
+            e->switch_col = col1;
+            e->levels = elevator_levels(s, row2, col2);
+            entity = s->elevator_count++;
+        }
+
+        /* Connecting teleports, key/doors and switch/elevators */
+        s->map[row1][col1].color = c;
+        add_link(s, row1, col1, row2, col2, entity);
+
+        /* And also backwards! */
+        s->map[row2][col2].color = c;
+        add_link(s, row2, col2, row1, col1, entity);
+    }
+
+    if (size > 0) {
+        munmap((void*)text, size);
+    }
+}
+
+static void index_regions(SimState* s)
+{
+    int k;
+
+    if (s->regions != NULL || s->map == NULL) {
+        return;
+    }
+
+    s->regions = (RegionIndex*)malloc(sizeof(RegionIndex));
+    osAssert(s->regions != NULL, "Allocating memory for map regions failed\n");
+    region_build(s->regions, s);
+
+    /* Catching up with keys gathered before the first query */
+    for (k = 0; k < s->door_count; k++) {
+        if (s->doors[k].has_key) {
+            region_open_door(s->regions, k);
+        }
+    }
+}
+
+static const SimLink* find_link(const SimState* s, int i, int j)
+{
+    int cell = i * s->cols + j;
+    int k = (int)((unsigned)cell * 2654435761u & (unsigned)s->link_mask);
+
+    /* Linear probing until the cell or an empty slot is found */
+    while (s->links[k].cell != -1) {
+        if (s->links[k].cell == cell) {
+            return &s->links[k];
+        }
+        k = (k + 1) & s->link_mask;
+    }
+
+    return NULL;
+}
+
+static void add_link(SimState* s, int i, int j, int to_i, int to_j, int entity)
+{
+    int cell = i * s->cols + j;
+    int k = (int)((unsigned)cell * 2654435761u & (unsigned)s->link_mask);
+
+    while (s->links[k].cell != -1 && s->links[k].cell != cell) {
+        k = (k + 1) & s->link_mask;
+    }
+
+    s->links[k].cell = cell;
+    s->links[k].to = to_i * s->cols + to_j;
+    s->links[k].entity = entity;
+}
+
+static int cell_entity(const SimState* s, int i, int j, int count)
+{
+    const SimLink* link = find_link(s, i, j);
+
+    return link != NULL && link->entity >= 0 && link->entity < count ? link->entity : -1;
+}
+
+static bool cell_is(const SimState* s, int i, int j, char type)
+{
+    return i >= 0 && i < s->rows && j >= 0 && j < s->cols && sim_field(s, i, j).type == type;
+}
+
+static bool is_teleport(char type)
+{
+    return type == 'g' || type == 'b' || type == 'p' || type == 'r'
+           || type == 'm' || type == 'c' || type == 'y' || type == 'o';
+}
+
+static int elevator_levels(const SimState* s, int i, int j)
+{
+    int di[] = {-1, 1, 0, 0};
+    int dj[] = {0, 0, -1, 1};
+    int k, top = s->map[i][j].height + 1;
+
+    /* Walls, lava, doors and other elevators aren't floors one can step on */
+    for (k = 0; k < 4; k++) {
+        int ti = i + di[k];
+        int tj = j + dj[k];
+
+        if (ti >= 0 && ti < s->rows && tj >= 0 && tj < s->cols
+            && s->map[ti][tj].type != 'w' && s->map[ti][tj].type != 'l'
+            && s->map[ti][tj].type != 'd' && s->map[ti][tj].type != 'e'
+            && s->map[ti][tj].height > top) {
+            top = s->map[ti][tj].height;
+        }
+    }
+
+    return top - s->map[i][j].height;
+}
+
+static void reset_objects(SimState* s)
+{
+    int k;
+
+    s->reset_clock = s->clock;
+
+    for (k = 0; k < s->door_count; k++) {
+        s->doors[k].has_key = false;
+        s->doors[k].open = false;
+    }
+    s->opening_count = 0;
+
+    if (s->regions != NULL) {
+        region_reset(s->regions);
+    }
+
+    for (k = 0; k < s->elevator_count; k++) {
+        s->elevators[k].has_switch = false;
+    }
+}
+
+static void gather_key(SimState* s, int door)
+{
+    SimDoor* d = &s->doors[door];
+
+    if (!d->has_key) {
+        d->has_key = true;
+        d->start = s->clock;
+        s->opening[s->opening_count++] = door;
+
+        /* The door is as good as open: nothing can close it before it sinks */
+        if (s->regions != NULL) {
+            region_open_door(s->regions, door);
+        }
+    }
+}
+
+static void gather_switch(SimState* s, SimElevator* e)
+{
+    /* Elevators keep moving once started, but it's all in sim_elevator_height() */
+    if (!e->has_switch) {
+        e->has_switch = true;
+        e->start = s->clock;
+    }
+}
+
+static void finish_doors(SimState* s)
+{
+    int k = 0;
+
+    /* Doors sink one cube (and a bit) and disappear */
+    while (k < s->opening_count) {
+        SimDoor* d = &s->doors[s->opening[k]];
+
+        if (sim_door_offset(s, d) >= CUBE_SIZE + 0.1) {
+            d->open = true;
+            s->opening[k] = s->opening[--s->opening_count];
+        } else {
+            k++;
+        }
+    }
+}
+
+static void player_movement(SimState* s, const SimInput* input, float scale,
+                            float path[PATH_POINTS][3], int* points)
+{
+    float right[3], move[3];
+    float length;
+    int k;
+
+    s->front[0] = input->front[0];
+    s->front[1] = input->front[1];
+    s->front[2] = input->front[2];
+
+    /* Right vector: front x up, normalized */
+    right[0] = -s->front[2];
+    right[1] = 0;
+    right[2] = s->front[0];
+
+    length = sqrt(right[0] * right[0] + right[2] * right[2]);
+    if (length > 0) {
+        right[0] /= length;
+        right[2] /= length;
+    }
+
+    /* Checking movement indicators */
+    for (k = 0; k < 3; k++) {
+        move[k] = (input->forward * s->front[k] + input->right * right[k]) * s->speed * scale;
+    }
+
+    move_player(s, move, path, points);
+}
+
+static float solid_top(const SimState* s, int i, int j)
+{
+    const SimDoor* d = NULL;
+    const SimElevator* e = NULL;
+    FieldData field;
+
+    if (i < 0 || i >= s->rows || j < 0 || j >= s->cols) {
+        return -INFINITY;
+    }
+    field = sim_field(s, i, j);
+    d = field.type == 'd' ? sim_door(s, i, j) : NULL;
+    e = field.type == 'e' ? sim_elevator(s, i, j) : NULL;
+
+    /* Door keeps sinking into its column until it's open */
+    if (d != NULL && !d->open) {
+        return fmax(sim_cell_top(s, i, j, true) * CUBE_SIZE,
+                    field.height * CUBE_SIZE - sim_door_offset(s, d));
+    }
+
+    /* Elevator platform rises levels cubes above its bottom */
+    if (e != NULL) {
+        return (sim_cell_top(s, i, j, false) + e->levels * sim_elevator_height(s, e)) * CUBE_SIZE;
+    }
+
+    return sim_cell_top(s, i, j, d != NULL) * CUBE_SIZE;
+}
+
+static bool sweep_cell(const SimState* s, int i, int j, float x, float z, float dx, float dz,
+                       float r, float* t, float normal[2])
+{
+    /* Cell square, and the same square grown by r on every side */
+    float min_x = j * CUBE_SIZE, max_x = min_x + CUBE_SIZE;
+    float min_z = (i - s->rows) * CUBE_SIZE, max_z = min_z + CUBE_SIZE;
+    float t_enter = -INFINITY, t_exit = INFINITY;
+    float near_x, near_z, distance, hit_x, hit_z, corner_x, corner_z, a, b, c, discriminant;
+    int axis = -1;
+
+    /* Slab test against the grown square */
+    if (dx != 0) {
+        float t1 = (min_x - r - x) / dx, t2 = (max_x + r - x) / dx;
+
+        if (t1 > t2) {
+            float swap = t1;
+            t1 = t2;
+            t2 = swap;
+        }
+        if (t1 > t_enter) {
+            t_enter = t1;
+            axis = 0;
+        }
+        t_exit = t2 < t_exit ? t2 : t_exit;
+    } else if (x <= min_x - r || x >= max_x + r) {
+        return false;
+    }
+
+    if (dz != 0) {
+        float t1 = (min_z - r - z) / dz, t2 = (max_z + r - z) / dz;
+
+        if (t1 > t2) {
+            float swap = t1;
+            t1 = t2;
+            t2 = swap;
+        }
+        if (t1 > t_enter) {
+            t_enter = t1;
+            axis = 1;
+        }
+        t_exit = t2 < t_exit ? t2 : t_exit;
+    } else if (z <= min_z - r || z >= max_z + r) {
+        return false;
+    }
+
+    if (t_enter > t_exit || t_enter > 1 || t_exit <= 0) {
+        return false;
+    }
+
+    /* Circle that already touches the cell only stops moving further into it */
+    near_x = x < min_x ? min_x : (x > max_x ? max_x : x);
+    near_z = z < min_z ? min_z : (z > max_z ? max_z : z);
+    distance = sqrt((x - near_x) * (x - near_x) + (z - near_z) * (z - near_z));
+
+    if (distance <= r) {
+        if (distance > 0) {
+            normal[0] = (x - near_x) / distance;
+            normal[1] = (z - near_z) / distance;
+        } else {
+            /* Center inside the cell: out through the nearest side */
+            float sides[4] = {x - min_x, max_x - x, z - min_z, max_z - z};
+            int side = 0, k;
+
+            for (k = 1; k < 4; k++) {
+                side = sides[k] < sides[side] ? k : side;
+            }
+            normal[0] = side == 0 ? -1 : (side == 1 ? 1 : 0);
+            normal[1] = side == 2 ? -1 : (side == 3 ? 1 : 0);
+        }
+
+        *t = 0;
+        return dx * normal[0] + dz * normal[1] < 0;
+    }
+
+    /* Near the corner of the grown square only the circle around the corner counts */
+    hit_x = x + (t_enter > 0 ? t_enter : 0) * dx;
+    hit_z = z + (t_enter > 0 ? t_enter : 0) * dz;
+
+    if ((hit_x < min_x || hit_x > max_x) && (hit_z < min_z || hit_z > max_z)) {
+        corner_x = hit_x < min_x ? min_x : max_x;
+        corner_z = hit_z < min_z ? min_z : max_z;
+
+        a = dx * dx + dz * dz;
+        b = 2 * ((x - corner_x) * dx + (z - corner_z) * dz);
+        c = (x - corner_x) * (x - corner_x) + (z - corner_z) * (z - corner_z) - r * r;
+        discriminant = b * b - 4 * a * c;
+
+        if (discriminant < 0) {
+            return false;
+        }
+
+        *t = (-b - sqrt(discriminant)) / (2 * a);
+        if (*t < 0 || *t > 1) {
+            return false;
+        }
+
+        normal[0] = (x + *t * dx - corner_x) / r;
+        normal[1] = (z + *t * dz - corner_z) / r;
+        return true;
+    }
+
+    *t = t_enter;
+    normal[0] = axis == 0 ? (dx > 0 ? -1 : 1) : 0;
+    normal[1] = axis == 1 ? (dz > 0 ? -1 : 1) : 0;
+    return true;
+}
+
+static bool sweep_player(const SimState* s, float dx, float dz, float* t, float normal[2])
+{
+    float r = SIM_PLAYER_RADIUS;
+    float bottom = s->position[1] - r;
+    float x = s->position[0], z = s->position[2];
+    float cell_t, cell_normal[2];
+    GridWalk w;
+    int di, dj;
+    bool hit = false;
+
+    *t = 1;
+    walk_start(&w, x / CUBE_SIZE, s->rows + z / CUBE_SIZE, dx / CUBE_SIZE, dz / CUBE_SIZE);
+    do {
+        /* Sphere is smaller than a cell, so it only reaches the neighbours */
+        for (di = -1; di <= 1; di++) {
+            for (dj = -1; dj <= 1; dj++) {
+                if (solid_top(s, w.i + di, w.j + dj) > bottom
+                    && sweep_cell(s, w.i + di, w.j + dj, x, z, dx, dz, r, &cell_t, cell_normal)
+                    && cell_t < *t) {
+                    *t = cell_t;
+                    normal[0] = cell_normal[0];
+                    normal[1] = cell_normal[1];
+                    hit = true;
+                }
+            }
+        }
+
+        /* Cells further on are entered after the hit */
+        if (hit && *t < walk_exit(&w)) {
+            break;
+        }
+    } while (walk_next(&w));
+
+    return hit;
+}
+
+static void walk_start(GridWalk* w, float u, float v, float du, float dv)
+{
+    w->j = (int)floor(u);
+    w->i = (int)floor(v);
+    w->steps = abs((int)floor(u + du) - w->j) + abs((int)floor(v + dv) - w->i);
+    w->step_j = du > 0 ? 1 : -1;
+    w->step_i = dv > 0 ? 1 : -1;
+    w->next_j = du != 0 ? ((du > 0 ? w->j + 1 : w->j) - u) / du : INFINITY;
+    w->next_i = dv != 0 ? ((dv > 0 ? w->i + 1 : w->i) - v) / dv : INFINITY;
+    w->delta_j = du != 0 ? w->step_j / du : INFINITY;
+    w->delta_i = dv != 0 ? w->step_i / dv : INFINITY;
+}
+
+static float walk_exit(const GridWalk* w)
+{
+    float exit = w->next_j < w->next_i ? w->next_j : w->next_i;
+
+    return w->steps > 0 && exit < 1 ? exit : 1;
+}
+
+static bool walk_next(GridWalk* w)
+{
+    if (w->steps-- <= 0) {
+        return false;
+    }
+
+    if (w->next_j < w->next_i) {
+        w->j += w->step_j;
+        w->next_j += w->delta_j;
+    } else {
+        w->i += w->step_i;
+        w->next_i += w->delta_i;
+    }
+
+    return true;
+}
+
+static void move_player(SimState* s, const float move[3], float path[PATH_POINTS][3], int* points)
+{
+    float r = SIM_PLAYER_RADIUS;
+    float dx = move[0], dz = move[2];
+    float y = s->position[1] + move[1];
+    float t, normal[2], along;
+    int i, j, di, dj, k;
+
+    *points = 0;
+    add_path_point(s, path, points);
+
+    /* Rising elevator platform carries the player above it along */
+    if (sim_cell_at(s, s->position[0], s->position[2], &i, &j) && sim_elevator(s, i, j) != NULL
+        && solid_top(s, i, j) > s->position[1] - r && solid_top(s, i, j) < s->position[1] + r) {
+        s->position[1] = solid_top(s, i, j) + r;
+        y = s->position[1] + move[1];
+    }
+
+    /* Falling on a column: the highest one under the sphere that was below it */
+    if (move[1] < 0 && sim_cell_at(s, s->position[0], s->position[2], &i, &j)) {
+        for (di = -1; di <= 1; di++) {
+            for (dj = -1; dj <= 1; dj++) {
+                float top = solid_top(s, i + di, j + dj);
+                float near_x = fmax(j + dj, fmin(s->position[0] / CUBE_SIZE, j + dj + 1));
+                float near_z = fmax(i + di, fmin(s->rows + s->position[2] / CUBE_SIZE, i + di + 1));
+                float distance_x = (near_x - s->position[0] / CUBE_SIZE) * CUBE_SIZE;
+                float distance_z = (near_z - s->rows - s->position[2] / CUBE_SIZE) * CUBE_SIZE;
+
+                if (distance_x * distance_x + distance_z * distance_z < r * r
+                    && top <= s->position[1] - r && top > y - r) {
+                    y = top + r;
+                }
+            }
+        }
+    }
+    s->position[1] = y;
+    add_path_point(s, path, points);
+
+    /* Moving until a side is hit, then along it with what's left of the move */
+    for (k = 0; k < COLLISION_SLIDES && (dx != 0 || dz != 0); k++) {
+        if (!sweep_player(s, dx, dz, &t, normal)) {
+            s->position[0] += dx;
+            s->position[2] += dz;
+            add_path_point(s, path, points);
+            return;
+        }
+
+        s->position[0] += t * dx + normal[0] * COLLISION_SKIN;
+        s->position[2] += t * dz + normal[1] * COLLISION_SKIN;
+        add_path_point(s, path, points);
+
+        dx *= 1 - t;
+        dz *= 1 - t;
+        along = dx * normal[0] + dz * normal[1];
+        dx -= along * normal[0];
+        dz -= along * normal[1];
+    }
+}
+
+static void add_path_point(const SimState* s, float path[PATH_POINTS][3], int* points)
+{
+    path[*points][0] = s->position[0];
+    path[*points][1] = s->position[1];
+    path[*points][2] = s->position[2];
+    (*points)++;
+}
+
+static bool check_height(const SimState* s, float min_height, float max_height)
+{
+    /* Player height validation */
+    return s->position[1] >= min_height && s->position[1] <= max_height;
+}
+
+static void check_player_position(SimState* s, float path[PATH_POINTS][3], int points)
+{
+    int i, j, k;
+    FieldData field;
+
+    /* Every part of the way, so nothing is skipped however fast the player is */
+    for (k = 1; k < points && s->status == SIM_PLAYING; k++) {
+        check_player_path(s, path[k - 1], path[k]);
+    }
+
+    /* Nothing else to check outside the map */
+    if (!sim_cell_at(s, s->position[0], s->position[2], &i, &j)) {
+        return;
+    }
+
+    /* Streamed map keeps loading around the player */
+    if (s->stream != NULL) {
+        stream_focus(s->stream, i, j);
+        field = sim_field(s, i, j);
+
+        /* Player may jump any moment: destination is loaded ahead */
+        if (is_teleport(field.type) && find_link(s, i, j) != NULL) {
+            stream_prefetch(s->stream, find_link(s, i, j)->to / s->cols,
+                            find_link(s, i, j)->to % s->cols);
+        }
+    }
+}
+
+static void check_player_path(SimState* s, const float from[3], const float to[3])
+{
+    GridWalk w;
+    float t_in = 0, t_out;
+
+    walk_start(&w, from[0] / CUBE_SIZE, s->rows + from[2] / CUBE_SIZE,
+               (to[0] - from[0]) / CUBE_SIZE, (to[2] - from[2]) / CUBE_SIZE);
+    do {
+        t_out = walk_exit(&w);
+        if (w.i >= 0 && w.i < s->rows && w.j >= 0 && w.j < s->cols) {
+            check_cell(s, w.i, w.j, from, to, t_in, t_out);
+        }
+        t_in = t_out;
+    } while (s->status == SIM_PLAYING && walk_next(&w));
+}
+
+static void check_cell(SimState* s, int i, int j, const float from[3], const float to[3],
+                       float t_in, float t_out)
+{
+    float min_height, max_height, low, high;
+    float x_center, z_center, dx, dz, a, b, c, discriminant;
+    FieldData field = sim_field(s, i, j);
+
+    /* Only keys, switches, lava and the goal do something when crossed */
+    if (field.type != 'k' && field.type != 's' && field.type != 'l' && field.type != 'X') {
+        return;
+    }
+
+    /* Goal counts only inside its inner circle: the part of the way in the cell is
+     * narrowed to where it's closer to the center than the radius */
+    if (field.type == 'X') {
+        x_center = j * CUBE_SIZE + CUBE_SIZE / 2;
+        z_center = -(s->rows - 1 - i) * CUBE_SIZE - CUBE_SIZE / 2;
+        dx = to[0] - from[0];
+        dz = to[2] - from[2];
+
+        a = dx * dx + dz * dz;
+        b = 2 * ((from[0] - x_center) * dx + (from[2] - z_center) * dz);
+        c = (from[0] - x_center) * (from[0] - x_center) + (from[2] - z_center) * (from[2] - z_center)
+          - (0.75 * CUBE_SIZE / 2) * (0.75 * CUBE_SIZE / 2);
+
+        if (a == 0) {
+            if (c > 0) {
+                return;
+            }
+        } else {
+            discriminant = b * b - 4 * a * c;
+            if (discriminant < 0) {
+                return;
+            }
+            t_in = fmax(t_in, (-b - sqrt(discriminant)) / (2 * a));
+            t_out = fmin(t_out, (-b + sqrt(discriminant)) / (2 * a));
+            if (t_in > t_out) {
+                return;
+            }
+        }
+    }
+
+    /* Heights the player went through in the cell */
+    low = from[1] + t_in * (to[1] - from[1]);
+    high = from[1] + t_out * (to[1] - from[1]);
+    if (low > high) {
+        float swap = low;
+        low = high;
+        high = swap;
+    }
+
+    /* Setting up height interval used for proper height detection */
+    min_height = (field.height - 1) * CUBE_SIZE + CUBE_SIZE / 3;
+    max_height = field.height * CUBE_SIZE + CUBE_SIZE / 2;
+
+    /* If player steps on lava, he dies */
+    if (field.type == 'l' && high >= min_height && low <= max_height + CUBE_SIZE / 3) {
+        s->status = SIM_DIED;
+    } else if (field.type == 'k' && high >= min_height && low <= max_height) {
+        /* Collecting proper key */
+        if (cell_entity(s, i, j, s->door_count) >= 0) {
+            gather_key(s, cell_entity(s, i, j, s->door_count));
+        }
+    } else if (field.type == 's' && high >= min_height && low <= max_height) {
+        /* Collecting proper switch */
+        if (cell_entity(s, i, j, s->elevator_count) >= 0) {
+            gather_switch(s, &s->elevators[cell_entity(s, i, j, s->elevator_count)]);
+        }
+    } else if (field.type == 'X' && high >= min_height && low <= max_height - CUBE_SIZE / 2) {
+        /* Player has passed through white teleport - he wins the game! */
+        s->status = SIM_WON;
+    }
+}
+
+static bool check_inside_circle(const SimState* s, int i, int j)
+{
+    /* Coordinates of the center of the cube */
+    float x_center = j * CUBE_SIZE + CUBE_SIZE / 2;
+    float z_center = -(s->rows - 1 - i) * CUBE_SIZE - CUBE_SIZE / 2;
+
+    /* Player current position */
+    float x_player = s->position[0];
+    float z_player = s->position[2];
+
+    /* Teleport inner radius, squared */
+    float r_in_square = (0.75 * CUBE_SIZE / 2) * (0.75 * CUBE_SIZE / 2);
+
+    /* Player distance, squared */
+    float d_square = (x_player - x_center) * (x_player - x_center)
+                   + (z_player - z_center) * (z_player - z_center);
+
+    return d_square <= r_in_square;
+}
+
+static void check_teleportation(SimState* s)
+{
+    int i, j;
+    float min_height, max_height;
+    FieldData field;
+
+    /* There are no teleports outside the map */
+    if (!sim_cell_at(s, s->position[0], s->position[2], &i, &j)) {
+        return;
+    }
+    field = sim_field(s, i, j);
+
+    /* Setting up height interval used for proper inside-teleport height detection */
+    min_height = (field.height - 1) * CUBE_SIZE + CUBE_SIZE / 3;
+    max_height = field.height * CUBE_SIZE;
+
+    /* Checking player position map type. If teleport, teleports player to proper position */
+    if (is_teleport(field.type) && check_inside_circle(s, i, j)
+        && check_height(s, min_height, max_height) && find_link(s, i, j) != NULL)
+    {
+        int to_row = find_link(s, i, j)->to / s->cols;
+        int to_col = find_link(s, i, j)->to % s->cols;
+
+        /* Calculating next player position via connection of the teleport */
+        s->position[0] = to_col * CUBE_SIZE + CUBE_SIZE / 2;
+        s->position[1] = (sim_field(s, to_row, to_col).height - 1) * CUBE_SIZE + CUBE_SIZE / 2;
+        s->position[2] = -(s->rows - 1 - to_row) * CUBE_SIZE - CUBE_SIZE / 2;
+    }
+}
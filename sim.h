@@ -0,0 +1,244 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Game simulation: map, player, keys/doors and switches/elevators.
+ * It doesn't depend on GL or GLUT, so it can run without a display.
+ * The game advances only through sim_tick(); everything else is a query */
+
+/* Every part of the field is made of cube of fixed size.
+ * All other objects' size are relative to this size */
+#define SIM_CUBE_SIZE 3.6
+
+/* Length of one simulation tick in seconds. Speeds of the player and of all
+ * animations are given per tick. Time is measured in ticks, as a double so that
+ * sim_tick() can also advance it by a fraction of a tick (dt / SIM_TICK) */
+#define SIM_TICK 0.02
+
+/* Radius of the sphere around the camera that collides with walls and closed doors */
+#define SIM_PLAYER_RADIUS (SIM_CUBE_SIZE / 4)
+
+/* Structure that will keep data for every field cube, packed in 3 bytes.
+ * 1) type can be: 'w' - wall, 'l' - lava, 'd' - door, 'e' - elevator,
+ *    'k' - key, 's' - switch, 'X' - goal, '@' - player starting position
+ * 2) color can be: 'r' - red, 'g' - green, 'b' - blue, 'y' - yellow, 'o' - orange,
+ *    'p' - purple, 'c' - cyan, 'm' - magenta. In case of teleports this is also the type
+ * 3) height stores height of the cube: 0 height means floor
+ * Few cubes are connected to others, so connections are kept aside in SimLink table */
+typedef struct field {
+    char type;
+    char color;
+    unsigned char height;
+}   FieldData;
+
+/* Connection of the cube with index cell (row * cols + col) to the cube with index to,
+ * for teleport-teleport, key-door and switch/elevator. entity is the index of the door
+ * (for keys and doors) or elevator (for switches and elevators), -1 for teleports */
+typedef struct sim_link {
+    int cell;
+    int to;
+    int entity;
+}   SimLink;
+
+/* Door on (row, col), opened by the key on (key_row, key_col). Once the key is
+ * gathered (at time start), door sinks into the floor until it's open (gone) */
+typedef struct sim_door {
+    int row, col;
+    int key_row, key_col;
+    bool has_key;
+    bool open;
+    double start;
+}   SimDoor;
+
+/* Elevator on (row, col), started by the switch on (switch_row, switch_col)
+ * at time start. It moves up and down by levels cubes from then on */
+typedef struct sim_elevator {
+    int row, col;
+    int switch_row, switch_col;
+    int levels;
+    bool has_switch;
+    double start;
+}   SimElevator;
+
+/* Game outcome */
+enum sim_status {
+    SIM_PLAYING,
+    SIM_WON,
+    SIM_DIED
+};
+
+/* Player input for one tick */
+typedef struct sim_input {
+    /* Movement: 1 forward/right, -1 backward/left, 0 standing */
+    int forward;
+    int right;
+
+    /* Direction the player looks at (unit vector) */
+    float front[3];
+
+    /* Activates the teleport the player stands in */
+    bool teleport;
+
+    /* Resets keys, switches, doors and elevators */
+    bool reset;
+
+    /* Hack-collecting: 1 - 4 gather the first four switches, 5 - 8 the first
+     * four keys (in map connections file order), 0 nothing */
+    int collect;
+
+    /* Number of the newest input event this input includes, for the caller to tell
+     * when the event is shown (see sim_thread_view()). The game doesn't use it */
+    long sequence;
+}   SimInput;
+
+/* Whole game state */
+typedef struct sim_state {
+    /* Map matrix and its size. Rows point into one contiguous block of cells.
+     * For a streamed level there's no matrix (map is NULL): cells come from stream */
+    FieldData** map;
+    int rows, cols;
+    struct world_stream* stream;
+
+    /* Open addressing hash table of connections, keyed by cell index.
+     * Its size is link_mask + 1, a power of two */
+    SimLink* links;
+    int link_mask;
+
+    /* Walkable regions and what connects them (see region.h), NULL until the first
+     * region query and for a streamed level */
+    struct region_index* regions;
+
+    /* Memory mapped level file that cells and links point into (read-only),
+     * or NULL if the map was read from text files */
+    void* level;
+    size_t level_size;
+
+    /* Packed PVS the level file was compiled with (see pvs.h), or NULL if it has none */
+    const void* level_pvs;
+    size_t level_pvs_size;
+
+    /* Player (camera) position, starting position and look direction */
+    float position[3];
+    float start[3];
+    float front[3];
+
+    /* Player movement per tick */
+    float speed;
+
+    /* Ticks since the map was loaded and the clock at the last reset.
+     * All animations are evaluated from the clock and their start times */
+    double clock;
+    double reset_clock;
+
+    /* Doors and elevators in map connections file order */
+    SimDoor* doors;
+    int door_count;
+    SimElevator* elevators;
+    int elevator_count;
+
+    /* Doors that are sinking: the only objects that need work per tick */
+    int* opening;
+    int opening_count;
+
+    enum sim_status status;
+}   SimState;
+
+/* Reads the map from the dimensions, map and connections files and puts the
+ * player on the starting position. Exits with a message if a file can't be read */
+void sim_load(SimState* s, const char* dimensions_file, const char* map_file,
+              const char* connections_file);
+
+/* Maps compiled level file (see sim_save_level()) and puts the player on the
+ * starting position. Nothing is parsed: cells and connections are used right
+ * from the file. Cells of a streamed level are loaded in chunks around the
+ * player in the background. Exits with a message if the file can't be used */
+void sim_load_level(SimState* s, const char* level_file);
+
+/* Writes map loaded from text files as a compiled level file: grid, connections,
+ * doors, elevators, the starting cell and pvs_size bytes of packed PVS (none if
+ * pvs is NULL). Grid of a streamed level is written in compressed chunks.
+ * Exits with a message if it can't be written */
+void sim_save_level(const SimState* s, const char* level_file, bool streamed,
+                    const void* pvs, size_t pvs_size);
+
+/* Releases the map */
+void sim_free(SimState* s);
+
+/* Advances the game by dt seconds with the given input */
+void sim_tick(SimState* s, const SimInput* input, float dt);
+
+/* Resets objects and puts the player back on the starting position */
+void sim_respawn(SimState* s);
+
+/* Computes map matrix position (i, j) of the point (x, z).
+ * Returns false if the point is outside the map */
+bool sim_cell_at(const SimState* s, float x, float z, int* i, int* j);
+
+/* Returns cell (i, j) of the map. Cell of a streamed level that isn't loaded yet
+ * is waited for */
+FieldData sim_field(const SimState* s, int i, int j);
+
+/* Returns level of the static column top on (i, j), in cubes: walls are full
+ * height, lava and the starting cell only floor, and every other cell one cube
+ * lower than its height, with its object (door, elevator, key, switch or teleport)
+ * on top */
+int sim_column_top(const SimState* s, int i, int j);
+
+/* Returns level in cubes the player has to be above to cross (i, j) once nothing
+ * on it moves: the column top, or the door on it while it isn't open (one without
+ * a key never opens), or the elevator platform at its bottom. Player collision
+ * and the solver both step by it */
+int sim_cell_top(const SimState* s, int i, int j, bool open);
+
+/* Returns true if there's an object on (i, j) that moves or animates above its column */
+bool sim_has_object(const SimState* s, int i, int j);
+
+/* Returns how many cubes above its cell the object on (i, j) can get, over the
+ * one cube it takes on the column top: an elevator rises by its levels, anything
+ * else stays within one cube. Returns 0 if there's no object */
+int sim_object_reach(const SimState* s, int i, int j);
+
+/* Returns the highest sim_object_reach() of the level's objects */
+int sim_object_headroom(const SimState* s);
+
+/* Returns connection of the cell (i, j), or NULL if it isn't connected */
+const SimLink* sim_link(const SimState* s, int i, int j);
+
+/* Region queries. The region index is built on the first of them, so a game
+ * that never asks doesn't pay for it */
+
+/* Returns walkable region of the cell (i, j), or -1 if it can't be walked on
+ * (or the level is streamed) */
+int sim_region(SimState* s, int i, int j);
+
+/* Returns true if region b can be reached from region a through teleports and
+ * doors whose keys are gathered so far */
+bool sim_reachable(SimState* s, int a, int b);
+
+/* Returns true if the goal can be reached from the player's position through
+ * teleports and doors whose keys are gathered so far */
+bool sim_goal_reachable(SimState* s);
+
+/* Returns true if the key/switch on (i, j) is gathered */
+bool sim_key_gathered(const SimState* s, int i, int j);
+bool sim_switch_gathered(const SimState* s, int i, int j);
+
+/* Returns door/elevator on (i, j) or NULL if there is none */
+const SimDoor* sim_door(const SimState* s, int i, int j);
+const SimElevator* sim_elevator(const SimState* s, int i, int j);
+
+/* Returns ticks since the last reset; keys and switches spin with it */
+double sim_time(const SimState* s);
+
+/* Returns rotation angle of teleport lines */
+float sim_teleport_angle(const SimState* s);
+
+/* Returns how deep the door has sunk, or -1 once it's open */
+float sim_door_offset(const SimState* s, const SimDoor* d);
+
+/* Returns elevator height in [0, 1] of its path */
+float sim_elevator_height(const SimState* s, const SimElevator* e);
+
+#endif
@@ -0,0 +1,216 @@
+#include "sim_thread.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* Player moving further than this in one tick has jumped (teleport, respawn):
+ * such a move is shown at once instead of interpolated across the map */
+#define SIM_THREAD_JUMP SIM_CUBE_SIZE
+
+/* Error-checking function. Used for technical C details */
+#define osAssert(condition, msg) osError(condition, msg)
+static void osError(bool condition, const char* msg)
+{
+    if (!condition) {
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Simulation thread: ticks at a fixed rate until it's stopped */
+static void* run_ticks(void* arg);
+
+/* Copies the game into the thread's slot, then swaps it with the published slot.
+ * previous and previous_clock are position and clock before the last tick, and
+ * input_sequence is sequence of the input it took */
+static void publish(SimThread* t, const float previous[3], double previous_clock,
+                    long input_sequence);
+
+/* Returns monotonic time in seconds */
+static double now();
+
+void sim_thread_start(SimThread* t, SimState* s)
+{
+    int k;
+
+    t->sim = s;
+
+    memset(&t->input, 0, sizeof(t->input));
+    t->input.front[0] = s->front[0];
+    t->input.front[1] = s->front[1];
+    t->input.front[2] = s->front[2];
+    pthread_mutex_init(&t->input_lock, NULL);
+
+    /* Every slot has its own doors and elevators: they change while playing */
+    for (k = 0; k < SIM_THREAD_SLOTS; k++) {
+        t->slots[k].state.doors = (SimDoor*)malloc((s->door_count + 1) * sizeof(SimDoor));
+        t->slots[k].state.elevators =
+            (SimElevator*)malloc((s->elevator_count + 1) * sizeof(SimElevator));
+        osAssert(t->slots[k].state.doors != NULL && t->slots[k].state.elevators != NULL,
+                 "Allocating memory for game snapshots failed\n");
+    }
+
+    t->back = 0;
+    atomic_init(&t->middle, 1);
+    t->front = 2;
+    atomic_init(&t->quit, false);
+    atomic_init(&t->ticks, 0);
+    atomic_init(&t->dropped, 0);
+
+    /* Reader has something to show right away */
+    publish(t, s->position, s->clock, 0);
+
+    osAssert(pthread_create(&t->thread, NULL, run_ticks, t) == 0,
+             "Error starting simulation thread\n");
+}
+
+void sim_thread_stop(SimThread* t)
+{
+    int k;
+
+    atomic_store(&t->quit, true);
+    pthread_join(t->thread, NULL);
+    pthread_mutex_destroy(&t->input_lock);
+
+    for (k = 0; k < SIM_THREAD_SLOTS; k++) {
+        free(t->slots[k].state.doors);
+        free(t->slots[k].state.elevators);
+    }
+}
+
+void sim_thread_input(SimThread* t, const SimInput* input)
+{
+    pthread_mutex_lock(&t->input_lock);
+
+    t->input.forward = input->forward;
+    t->input.right = input->right;
+    t->input.front[0] = input->front[0];
+    t->input.front[1] = input->front[1];
+    t->input.front[2] = input->front[2];
+
+    t->input.teleport = t->input.teleport || input->teleport;
+    t->input.reset = t->input.reset || input->reset;
+    if (input->collect != 0) {
+        t->input.collect = input->collect;
+    }
+    t->input.sequence = input->sequence;
+
+    pthread_mutex_unlock(&t->input_lock);
+}
+
+long sim_thread_view(SimThread* t, SimState* view)
+{
+    const SimSnapshot* snapshot = NULL;
+    double alpha;
+    int k;
+
+    /* Taking the newest snapshot, if there's one not taken yet */
+    if (atomic_load(&t->middle) & SIM_THREAD_FRESH) {
+        t->front = atomic_exchange(&t->middle, t->front) & ~SIM_THREAD_FRESH;
+    }
+    snapshot = &t->slots[t->front];
+
+    /* Drawing runs a tick behind, so that there's always a tick to move towards */
+    alpha = (now() - snapshot->time) / SIM_TICK;
+    alpha = alpha < 0 ? 0 : (alpha > 1 ? 1 : alpha);
+
+    *view = snapshot->state;
+    for (k = 0; k < 3; k++) {
+        view->position[k] = snapshot->previous[k]
+                            + alpha * (snapshot->state.position[k] - snapshot->previous[k]);
+    }
+    view->clock = snapshot->previous_clock
+                  + alpha * (snapshot->state.clock - snapshot->previous_clock);
+
+    return snapshot->input_sequence;
+}
+
+static void* run_ticks(void* arg)
+{
+    SimThread* t = (SimThread*)arg;
+    SimInput input;
+    struct timespec wake;
+    double deadline = now(), late;
+    float previous[3];
+    double previous_clock;
+
+    while (!atomic_load(&t->quit)) {
+        deadline += SIM_TICK;
+        wake.tv_sec = (time_t)deadline;
+        wake.tv_nsec = (long)((deadline - wake.tv_sec) * 1e9);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+        }
+
+        /* Ticks that are late run back to back, but a long stall isn't made up for */
+        late = now() - deadline;
+        if (late > SIM_THREAD_CATCHUP * SIM_TICK) {
+            atomic_fetch_add(&t->dropped, (long)(late / SIM_TICK));
+            deadline = now();
+        }
+
+        /* One-shot actions happen on one tick only */
+        pthread_mutex_lock(&t->input_lock);
+        input = t->input;
+        t->input.teleport = false;
+        t->input.reset = false;
+        t->input.collect = 0;
+        pthread_mutex_unlock(&t->input_lock);
+
+        previous[0] = t->sim->position[0];
+        previous[1] = t->sim->position[1];
+        previous[2] = t->sim->position[2];
+        previous_clock = t->sim->clock;
+
+        sim_tick(t->sim, &input, SIM_TICK);
+        atomic_fetch_add(&t->ticks, 1);
+
+        publish(t, previous, previous_clock, input.sequence);
+    }
+
+    return NULL;
+}
+
+static void publish(SimThread* t, const float previous[3], double previous_clock,
+                    long input_sequence)
+{
+    const SimState* s = t->sim;
+    SimSnapshot* snapshot = &t->slots[t->back];
+    SimDoor* doors = snapshot->state.doors;
+    SimElevator* elevators = snapshot->state.elevators;
+    float dx = s->position[0] - previous[0];
+    float dy = s->position[1] - previous[1];
+    float dz = s->position[2] - previous[2];
+
+    memcpy(doors, s->doors, s->door_count * sizeof(SimDoor));
+    memcpy(elevators, s->elevators, s->elevator_count * sizeof(SimElevator));
+
+    snapshot->state = *s;
+    snapshot->state.doors = doors;
+    snapshot->state.elevators = elevators;
+    snapshot->state.regions = NULL;
+    snapshot->state.opening = NULL;
+    snapshot->state.opening_count = 0;
+
+    if (dx * dx + dy * dy + dz * dz > SIM_THREAD_JUMP * SIM_THREAD_JUMP) {
+        previous = s->position;
+    }
+    snapshot->previous[0] = previous[0];
+    snapshot->previous[1] = previous[1];
+    snapshot->previous[2] = previous[2];
+    snapshot->previous_clock = previous_clock;
+    snapshot->time = now();
+    snapshot->input_sequence = input_sequence;
+
+    t->back = atomic_exchange(&t->middle, t->back | SIM_THREAD_FRESH) & ~SIM_THREAD_FRESH;
+}
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,81 @@
+#ifndef SIM_THREAD_H
+#define SIM_THREAD_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "sim.h"
+
+/* Game simulation running on its own thread, one tick every SIM_TICK seconds,
+ * however long frames take. After every tick the thread publishes a snapshot of
+ * the game through a triple buffer: it always has a slot of its own to write,
+ * the reader always has the newest complete one, and neither waits for the other.
+ *
+ * Snapshot is a SimState that shares the map and connections (which don't change
+ * while playing) with the simulation and has its own copy of doors and elevators,
+ * so all sim_* queries work on it. It has no regions and no doors to open */
+
+#define SIM_THREAD_SLOTS 3
+
+/* Bit of the shared slot index telling the slot hasn't been read yet */
+#define SIM_THREAD_FRESH 4
+
+/* Ticks the thread catches up at most after falling behind; older time is dropped */
+#define SIM_THREAD_CATCHUP 5
+
+typedef struct sim_snapshot {
+    SimState state;
+
+    /* Player position and clock after the tick before, to interpolate from */
+    float previous[3];
+    double previous_clock;
+
+    /* Monotonic time the snapshot was published at, in seconds */
+    double time;
+
+    /* Sequence of the input the tick took (see SimInput) */
+    long input_sequence;
+}   SimSnapshot;
+
+typedef struct sim_thread {
+    /* Simulation, owned by the thread until it's stopped */
+    SimState* sim;
+
+    /* Slot written by the thread, slot last published (with SIM_THREAD_FRESH
+     * until the reader takes it) and slot read by the reader */
+    SimSnapshot slots[SIM_THREAD_SLOTS];
+    int back;
+    atomic_int middle;
+    int front;
+
+    /* Input for the next tick. One-shot actions are kept until a tick uses them */
+    SimInput input;
+    pthread_mutex_t input_lock;
+
+    pthread_t thread;
+    atomic_bool quit;
+
+    /* Ticks run and ticks dropped after falling too far behind (the game shows
+     * both with its frame statistics) */
+    atomic_long ticks;
+    atomic_long dropped;
+}   SimThread;
+
+/* Publishes the first snapshot and starts running s on a new thread. From then on
+ * s belongs to the thread: it's read only through snapshots */
+void sim_thread_start(SimThread* t, SimState* s);
+
+/* Stops the thread and frees snapshots; s can be used directly again */
+void sim_thread_stop(SimThread* t);
+
+/* Sets input for the next ticks. One-shot actions are added to those not used yet */
+void sim_thread_input(SimThread* t, const SimInput* input);
+
+/* Fills view with the game as it should be drawn now: the newest snapshot, with
+ * player position and clock interpolated from the tick before it by the time since
+ * it was published. View stays valid until the next call. Returns sequence of the
+ * newest input the snapshot's tick took: every input up to it shows in the view */
+long sim_thread_view(SimThread* t, SimState* view);
+
+#endif
@@ -0,0 +1,874 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sim.h"
+
+/* Level solver: finds the shortest route from the starting position to the 'X'
+ * goal, or tells that there's none. Moves are taken on the map grid, the way the
+ * game moves the player: it flies along where it looks, and a cell only stops it
+ * below the cell top (sim_cell_top(), the same the game collides with):
+ *  - stepping to one of the four neighbours, over its top and down onto it. The
+ *    game doesn't limit how high the player rises, so walls and closed doors are
+ *    flown over, and lava is crossed a cube above its height, where it doesn't
+ *    kill. With -c climb, the level is solved as if it was walked: the player
+ *    rises at most climb cubes above the top it stands on, and never enters lava
+ *    or walls (except height 0 floors)
+ *  - stepping on a key/switch gathers it: its door is open, its elevator moving
+ *  - teleporting from a connected teleport to its destination
+ *  - riding a moving elevator one cube up or down
+ * Heights are cell tops in cubes: a cell is stood on at its top, a moving elevator
+ * anywhere from its bottom up to levels cubes above it, and it can be boarded at
+ * any of them the player can step to.
+ *
+ * State is the player cell and height in the first word, followed by a bitset of
+ * gathered keys (door order) and switches (elevator order); that is all that
+ * changes during the game. Breadth first search expands every frontier on several
+ * threads, which only read the visited states, and then adds new states on one
+ * thread, so the first route found is the shortest one.
+ *
+ * Gathering never takes a move away, so a state is skipped if a state on the same
+ * position with all of its keys and switches (and maybe more) is already visited:
+ * it was reached no later, and can do everything this one can. Still, every detour
+ * for a key would be searched with and without it, so dead ends are filled first:
+ * a route never goes into them, and keys and switches of doors and elevators in
+ * them get no state bits. In a maze, only keys on the way to the goal are left.
+ * Without a climb limit no key or switch does, as nothing stops a flying player
+ *
+ * Usage: solver [-c climb] [level_file | dimensions_file map_file connections_file]
+ * Without files, the map is read from the files the game reads by default */
+
+/* How many cubes the player can rise above the top it stands on: the game doesn't
+ * limit it (-1) */
+#define SOLVER_CLIMB -1
+
+/* Expanding threads, and frontier states there have to be for every thread */
+#define SOLVER_THREADS 16
+#define SOLVER_THREAD_STATES 1024
+
+/* Visited states: words per state each, in the order they were found.
+ * Table is open addressing hash of positions, kept at most half full, to the
+ * latest state on the position; the others on it are linked through next */
+typedef struct solver {
+    const SimState* s;
+    int climb;
+    int words;
+
+    /* Filled dead end cells, and state bit of every door (then elevator), or -1
+     * if it's filled and its key (switch) doesn't matter */
+    unsigned char* filled;
+    int* item_bits;
+    int bit_count;
+
+    uint64_t* states;
+    int64_t* parents;
+    int64_t* next;
+    size_t state_count, state_capacity;
+
+    int64_t* table;
+    size_t table_mask, position_count;
+}   Solver;
+
+/* States found by one thread from its part of the frontier */
+typedef struct expansion {
+    Solver* solver;
+    const int64_t* frontier;
+    size_t first, last;
+
+    uint64_t* states;
+    int64_t* parents;
+    size_t count, capacity;
+}   Expansion;
+
+/* Returns monotonic time in seconds */
+static double now();
+
+/* Packs position into the first state word and back */
+static uint64_t pack_position(int cell, int height);
+static void unpack_position(uint64_t word, int* cell, int* height);
+
+/* Returns true if the key of the door/switch of the elevator (item door_count +
+ * elevator) is gathered in state, and gathers it */
+static bool gathered(const Solver* v, const uint64_t* state, int item);
+static void gather(const Solver* v, uint64_t* state, int item);
+
+/* Returns true if the player standing at height from can rise to height to */
+static bool can_rise(const Solver* v, int from, int to);
+
+/* Returns the highest top the player might stand at on (i, j) */
+static int highest_top(const SimState* s, int i, int j);
+
+/* Returns true if (i, j) can be walked on: it isn't lava or a wall higher than floor */
+static bool walked_on(const SimState* s, int i, int j);
+
+/* Returns true if the door/elevator on (i, j) can change where the player goes: the
+ * door stops it from a neighbour while it's closed, or the elevator lifts it to a
+ * neighbour that it can't climb to from the elevator bottom */
+static bool item_matters(const Solver* v, int i, int j);
+
+/* Returns true if (i, j) is inside the map, not filled, and might ever be entered:
+ * always without a climb limit, and with it if it isn't lava or a wall and its top
+ * can be climbed to from a neighbour */
+static bool open_cell(const Solver* v, int i, int j);
+
+/* Returns true if (i, j) is open, has at most one open neighbour and is neither
+ * the start, the goal, a teleport nor a key/switch of an open door/elevator */
+static bool dead_end(const Solver* v, int i, int j, int start_cell);
+
+/* Fills dead ends until there are none, and gives state bits to doors and
+ * elevators that are left open */
+static void fill_dead_ends(Solver* v, int start_cell);
+
+/* Returns table slot of the position: the one with its states, or an empty one */
+static size_t find_position(const Solver* v, uint64_t position);
+
+/* Returns true if state a has every key and switch state b has */
+static bool covers(const Solver* v, const uint64_t* a, const uint64_t* b);
+
+/* Returns true if a visited state covers the state on its position */
+static bool dominated(const Solver* v, const uint64_t* state);
+
+/* Adds the state reached from the parent state, dropping states on its position
+ * that it covers from further checks. Returns its index */
+static int64_t add_state(Solver* v, const uint64_t* state, int64_t parent);
+
+/* Returns height the player stands at on (i, j) in state, after coming from
+ * height from, or -1 if the cell can't be entered. Lava is flown over instead,
+ * and moving elevator can also be boarded lower, down to its bottom */
+static int enter_height(const Solver* v, const uint64_t* state, int i, int j, int from);
+
+/* Returns door/elevator connected to the key/switch on (i, j), or -1 */
+static int item_entity(const SimState* s, int i, int j, char type, int count);
+
+/* Returns true if the elevator on (i, j) is moving in state, and its range */
+static bool elevator_moving(const Solver* v, const uint64_t* state, int i, int j,
+                            int* bottom, int* top);
+
+/* Adds successor to the expansion, unless it's already visited */
+static void add_successor(Expansion* x, const uint64_t* state, int64_t parent);
+
+/* Expands the part of the frontier (Expansion*) */
+static void* expand_states(void* expansion);
+
+/* Prints route to the state */
+static void print_route(const Solver* v, int64_t goal);
+
+int main(int argc, char** argv)
+{
+    SimState sim;
+    Solver v;
+    Expansion expansions[SOLVER_THREADS];
+    pthread_t threads[SOLVER_THREADS];
+    int64_t* frontier = NULL;
+    int64_t* next = NULL;
+    int64_t goal = -1;
+    size_t frontier_count, next_count, k;
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    int start_row, start_col, depth = 0, count, t;
+    uint64_t* start = NULL;
+    double start_time, seconds;
+    char** files = argv + 1;
+    int file_count;
+
+    v.climb = SOLVER_CLIMB;
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        v.climb = atoi(argv[2]);
+        files += 2;
+    }
+
+    file_count = argc - (int)(files - argv);
+    if (file_count != 0 && file_count != 1 && file_count != 3) {
+        fprintf(stderr, "Usage: %s [-c climb] [level_file | "
+                "dimensions_file map_file connections_file]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (file_count == 0) {
+        sim_load(&sim, "map_dimensions.txt", "map.txt", "map_connections.txt");
+    } else if (file_count == 1) {
+        sim_load_level(&sim, files[0]);
+    } else {
+        sim_load(&sim, files[0], files[1], files[2]);
+    }
+
+    if (!sim_cell_at(&sim, sim.start[0], sim.start[2], &start_row, &start_col)) {
+        fprintf(stderr, "Map has no starting position\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Visited states */
+    v.s = &sim;
+    fill_dead_ends(&v, start_row * sim.cols + start_col);
+    v.words = 1 + (v.bit_count + 63) / 64;
+    v.state_capacity = 1024;
+    v.state_count = 0;
+    v.states = (uint64_t*)malloc(v.state_capacity * v.words * sizeof(uint64_t));
+    v.parents = (int64_t*)malloc(v.state_capacity * sizeof(int64_t));
+    v.next = (int64_t*)malloc(v.state_capacity * sizeof(int64_t));
+    v.table_mask = 1023;
+    v.position_count = 0;
+    v.table = (int64_t*)malloc((v.table_mask + 1) * sizeof(int64_t));
+    start = (uint64_t*)calloc(v.words, sizeof(uint64_t));
+    if (v.states == NULL || v.parents == NULL || v.next == NULL || v.table == NULL
+        || start == NULL) {
+        fprintf(stderr, "Allocating memory for solver states failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0; k <= v.table_mask; k++) {
+        v.table[k] = -1;
+    }
+
+    start[0] = pack_position(start_row * sim.cols + start_col,
+                             sim_cell_top(&sim, start_row, start_col, false));
+    add_state(&v, start, -1);
+
+    frontier = (int64_t*)malloc(sizeof(int64_t));
+    frontier[0] = 0;
+    frontier_count = 1;
+
+    for (t = 0; t < SOLVER_THREADS; t++) {
+        expansions[t].solver = &v;
+        expansions[t].capacity = 0;
+        expansions[t].states = NULL;
+        expansions[t].parents = NULL;
+    }
+
+    start_time = now();
+    while (frontier_count > 0 && goal < 0) {
+        /* Expanding: as many threads as there are processors and states for them */
+        count = frontier_count / SOLVER_THREAD_STATES + 1;
+        if (count > processors) {
+            count = processors;
+        }
+        if (count > SOLVER_THREADS) {
+            count = SOLVER_THREADS;
+        }
+        if (count < 1) {
+            count = 1;
+        }
+
+        for (t = 0; t < count; t++) {
+            expansions[t].frontier = frontier;
+            expansions[t].first = frontier_count / count * t;
+            expansions[t].last = t == count - 1 ? frontier_count : frontier_count / count * (t + 1);
+        }
+        for (t = 0; t < count - 1; t++) {
+            if (pthread_create(&threads[t], NULL, expand_states, &expansions[t]) != 0) {
+                fprintf(stderr, "Starting solver thread failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        expand_states(&expansions[count - 1]);
+        for (t = 0; t < count - 1; t++) {
+            pthread_join(threads[t], NULL);
+        }
+
+        /* Adding new states: the same state might have been found by several threads */
+        next_count = 0;
+        for (t = 0; t < count; t++) {
+            next_count += expansions[t].count;
+        }
+        next = (int64_t*)malloc((next_count + 1) * sizeof(int64_t));
+        if (next == NULL) {
+            fprintf(stderr, "Allocating memory for solver frontier failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        next_count = 0;
+        for (t = 0; t < count && goal < 0; t++) {
+            Expansion* x = &expansions[t];
+
+            for (k = 0; k < x->count && goal < 0; k++) {
+                const uint64_t* state = &x->states[k * v.words];
+                int cell, height;
+
+                if (dominated(&v, state)) {
+                    continue;
+                }
+
+                next[next_count] = add_state(&v, state, x->parents[k]);
+
+                unpack_position(state[0], &cell, &height);
+                if (sim_field(&sim, cell / sim.cols, cell % sim.cols).type == 'X') {
+                    goal = next[next_count];
+                }
+                next_count++;
+            }
+        }
+
+        free(frontier);
+        frontier = next;
+        frontier_count = next_count;
+        depth++;
+    }
+    seconds = now() - start_time;
+
+    printf("%d of %d keys and switches matter\n", v.bit_count, sim.door_count + sim.elevator_count);
+    printf("%zu states in %.3f s: %.0f states/s, %d bits per state\n", v.state_count, seconds,
+           v.state_count / seconds, 64 * v.words);
+
+    if (goal < 0) {
+        printf("no route to the goal\n");
+    } else {
+        printf("route of %d moves:\n", depth);
+        print_route(&v, goal);
+    }
+
+    for (t = 0; t < SOLVER_THREADS; t++) {
+        free(expansions[t].states);
+        free(expansions[t].parents);
+    }
+    free(frontier);
+    free(start);
+    free(v.states);
+    free(v.parents);
+    free(v.next);
+    free(v.table);
+    free(v.filled);
+    free(v.item_bits);
+    sim_free(&sim);
+
+    return goal >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t pack_position(int cell, int height)
+{
+    return (uint64_t)cell << 16 | (uint64_t)height;
+}
+
+static void unpack_position(uint64_t word, int* cell, int* height)
+{
+    *cell = (int)(word >> 16);
+    *height = (int)(word & 0xffff);
+}
+
+static bool gathered(const Solver* v, const uint64_t* state, int item)
+{
+    int bit = v->item_bits[item];
+
+    return bit >= 0 && ((state[1 + bit / 64] >> (bit % 64)) & 1);
+}
+
+static void gather(const Solver* v, uint64_t* state, int item)
+{
+    int bit = v->item_bits[item];
+
+    if (bit >= 0) {
+        state[1 + bit / 64] |= 1ull << (bit % 64);
+    }
+}
+
+static bool can_rise(const Solver* v, int from, int to)
+{
+    return v->climb < 0 || to <= from + v->climb;
+}
+
+static int highest_top(const SimState* s, int i, int j)
+{
+    const SimElevator* e = sim_elevator(s, i, j);
+
+    return sim_cell_top(s, i, j, false) + (e != NULL ? e->levels : 0);
+}
+
+static bool walked_on(const SimState* s, int i, int j)
+{
+    FieldData field = sim_field(s, i, j);
+
+    return field.type != 'l' && (field.type != 'w' || field.height == 0);
+}
+
+static bool item_matters(const Solver* v, int i, int j)
+{
+    const SimState* s = v->s;
+    int di[] = {-1, 1, 0, 0};
+    int dj[] = {0, 0, -1, 1};
+    int k, top = sim_cell_top(s, i, j, false);
+
+    /* Nothing stops a flying player */
+    if (v->climb < 0 || v->filled[i * s->cols + j]) {
+        return false;
+    }
+
+    for (k = 0; k < 4; k++) {
+        int ni = i + di[k];
+        int nj = j + dj[k];
+        int neighbour;
+
+        if (ni < 0 || ni >= s->rows || nj < 0 || nj >= s->cols || !walked_on(s, ni, nj)) {
+            continue;
+        }
+        neighbour = sim_cell_top(s, ni, nj, true);
+
+        if (sim_field(s, i, j).type == 'd' ? !can_rise(v, neighbour, top) : !can_rise(v, top, neighbour)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool open_cell(const Solver* v, int i, int j)
+{
+    const SimState* s = v->s;
+    int di[] = {-1, 1, 0, 0};
+    int dj[] = {0, 0, -1, 1};
+    int k, top;
+
+    if (i < 0 || i >= s->rows || j < 0 || j >= s->cols || v->filled[i * s->cols + j]) {
+        return false;
+    }
+    if (v->climb < 0) {
+        return true;
+    }
+    if (!walked_on(s, i, j)) {
+        return false;
+    }
+
+    /* Lowest the cell gets is with its door open */
+    top = sim_cell_top(s, i, j, true);
+    for (k = 0; k < 4; k++) {
+        int ni = i + di[k];
+        int nj = j + dj[k];
+
+        if (ni >= 0 && ni < s->rows && nj >= 0 && nj < s->cols && walked_on(s, ni, nj)
+            && can_rise(v, highest_top(s, ni, nj), top)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool dead_end(const Solver* v, int i, int j, int start_cell)
+{
+    const SimState* s = v->s;
+    const SimLink* link = NULL;
+    FieldData field;
+    int neighbours = open_cell(v, i - 1, j) + open_cell(v, i + 1, j)
+                     + open_cell(v, i, j - 1) + open_cell(v, i, j + 1);
+
+    if (!open_cell(v, i, j) || neighbours > 1 || i * s->cols + j == start_cell) {
+        return false;
+    }
+    field = sim_field(s, i, j);
+    link = sim_link(s, i, j);
+
+    if (field.type == 'X' || (link != NULL && link->entity < 0)) {
+        return false;
+    }
+    if (field.type == 'k' && link != NULL
+        && link->entity >= 0 && link->entity < s->door_count) {
+        return v->filled[link->to] != 0;
+    }
+    if (field.type == 's' && link != NULL
+        && link->entity >= 0 && link->entity < s->elevator_count) {
+        return v->filled[link->to] != 0;
+    }
+
+    return true;
+}
+
+static void fill_dead_ends(Solver* v, int start_cell)
+{
+    const SimState* s = v->s;
+    int di[] = {-1, 1, 0, 0};
+    int dj[] = {0, 0, -1, 1};
+    int* stack = NULL;
+    size_t stack_count = 0, stack_capacity, cells = (size_t)s->rows * s->cols, c;
+    int k, items = s->door_count + s->elevator_count;
+
+    v->filled = (unsigned char*)calloc(cells, 1);
+    v->item_bits = (int*)malloc((items + 1) * sizeof(int));
+    stack_capacity = cells + 1;
+    stack = (int*)malloc(stack_capacity * sizeof(int));
+    if (v->filled == NULL || v->item_bits == NULL || stack == NULL) {
+        fprintf(stderr, "Allocating memory for solver map failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Filling a cell might make its neighbours and its key or switch dead ends */
+    for (c = 0; c < cells; c++) {
+        stack[stack_count++] = c;
+
+        while (stack_count > 0) {
+            int cell = stack[--stack_count];
+            int i = cell / s->cols;
+            int j = cell % s->cols;
+            const SimLink* link = NULL;
+
+            if (!dead_end(v, i, j, start_cell)) {
+                continue;
+            }
+            v->filled[cell] = 1;
+
+            if (stack_count + 5 > stack_capacity) {
+                stack_capacity *= 2;
+                stack = (int*)realloc(stack, stack_capacity * sizeof(int));
+                if (stack == NULL) {
+                    fprintf(stderr, "Allocating memory for solver map failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            for (k = 0; k < 4; k++) {
+                if (i + di[k] >= 0 && i + di[k] < s->rows && j + dj[k] >= 0 && j + dj[k] < s->cols) {
+                    stack[stack_count++] = (i + di[k]) * s->cols + j + dj[k];
+                }
+            }
+
+            link = sim_link(s, i, j);
+            if (link != NULL && link->entity >= 0) {
+                stack[stack_count++] = link->to;
+            }
+        }
+    }
+
+    /* Only keys and switches of doors and elevators that are left and can change the
+     * way matter: without a climb limit none do */
+    v->bit_count = 0;
+    for (k = 0; k < s->door_count; k++) {
+        const SimDoor* d = &s->doors[k];
+
+        v->item_bits[k] = item_matters(v, d->row, d->col) ? v->bit_count++ : -1;
+    }
+    for (k = 0; k < s->elevator_count; k++) {
+        const SimElevator* e = &s->elevators[k];
+
+        v->item_bits[s->door_count + k] = item_matters(v, e->row, e->col) ? v->bit_count++ : -1;
+    }
+
+    free(stack);
+}
+
+static size_t find_position(const Solver* v, uint64_t position)
+{
+    size_t k = (position * 0x9E3779B97F4A7C15ull >> 20) & v->table_mask;
+
+    /* Linear probing up to the first empty slot */
+    while (v->table[k] >= 0 && v->states[v->table[k] * v->words] != position) {
+        k = (k + 1) & v->table_mask;
+    }
+
+    return k;
+}
+
+static bool covers(const Solver* v, const uint64_t* a, const uint64_t* b)
+{
+    int k;
+
+    for (k = 1; k < v->words; k++) {
+        if ((b[k] & ~a[k]) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool dominated(const Solver* v, const uint64_t* state)
+{
+    int64_t k;
+
+    for (k = v->table[find_position(v, state[0])]; k >= 0; k = v->next[k]) {
+        if (covers(v, &v->states[k * v->words], state)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static int64_t add_state(Solver* v, const uint64_t* state, int64_t parent)
+{
+    int64_t* link = NULL;
+    size_t k, slot;
+
+    if (v->state_count == v->state_capacity) {
+        v->state_capacity *= 2;
+        v->states = (uint64_t*)realloc(v->states, v->state_capacity * v->words * sizeof(uint64_t));
+        v->parents = (int64_t*)realloc(v->parents, v->state_capacity * sizeof(int64_t));
+        v->next = (int64_t*)realloc(v->next, v->state_capacity * sizeof(int64_t));
+        if (v->states == NULL || v->parents == NULL || v->next == NULL) {
+            fprintf(stderr, "Allocating memory for solver states failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(&v->states[v->state_count * v->words], state, v->words * sizeof(uint64_t));
+    v->parents[v->state_count] = parent;
+
+    slot = find_position(v, state[0]);
+    if (v->table[slot] < 0) {
+        v->position_count++;
+    }
+
+    /* States the new one covers don't need to be checked against anymore */
+    for (link = &v->table[slot]; *link >= 0;) {
+        if (covers(v, state, &v->states[*link * v->words])) {
+            *link = v->next[*link];
+        } else {
+            link = &v->next[*link];
+        }
+    }
+
+    v->next[v->state_count] = v->table[slot];
+    v->table[slot] = v->state_count;
+
+    /* Growing the table once it's half full */
+    if (2 * v->position_count > v->table_mask) {
+        int64_t* old = v->table;
+        size_t old_mask = v->table_mask;
+
+        v->table_mask = 2 * v->table_mask + 1;
+        v->table = (int64_t*)malloc((v->table_mask + 1) * sizeof(int64_t));
+        if (v->table == NULL) {
+            fprintf(stderr, "Allocating memory for solver states failed\n");
+            exit(EXIT_FAILURE);
+        }
+
+        for (k = 0; k <= v->table_mask; k++) {
+            v->table[k] = -1;
+        }
+        for (k = 0; k <= old_mask; k++) {
+            if (old[k] >= 0) {
+                v->table[find_position(v, v->states[old[k] * v->words])] = old[k];
+            }
+        }
+
+        free(old);
+    }
+
+    return v->state_count++;
+}
+
+static int item_entity(const SimState* s, int i, int j, char type, int count)
+{
+    const SimLink* link = sim_link(s, i, j);
+
+    if (sim_field(s, i, j).type != type || link == NULL
+        || link->entity < 0 || link->entity >= count) {
+        return -1;
+    }
+
+    return link->entity;
+}
+
+static bool elevator_moving(const Solver* v, const uint64_t* state, int i, int j,
+                            int* bottom, int* top)
+{
+    const SimElevator* e = sim_elevator(v->s, i, j);
+
+    if (e == NULL || !gathered(v, state, v->s->door_count + (int)(e - v->s->elevators))) {
+        return false;
+    }
+
+    *bottom = sim_cell_top(v->s, i, j, false);
+    *top = *bottom + e->levels;
+
+    return true;
+}
+
+static int enter_height(const Solver* v, const uint64_t* state, int i, int j, int from)
+{
+    const SimDoor* d = NULL;
+    FieldData field;
+    int bottom, top;
+
+    if (!open_cell(v, i, j)) {
+        return -1;
+    }
+    field = sim_field(v->s, i, j);
+
+    switch (field.type) {
+        /* Lava kills up to a little below a cube above it, so it's only flown over */
+        case 'l':
+            return v->climb < 0 ? field.height + 1 : -1;
+
+        /* Door sinks into its column once its key is gathered. One whose key isn't
+         * kept might be open or not: it's climbed as closed and stood on as open */
+        case 'd':
+            d = sim_door(v->s, i, j);
+            if (d != NULL && v->item_bits[d - v->s->doors] < 0) {
+                return can_rise(v, from, field.height) ? sim_cell_top(v->s, i, j, true) : -1;
+            }
+            top = sim_cell_top(v->s, i, j, d != NULL && gathered(v, state, (int)(d - v->s->doors)));
+            return can_rise(v, from, top) ? top : -1;
+
+        /* Moving elevator is boarded at the height closest to the player's */
+        case 'e':
+            if (elevator_moving(v, state, i, j, &bottom, &top)) {
+                if (!can_rise(v, from, bottom)) {
+                    return -1;
+                }
+                return can_rise(v, from, top) ? top : from + v->climb;
+            }
+            top = sim_cell_top(v->s, i, j, false);
+            return can_rise(v, from, top) ? top : -1;
+
+        default:
+            top = sim_cell_top(v->s, i, j, false);
+            return can_rise(v, from, top) ? top : -1;
+    }
+}
+
+static void add_successor(Expansion* x, const uint64_t* state, int64_t parent)
+{
+    Solver* v = x->solver;
+
+    if (dominated(v, state)) {
+        return;
+    }
+
+    if (x->count == x->capacity) {
+        x->capacity = x->capacity > 0 ? 2 * x->capacity : 256;
+        x->states = (uint64_t*)realloc(x->states, x->capacity * v->words * sizeof(uint64_t));
+        x->parents = (int64_t*)realloc(x->parents, x->capacity * sizeof(int64_t));
+        if (x->states == NULL || x->parents == NULL) {
+            fprintf(stderr, "Allocating memory for solver states failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    memcpy(&x->states[x->count * v->words], state, v->words * sizeof(uint64_t));
+    x->parents[x->count++] = parent;
+}
+
+static void* expand_states(void* expansion)
+{
+    Expansion* x = (Expansion*)expansion;
+    Solver* v = x->solver;
+    const SimState* s = v->s;
+    int di[] = {-1, 1, 0, 0};
+    int dj[] = {0, 0, -1, 1};
+    uint64_t* next = (uint64_t*)malloc(v->words * sizeof(uint64_t));
+    size_t n;
+
+    if (next == NULL) {
+        fprintf(stderr, "Allocating memory for solver states failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    x->count = 0;
+    for (n = x->first; n < x->last; n++) {
+        int64_t parent = x->frontier[n];
+        const uint64_t* state = &v->states[parent * v->words];
+        const SimLink* link = NULL;
+        int cell, height, i, j, k, bottom, top, entity;
+
+        unpack_position(state[0], &cell, &height);
+        i = cell / s->cols;
+        j = cell % s->cols;
+
+        /* Stepping to neighbours, gathering keys and switches there */
+        for (k = 0; k < 4; k++) {
+            int ti = i + di[k];
+            int tj = j + dj[k];
+            int to = enter_height(v, state, ti, tj, height);
+
+            if (to < 0) {
+                continue;
+            }
+
+            memcpy(next, state, v->words * sizeof(uint64_t));
+
+            if ((entity = item_entity(s, ti, tj, 'k', s->door_count)) >= 0) {
+                gather(v, next, entity);
+            } else if ((entity = item_entity(s, ti, tj, 's', s->elevator_count)) >= 0) {
+                gather(v, next, s->door_count + entity);
+            }
+
+            if (!elevator_moving(v, state, ti, tj, &bottom, &top)) {
+                bottom = to;
+            }
+            for (; to >= bottom; to--) {
+                next[0] = pack_position(ti * s->cols + tj, to);
+                add_successor(x, next, parent);
+            }
+        }
+
+        /* Riding the elevator */
+        if (elevator_moving(v, state, i, j, &bottom, &top)) {
+            memcpy(next, state, v->words * sizeof(uint64_t));
+            if (height > bottom) {
+                next[0] = pack_position(cell, height - 1);
+                add_successor(x, next, parent);
+            }
+            if (height < top) {
+                next[0] = pack_position(cell, height + 1);
+                add_successor(x, next, parent);
+            }
+        }
+
+        /* Teleporting: connected cells that aren't keys, switches, doors or elevators */
+        link = sim_link(s, i, j);
+        if (link != NULL && link->entity < 0) {
+            int to_row = link->to / s->cols;
+            int to_col = link->to % s->cols;
+            if (!v->filled[link->to]) {
+                memcpy(next, state, v->words * sizeof(uint64_t));
+                next[0] = pack_position(link->to, sim_column_top(s, to_row, to_col));
+                add_successor(x, next, parent);
+            }
+        }
+    }
+
+    free(next);
+
+    return NULL;
+}
+
+static void print_route(const Solver* v, int64_t goal)
+{
+    int64_t* route = NULL;
+    int64_t k;
+    int count = 0, n, cell, height, previous_cell, previous_height;
+
+    for (k = goal; k >= 0; k = v->parents[k]) {
+        count++;
+    }
+
+    route = (int64_t*)malloc(count * sizeof(int64_t));
+    if (route == NULL) {
+        fprintf(stderr, "Allocating memory for solver route failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    n = count;
+    for (k = goal; k >= 0; k = v->parents[k]) {
+        route[--n] = k;
+    }
+
+    unpack_position(v->states[route[0] * v->words], &previous_cell, &previous_height);
+    printf("start %d %d\n", previous_cell / v->s->cols, previous_cell % v->s->cols);
+
+    for (n = 1; n < count; n++) {
+        unpack_position(v->states[route[n] * v->words], &cell, &height);
+
+        if (cell == previous_cell) {
+            printf("ride %d %d to height %d\n", cell / v->s->cols, cell % v->s->cols, height);
+        } else if (abs(cell / v->s->cols - previous_cell / v->s->cols)
+                   + abs(cell % v->s->cols - previous_cell % v->s->cols) == 1) {
+            printf("step %d %d\n", cell / v->s->cols, cell % v->s->cols);
+        } else {
+            printf("teleport %d %d\n", cell / v->s->cols, cell % v->s->cols);
+        }
+
+        previous_cell = cell;
+    }
+
+    free(route);
+}
@@ -0,0 +1,427 @@
+#include "stream.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#define CHUNK_CELLS (STREAM_CHUNK_SIZE * STREAM_CHUNK_SIZE)
+
+/* States of a chunk */
+enum chunk_state {
+    CHUNK_ABSENT,
+    CHUNK_QUEUED,
+    CHUNK_LOADING,
+    CHUNK_RESIDENT
+};
+
+/* Error-checking function. Used for technical C details */
+#define osAssert(condition, msg) osError(condition, msg)
+static void osError(bool condition, const char* msg)
+{
+    if (!condition) {
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Loader thread: loads requested chunks until the stream is closed */
+static void* load_chunks(void* arg);
+
+/* Reads and decompresses chunk into the slot. Returns false if it's damaged */
+static bool read_chunk(WorldStream* st, int chunk, int slot);
+
+/* Queues chunk for loading unless it's loaded or being loaded.
+ * Must be called with the lock held */
+static void request_chunk(WorldStream* st, int chunk);
+
+/* Moves queued chunk to the front of the queue */
+static void hurry_chunk(WorldStream* st, int chunk);
+
+/* Requests chunks within radius around the cell (i, j), nearest last so that
+ * they are loaded first. Must be called with the lock held */
+static void request_area(WorldStream* st, int i, int j, int radius);
+
+/* Moves slot to the front of the least recently used list */
+static void touch_slot(WorldStream* st, int slot);
+
+uint64_t stream_write(FILE* f, const SimState* s)
+{
+    int chunk_rows = (s->rows + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE;
+    int chunk_cols = (s->cols + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE;
+    int chunk_count = chunk_rows * chunk_cols;
+    uLongf bound = compressBound(CHUNK_CELLS * sizeof(FieldData));
+    uint64_t* offsets = NULL;
+    FieldData* cells = NULL;
+    Bytef* packed = NULL;
+    long start = ftell(f);
+    uint64_t size;
+    int ci, cj, i, j;
+
+    offsets = (uint64_t*)malloc((chunk_count + 1) * sizeof(uint64_t));
+    cells = (FieldData*)malloc(CHUNK_CELLS * sizeof(FieldData));
+    packed = (Bytef*)malloc(bound);
+    osAssert(offsets != NULL && cells != NULL && packed != NULL,
+             "Allocating memory for map chunks failed\n");
+
+    /* Offsets are known only after compression, so they are written last */
+    offsets[0] = (chunk_count + 1) * sizeof(uint64_t);
+    osAssert(fseek(f, offsets[0], SEEK_CUR) == 0, "Error writing map chunks\n");
+
+    for (ci = 0; ci < chunk_rows; ci++) {
+        for (cj = 0; cj < chunk_cols; cj++) {
+            int k = ci * chunk_cols + cj;
+            uLongf packed_size = bound;
+
+            memset(cells, 0, CHUNK_CELLS * sizeof(FieldData));
+            for (i = ci * STREAM_CHUNK_SIZE; i < s->rows && i < (ci + 1) * STREAM_CHUNK_SIZE; i++) {
+                j = cj * STREAM_CHUNK_SIZE;
+                memcpy(&cells[(i % STREAM_CHUNK_SIZE) * STREAM_CHUNK_SIZE], &s->map[i][j],
+                       ((s->cols - j < STREAM_CHUNK_SIZE) ? s->cols - j : STREAM_CHUNK_SIZE)
+                       * sizeof(FieldData));
+            }
+
+            osAssert(compress2(packed, &packed_size, (const Bytef*)cells,
+                               CHUNK_CELLS * sizeof(FieldData), Z_DEFAULT_COMPRESSION) == Z_OK,
+                     "Error compressing map chunk\n");
+            osAssert(fwrite(packed, 1, packed_size, f) == packed_size, "Error writing map chunks\n");
+
+            offsets[k + 1] = offsets[k] + packed_size;
+        }
+    }
+
+    osAssert(fseek(f, start, SEEK_SET) == 0
+             && fwrite(offsets, sizeof(uint64_t), chunk_count + 1, f) == (size_t)chunk_count + 1
+             && fseek(f, start + offsets[chunk_count], SEEK_SET) == 0,
+             "Error writing map chunks\n");
+
+    size = offsets[chunk_count];
+    free(offsets);
+    free(cells);
+    free(packed);
+
+    return size;
+}
+
+bool stream_open(WorldStream* st, int fd, uint64_t offset, uint64_t size, int rows, int cols)
+{
+    int chunk_count, k;
+    size_t index_size;
+
+    st->fd = fd;
+    st->offset = offset;
+    st->rows = rows;
+    st->cols = cols;
+    st->chunk_rows = (rows + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE;
+    st->chunk_cols = (cols + STREAM_CHUNK_SIZE - 1) / STREAM_CHUNK_SIZE;
+    chunk_count = st->chunk_rows * st->chunk_cols;
+
+    /* Chunk index has to be in the section and offsets have to grow */
+    index_size = (chunk_count + 1) * sizeof(uint64_t);
+    if (index_size > size) {
+        return false;
+    }
+
+    st->chunk_offsets = (uint64_t*)malloc(index_size);
+    osAssert(st->chunk_offsets != NULL, "Allocating memory for map chunks failed\n");
+
+    if (pread(fd, st->chunk_offsets, index_size, offset) != (ssize_t)index_size
+        || st->chunk_offsets[0] != index_size || st->chunk_offsets[chunk_count] > size) {
+        free(st->chunk_offsets);
+        return false;
+    }
+
+    for (k = 0; k < chunk_count; k++) {
+        if (st->chunk_offsets[k + 1] < st->chunk_offsets[k]) {
+            free(st->chunk_offsets);
+            return false;
+        }
+    }
+
+    /* Slots: as many as the budget allows, but at least twice the focus area */
+    st->slot_count = STREAM_BUDGET / (CHUNK_CELLS * sizeof(FieldData));
+    if (st->slot_count < 2 * (2 * STREAM_RADIUS + 1) * (2 * STREAM_RADIUS + 1)) {
+        st->slot_count = 2 * (2 * STREAM_RADIUS + 1) * (2 * STREAM_RADIUS + 1);
+    }
+    if (st->slot_count > chunk_count) {
+        st->slot_count = chunk_count;
+    }
+
+    st->chunk_state = (unsigned char*)calloc(chunk_count, sizeof(unsigned char));
+    st->chunk_slot = (int*)malloc(chunk_count * sizeof(int));
+    st->cells = (FieldData*)malloc((size_t)st->slot_count * CHUNK_CELLS * sizeof(FieldData));
+    st->slot_chunk = (int*)malloc(st->slot_count * sizeof(int));
+    st->slot_prev = (int*)malloc(st->slot_count * sizeof(int));
+    st->slot_next = (int*)malloc(st->slot_count * sizeof(int));
+    st->requests = (int*)malloc(st->slot_count * sizeof(int));
+    osAssert(st->chunk_state != NULL && st->chunk_slot != NULL && st->cells != NULL
+             && st->slot_chunk != NULL && st->slot_prev != NULL && st->slot_next != NULL
+             && st->requests != NULL, "Allocating memory for map chunks failed\n");
+
+    for (k = 0; k < chunk_count; k++) {
+        st->chunk_slot[k] = -1;
+    }
+
+    /* All slots start empty, linked in order */
+    for (k = 0; k < st->slot_count; k++) {
+        st->slot_chunk[k] = -1;
+        st->slot_prev[k] = k - 1;
+        st->slot_next[k] = k + 1 < st->slot_count ? k + 1 : -1;
+    }
+    st->lru_head = 0;
+    st->lru_tail = st->slot_count - 1;
+
+    st->request_first = st->request_count = 0;
+    st->focus_chunk = st->prefetch_chunk = -1;
+    st->loads = st->evictions = st->stalls = 0;
+    st->quit = false;
+
+    pthread_mutex_init(&st->lock, NULL);
+    pthread_cond_init(&st->requested, NULL);
+    pthread_cond_init(&st->loaded, NULL);
+    osAssert(pthread_create(&st->loader, NULL, load_chunks, st) == 0,
+             "Error starting map chunk loader\n");
+
+    return true;
+}
+
+void stream_focus(WorldStream* st, int i, int j)
+{
+    int chunk = (i / STREAM_CHUNK_SIZE) * st->chunk_cols + j / STREAM_CHUNK_SIZE;
+
+    if (chunk == st->focus_chunk) {
+        return;
+    }
+    st->focus_chunk = chunk;
+
+    pthread_mutex_lock(&st->lock);
+    request_area(st, i, j, STREAM_RADIUS);
+    pthread_mutex_unlock(&st->lock);
+}
+
+void stream_prefetch(WorldStream* st, int i, int j)
+{
+    int chunk = (i / STREAM_CHUNK_SIZE) * st->chunk_cols + j / STREAM_CHUNK_SIZE;
+
+    if (chunk == st->prefetch_chunk) {
+        return;
+    }
+    st->prefetch_chunk = chunk;
+
+    pthread_mutex_lock(&st->lock);
+    request_area(st, i, j, STREAM_PREFETCH_RADIUS);
+    pthread_mutex_unlock(&st->lock);
+}
+
+FieldData stream_cell(WorldStream* st, int i, int j)
+{
+    int chunk = (i / STREAM_CHUNK_SIZE) * st->chunk_cols + j / STREAM_CHUNK_SIZE;
+    int slot;
+    FieldData cell;
+
+    pthread_mutex_lock(&st->lock);
+
+    if (st->chunk_slot[chunk] == -1) {
+        st->stalls++;
+
+        if (st->chunk_state[chunk] == CHUNK_QUEUED) {
+            hurry_chunk(st, chunk);
+        } else {
+            request_chunk(st, chunk);
+        }
+
+        while (st->chunk_slot[chunk] == -1) {
+            pthread_cond_wait(&st->loaded, &st->lock);
+        }
+    }
+
+    slot = st->chunk_slot[chunk];
+    touch_slot(st, slot);
+    cell = st->cells[(size_t)slot * CHUNK_CELLS + (i % STREAM_CHUNK_SIZE) * STREAM_CHUNK_SIZE
+                     + j % STREAM_CHUNK_SIZE];
+
+    pthread_mutex_unlock(&st->lock);
+
+    return cell;
+}
+
+void stream_close(WorldStream* st)
+{
+    pthread_mutex_lock(&st->lock);
+    st->quit = true;
+    pthread_cond_signal(&st->requested);
+    pthread_mutex_unlock(&st->lock);
+
+    pthread_join(st->loader, NULL);
+    pthread_mutex_destroy(&st->lock);
+    pthread_cond_destroy(&st->requested);
+    pthread_cond_destroy(&st->loaded);
+
+    close(st->fd);
+    free(st->chunk_offsets);
+    free(st->chunk_state);
+    free(st->chunk_slot);
+    free(st->cells);
+    free(st->slot_chunk);
+    free(st->slot_prev);
+    free(st->slot_next);
+    free(st->requests);
+}
+
+static void* load_chunks(void* arg)
+{
+    WorldStream* st = (WorldStream*)arg;
+
+    pthread_mutex_lock(&st->lock);
+
+    while (!st->quit) {
+        int chunk, slot, old;
+
+        if (st->request_count == 0) {
+            pthread_cond_wait(&st->requested, &st->lock);
+            continue;
+        }
+
+        /* Newest request first */
+        st->request_count--;
+        chunk = st->requests[(st->request_first + st->request_count) % st->slot_count];
+        if (st->chunk_state[chunk] != CHUNK_QUEUED) {
+            continue;
+        }
+
+        /* Taking the least recently used slot */
+        slot = st->lru_tail;
+        old = st->slot_chunk[slot];
+        if (old != -1) {
+            st->chunk_slot[old] = -1;
+            st->chunk_state[old] = CHUNK_ABSENT;
+            st->slot_chunk[slot] = -1;
+            st->evictions++;
+        }
+        st->chunk_state[chunk] = CHUNK_LOADING;
+        touch_slot(st, slot);
+
+        /* Nobody else uses the slot now, so it's filled without the lock */
+        pthread_mutex_unlock(&st->lock);
+        if (!read_chunk(st, chunk, slot)) {
+            fprintf(stderr, "Map chunk %d is damaged\n", chunk);
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_lock(&st->lock);
+
+        st->slot_chunk[slot] = chunk;
+        st->chunk_slot[chunk] = slot;
+        st->chunk_state[chunk] = CHUNK_RESIDENT;
+        st->loads++;
+        pthread_cond_broadcast(&st->loaded);
+    }
+
+    pthread_mutex_unlock(&st->lock);
+
+    return NULL;
+}
+
+static bool read_chunk(WorldStream* st, int chunk, int slot)
+{
+    uint64_t size = st->chunk_offsets[chunk + 1] - st->chunk_offsets[chunk];
+    uLongf cells_size = CHUNK_CELLS * sizeof(FieldData);
+    Bytef* packed = (Bytef*)malloc(size + 1);
+    bool ok;
+
+    osAssert(packed != NULL, "Allocating memory for map chunk failed\n");
+
+    ok = pread(st->fd, packed, size, st->offset + st->chunk_offsets[chunk]) == (ssize_t)size
+         && uncompress((Bytef*)&st->cells[(size_t)slot * CHUNK_CELLS], &cells_size,
+                       packed, size) == Z_OK
+         && cells_size == CHUNK_CELLS * sizeof(FieldData);
+
+    free(packed);
+
+    return ok;
+}
+
+static void request_chunk(WorldStream* st, int chunk)
+{
+    if (st->chunk_state[chunk] != CHUNK_ABSENT) {
+        return;
+    }
+
+    /* Dropping the oldest request if there's no room */
+    if (st->request_count == st->slot_count) {
+        int oldest = st->requests[st->request_first];
+
+        if (st->chunk_state[oldest] == CHUNK_QUEUED) {
+            st->chunk_state[oldest] = CHUNK_ABSENT;
+        }
+        st->request_first = (st->request_first + 1) % st->slot_count;
+        st->request_count--;
+    }
+
+    st->requests[(st->request_first + st->request_count) % st->slot_count] = chunk;
+    st->request_count++;
+    st->chunk_state[chunk] = CHUNK_QUEUED;
+
+    pthread_cond_signal(&st->requested);
+}
+
+static void hurry_chunk(WorldStream* st, int chunk)
+{
+    int newest = (st->request_first + st->request_count - 1) % st->slot_count;
+    int k;
+
+    /* Requests are taken newest first, so it swaps places with the newest one */
+    for (k = 0; k < st->request_count; k++) {
+        int position = (st->request_first + k) % st->slot_count;
+
+        if (st->requests[position] == chunk) {
+            st->requests[position] = st->requests[newest];
+            st->requests[newest] = chunk;
+            return;
+        }
+    }
+}
+
+static void request_area(WorldStream* st, int i, int j, int radius)
+{
+    int ci = i / STREAM_CHUNK_SIZE;
+    int cj = j / STREAM_CHUNK_SIZE;
+    int d, a, b;
+
+    for (d = radius; d >= 0; d--) {
+        for (a = ci - d; a <= ci + d; a++) {
+            for (b = cj - d; b <= cj + d; b++) {
+                /* Only the ring at distance d */
+                if ((a != ci - d && a != ci + d && b != cj - d && b != cj + d)
+                    || a < 0 || a >= st->chunk_rows || b < 0 || b >= st->chunk_cols) {
+                    continue;
+                }
+
+                if (st->chunk_slot[a * st->chunk_cols + b] != -1) {
+                    touch_slot(st, st->chunk_slot[a * st->chunk_cols + b]);
+                } else {
+                    request_chunk(st, a * st->chunk_cols + b);
+                }
+            }
+        }
+    }
+}
+
+static void touch_slot(WorldStream* st, int slot)
+{
+    if (slot == st->lru_head) {
+        return;
+    }
+
+    /* Unlinking */
+    st->slot_next[st->slot_prev[slot]] = st->slot_next[slot];
+    if (st->slot_next[slot] != -1) {
+        st->slot_prev[st->slot_next[slot]] = st->slot_prev[slot];
+    } else {
+        st->lru_tail = st->slot_prev[slot];
+    }
+
+    /* Linking in front */
+    st->slot_prev[slot] = -1;
+    st->slot_next[slot] = st->lru_head;
+    st->slot_prev[st->lru_head] = slot;
+    st->lru_head = slot;
+}
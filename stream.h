@@ -0,0 +1,87 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "sim.h"
+
+/* Streamed map cells. Cells are split into STREAM_CHUNK_SIZE x STREAM_CHUNK_SIZE
+ * chunks, every chunk compressed on its own, so any of them can be read without
+ * the others. Only chunks near the player are kept in memory: a background thread
+ * reads and decompresses requested chunks into a fixed number of slots and
+ * evicts the least recently used chunk when it runs out of them.
+ *
+ * On disk: chunk_rows * chunk_cols + 1 offsets (uint64_t, from the start of the
+ * section), chunk k being compressed between offsets k and k + 1. Chunks are in
+ * row major order, cells of a chunk too; cells past the map edge are zero */
+
+/* Width and height of a chunk, in cells */
+#define STREAM_CHUNK_SIZE 64
+
+/* Memory for decompressed chunks, in bytes */
+#ifndef STREAM_BUDGET
+#define STREAM_BUDGET (16 << 20)
+#endif
+
+/* Chunks around the player (and around teleport destinations) that are kept loaded */
+#define STREAM_RADIUS 2
+#define STREAM_PREFETCH_RADIUS 1
+
+typedef struct world_stream {
+    int fd;
+    uint64_t offset;
+    int rows, cols;
+    int chunk_rows, chunk_cols;
+    uint64_t* chunk_offsets;
+    unsigned char* chunk_state;
+    int* chunk_slot;
+
+    /* Slots of decompressed chunks, in least recently used list */
+    FieldData* cells;
+    int slot_count;
+    int* slot_chunk;
+    int* slot_prev;
+    int* slot_next;
+    int lru_head, lru_tail;
+
+    /* Requested chunks; the newest are loaded first, the oldest dropped if too many */
+    int* requests;
+    int request_first, request_count;
+
+    /* Chunks the last focus and prefetch were around, to skip repeated requests */
+    int focus_chunk, prefetch_chunk;
+
+    pthread_t loader;
+    pthread_mutex_t lock;
+    pthread_cond_t requested, loaded;
+    bool quit;
+
+    /* Chunks loaded and evicted so far, and cell reads that had to wait for a chunk */
+    long loads, evictions, stalls;
+}   WorldStream;
+
+/* Writes map cells of s as a streamed cells section at the current position of f.
+ * Returns size of the section in bytes */
+uint64_t stream_write(FILE* f, const SimState* s);
+
+/* Opens streamed cells section of the given size at offset of the file fd, which
+ * the stream then owns, and starts the loader thread. Returns false if the section
+ * is damaged */
+bool stream_open(WorldStream* st, int fd, uint64_t offset, uint64_t size, int rows, int cols);
+
+/* Requests chunks around the cell (i, j) the player is on */
+void stream_focus(WorldStream* st, int i, int j);
+
+/* Requests chunks around the cell (i, j) the player might jump to */
+void stream_prefetch(WorldStream* st, int i, int j);
+
+/* Returns cell (i, j), waiting for its chunk if it isn't loaded yet */
+FieldData stream_cell(WorldStream* st, int i, int j);
+
+/* Stops the loader thread and releases the stream */
+void stream_close(WorldStream* st);
+
+#endif
@@ -0,0 +1,400 @@
+#include "teleport.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+/* Same constants as in main.c */
+#define PI 3.14159265359
+#define EPS 0.01
+
+/* Initial number of queued teleports; it doubles whenever it's filled */
+#define TELEPORT_INITIAL_CAPACITY 16
+
+/* Attribute locations shared by the program and the draw calls */
+#define VERTEX_LOCATION 0
+#define INSTANCE_LOCATION 1
+
+/* Floats per geometry vertex (x, y, z, kind) and per instance (x, y, z, color) */
+#define TELEPORT_VERTEX_FLOATS 4
+#define TELEPORT_INSTANCE_FLOATS 4
+
+/* Number of rotating lines in each set; line k stands at angle k * PI / 20 */
+#define TELEPORT_LINES 41
+
+/* Lines drawn at every detail level */
+static const int lod_lines[TELEPORT_LOD_COUNT] = {TELEPORT_LINES, 21, 11, 0};
+
+/* Vertex kinds: they select palette entry and rotation of the vertex */
+enum teleport_vertex_kind {
+    TELEPORT_FAN_CENTER,
+    TELEPORT_FAN_RIM,
+    TELEPORT_INNER_LINE,
+    TELEPORT_OUTER_LINE
+};
+
+/* Inner lines rotate with angle 0.5 * time, outer lines with -0.5 * time
+ * (the same angles create_teleport() gets with two glRotatef() calls) */
+static const char* vertex_source =
+    "#version 120\n"
+    "uniform float time;\n"
+    "uniform vec4 palette[3 * 9];\n"
+    "attribute vec4 vertex;\n"
+    "attribute vec4 instance;\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    int kind = int(vertex.w + 0.5);\n"
+    "    int slot = kind < 2 ? kind : 2;\n"
+    "    float angle = kind == 2 ? 0.5 * time : kind == 3 ? -0.5 * time : 0.0;\n"
+    "    float c = cos(angle);\n"
+    "    float s = sin(angle);\n"
+    "    vec3 p = vec3(c * vertex.x + s * vertex.z, vertex.y, -s * vertex.x + c * vertex.z);\n"
+    "    color = palette[3 * int(instance.w + 0.5) + slot];\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(p + instance.xyz, 1.0);\n"
+    "}\n";
+
+static const char* fragment_source =
+    "#version 120\n"
+    "varying vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = color;\n"
+    "}\n";
+
+/* Vertex storage used while the geometry is being built */
+typedef struct teleport_vertices {
+    GLfloat* data;
+    int count;
+    int capacity;
+}   TeleportVertices;
+
+/* Appends one geometry vertex */
+static void add_vertex(TeleportVertices* v, float x, float y, float z, int kind);
+
+/* Returns index of the line drawn at the given position. Every fourth line goes first,
+ * then the remaining even ones and then the odd ones, so any prefix is spread evenly */
+static int line_at(int position);
+
+/* Sets instance attribute to the queued instances of detail level lod */
+static void point_instances(const TeleportRenderer* t, int lod);
+
+/* Compiles one shader stage. Returns 0 on failure */
+static GLuint compile_shader(GLenum type, const char* source);
+
+/* Returns true if instanced drawing with per-instance attributes is available */
+static bool instancing_supported();
+
+bool teleport_renderer_init(TeleportRenderer* t, float cube_size, TeleportPalette palette)
+{
+    /* Same dimensions as in create_teleport() */
+    float r = 0.8 * cube_size / 2;
+    float r_in = cube_size / 3.2;
+    float line_height = 0.9 * cube_size;
+    float angle_scale = 2.1;
+    float phi;
+    int k, l;
+
+    GLuint vertex_shader, fragment_shader;
+    GLint linked;
+    TeleportVertices v = {NULL, 0, 0};
+
+    t->program = t->vbo = t->instance_vbo = 0;
+    for (l = 0; l < TELEPORT_LOD_COUNT; l++) {
+        t->line_count[l] = lod_lines[l];
+        t->instances[l] = NULL;
+        t->instance_count[l] = t->instance_capacity[l] = 0;
+    }
+
+    if (!instancing_supported()) {
+        return false;
+    }
+
+    vertex_shader = compile_shader(GL_VERTEX_SHADER, vertex_source);
+    fragment_shader = compile_shader(GL_FRAGMENT_SHADER, fragment_source);
+    if (vertex_shader == 0 || fragment_shader == 0) {
+        glDeleteShader(vertex_shader);
+        glDeleteShader(fragment_shader);
+        return false;
+    }
+
+    t->program = glCreateProgram();
+    glAttachShader(t->program, vertex_shader);
+    glAttachShader(t->program, fragment_shader);
+    glBindAttribLocation(t->program, VERTEX_LOCATION, "vertex");
+    glBindAttribLocation(t->program, INSTANCE_LOCATION, "instance");
+    glLinkProgram(t->program);
+
+    /* Program keeps the shaders alive as long as it needs them */
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+
+    glGetProgramiv(t->program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        fprintf(stderr, "Linking teleport shaders failed, using fixed pipeline.\n");
+        glDeleteProgram(t->program);
+        t->program = 0;
+        return false;
+    }
+
+    t->time_location = glGetUniformLocation(t->program, "time");
+    t->palette_location = glGetUniformLocation(t->program, "palette");
+
+    /* Palette never changes, so it's set only once */
+    glUseProgram(t->program);
+    glUniform4fv(t->palette_location, 3 * TELEPORT_COLORS, &palette[0][0][0]);
+    glUseProgram(0);
+
+    /* Floor gradiental circle */
+    t->fan_first = v.count;
+    add_vertex(&v, 0, 0, 0, TELEPORT_FAN_CENTER);
+    for (phi = 0; phi <= 2*PI + EPS; phi += PI / 20) {
+        add_vertex(&v, r * cos(phi), 0, r * sin(phi), TELEPORT_FAN_RIM);
+    }
+    t->fan_count = v.count - t->fan_first;
+
+    /* Inner lines */
+    t->inner_first = v.count;
+    for (k = 0; k < TELEPORT_LINES; k++) {
+        phi = line_at(k) * PI / 20;
+        add_vertex(&v, r_in * sin(angle_scale*phi), 0,
+                   r_in * cos(angle_scale*phi), TELEPORT_INNER_LINE);
+        add_vertex(&v, r_in * sin(angle_scale*phi), line_height,
+                   r_in * cos(angle_scale*phi), TELEPORT_INNER_LINE);
+    }
+
+    /* Outer lines */
+    t->outer_first = v.count;
+    for (k = 0; k < TELEPORT_LINES; k++) {
+        phi = line_at(k) * PI / 20;
+        add_vertex(&v, r * sin(phi), 0, r * cos(phi), TELEPORT_OUTER_LINE);
+        add_vertex(&v, r * sin(phi), line_height, r * cos(phi), TELEPORT_OUTER_LINE);
+    }
+
+    glGenBuffers(1, &t->vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, t->vbo);
+    glBufferData(GL_ARRAY_BUFFER, v.count * TELEPORT_VERTEX_FLOATS * sizeof(GLfloat),
+                 v.data, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &t->instance_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    free(v.data);
+
+    return true;
+}
+
+void teleport_renderer_add(TeleportRenderer* t, float x, float y, float z, int color, int lod)
+{
+    GLfloat* instance;
+
+    if (t->instance_count[lod] == t->instance_capacity[lod]) {
+        int capacity = t->instance_capacity[lod] == 0 ? TELEPORT_INITIAL_CAPACITY
+                                                      : 2 * t->instance_capacity[lod];
+        GLfloat* instances = (GLfloat*)realloc(t->instances[lod],
+                capacity * TELEPORT_INSTANCE_FLOATS * sizeof(GLfloat));
+        if (instances == NULL) {
+            fprintf(stderr, "Allocating memory for teleports failed.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        t->instances[lod] = instances;
+        t->instance_capacity[lod] = capacity;
+    }
+
+    instance = t->instances[lod] + t->instance_count[lod] * TELEPORT_INSTANCE_FLOATS;
+    instance[0] = x;
+    instance[1] = y;
+    instance[2] = z;
+    instance[3] = color;
+
+    t->instance_count[lod]++;
+}
+
+void teleport_renderer_draw(TeleportRenderer* t, float time)
+{
+    GLsizei stride = TELEPORT_VERTEX_FLOATS * sizeof(GLfloat);
+    GLboolean lighting = glIsEnabled(GL_LIGHTING);
+    GLintptr offset = 0;
+    int total = 0;
+    int l;
+
+    for (l = 0; l < TELEPORT_LOD_COUNT; l++) {
+        total += t->instance_count[l];
+    }
+
+    if (t->program == 0 || total == 0) {
+        return;
+    }
+
+    /* Positions and colors of this frame's teleports, grouped by detail level.
+     * Levels follow distance, so the farthest level goes first */
+    glBindBuffer(GL_ARRAY_BUFFER, t->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, total * TELEPORT_INSTANCE_FLOATS * sizeof(GLfloat),
+                 NULL, GL_STREAM_DRAW);
+    for (l = TELEPORT_LOD_COUNT - 1; l >= 0; l--) {
+        GLsizeiptr size = t->instance_count[l] * TELEPORT_INSTANCE_FLOATS * sizeof(GLfloat);
+
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, t->instances[l]);
+        offset += size;
+    }
+    glVertexAttribDivisor(INSTANCE_LOCATION, 1);
+    glEnableVertexAttribArray(INSTANCE_LOCATION);
+
+    glBindBuffer(GL_ARRAY_BUFFER, t->vbo);
+    glVertexAttribPointer(VERTEX_LOCATION, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid*)0);
+    glEnableVertexAttribArray(VERTEX_LOCATION);
+
+    /* Blended geometry: depth is tested, but not written */
+    glDisable(GL_LIGHTING);
+    glDepthMask(GL_FALSE);
+    glUseProgram(t->program);
+    glUniform1f(t->time_location, time);
+
+    /* Line width is fixed state, so circles and both line sets need calls
+     * of their own. Every detail level has a circle, so they go in one call */
+    point_instances(t, TELEPORT_LOD_COUNT - 1);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, t->fan_first, t->fan_count, total);
+
+    /* Lines level by level, from the farthest one */
+    for (l = TELEPORT_LOD_COUNT - 1; l >= 0; l--) {
+        if (t->instance_count[l] > 0 && t->line_count[l] > 0) {
+            point_instances(t, l);
+
+            glLineWidth(1.6);
+            glDrawArraysInstanced(GL_LINES, t->inner_first, 2 * t->line_count[l],
+                                  t->instance_count[l]);
+
+            glLineWidth(2.2);
+            glDrawArraysInstanced(GL_LINES, t->outer_first, 2 * t->line_count[l],
+                                  t->instance_count[l]);
+        }
+    }
+
+    glUseProgram(0);
+    glDepthMask(GL_TRUE);
+    if (lighting) {
+        glEnable(GL_LIGHTING);
+    }
+
+    glDisableVertexAttribArray(VERTEX_LOCATION);
+    glDisableVertexAttribArray(INSTANCE_LOCATION);
+    glVertexAttribDivisor(INSTANCE_LOCATION, 0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    for (l = 0; l < TELEPORT_LOD_COUNT; l++) {
+        t->instance_count[l] = 0;
+    }
+}
+
+void teleport_renderer_free(TeleportRenderer* t)
+{
+    int l;
+
+    if (t->program != 0) {
+        glDeleteProgram(t->program);
+    }
+    if (t->vbo != 0) {
+        glDeleteBuffers(1, &t->vbo);
+    }
+    if (t->instance_vbo != 0) {
+        glDeleteBuffers(1, &t->instance_vbo);
+    }
+
+    t->program = t->vbo = t->instance_vbo = 0;
+    for (l = 0; l < TELEPORT_LOD_COUNT; l++) {
+        free(t->instances[l]);
+        t->instances[l] = NULL;
+        t->instance_count[l] = t->instance_capacity[l] = 0;
+    }
+}
+
+static void add_vertex(TeleportVertices* v, float x, float y, float z, int kind)
+{
+    GLfloat* vertex;
+
+    if (v->count == v->capacity) {
+        int capacity = v->capacity == 0 ? 256 : 2 * v->capacity;
+        GLfloat* data = (GLfloat*)realloc(v->data,
+                capacity * TELEPORT_VERTEX_FLOATS * sizeof(GLfloat));
+        if (data == NULL) {
+            fprintf(stderr, "Allocating memory for teleport vertices failed.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        v->data = data;
+        v->capacity = capacity;
+    }
+
+    vertex = v->data + v->count * TELEPORT_VERTEX_FLOATS;
+    vertex[0] = x;
+    vertex[1] = y;
+    vertex[2] = z;
+    vertex[3] = kind;
+
+    v->count++;
+}
+
+static int line_at(int position)
+{
+    /* Lines 0, 4, ..., 40 */
+    if (position < 11) {
+        return 4 * position;
+    }
+
+    /* Lines 2, 6, ..., 38 */
+    if (position < 21) {
+        return 4 * (position - 11) + 2;
+    }
+
+    /* Odd lines */
+    return 2 * (position - 21) + 1;
+}
+
+static void point_instances(const TeleportRenderer* t, int lod)
+{
+    int first = 0;
+    int l;
+
+    for (l = TELEPORT_LOD_COUNT - 1; l > lod; l--) {
+        first += t->instance_count[l];
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, t->instance_vbo);
+    glVertexAttribPointer(INSTANCE_LOCATION, 4, GL_FLOAT, GL_FALSE, 0,
+            (const GLvoid*)(first * TELEPORT_INSTANCE_FLOATS * sizeof(GLfloat)));
+    glBindBuffer(GL_ARRAY_BUFFER, t->vbo);
+}
+
+static GLuint compile_shader(GLenum type, const char* source)
+{
+    GLuint shader = glCreateShader(type);
+    GLint compiled;
+
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (!compiled) {
+        char log[1024];
+
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        fprintf(stderr, "Compiling teleport shader failed, using fixed pipeline:\n%s\n", log);
+        glDeleteShader(shader);
+        return 0;
+    }
+
+    return shader;
+}
+
+static bool instancing_supported()
+{
+    int major = 0, minor = 0;
+    const char* version = (const char*)glGetString(GL_VERSION);
+
+    if (version == NULL || sscanf(version, "%d.%d", &major, &minor) != 2) {
+        return false;
+    }
+
+    /* Per-instance attributes are core since 3.3 */
+    return major > 3 || (major == 3 && minor >= 3);
+}
@@ -0,0 +1,51 @@
+#ifndef TELEPORT_H
+#define TELEPORT_H
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glut.h>
+#include <stdbool.h>
+
+/* Number of teleport colors: 'b', 'r', 'g', 'y', 'o', 'm', 'p', 'c' and white */
+#define TELEPORT_COLORS 9
+
+/* Number of detail levels. Levels draw fewer rotating lines as they go;
+ * the last level is an impostor made of the floor circle only */
+#define TELEPORT_LOD_COUNT 4
+
+/* Teleport effect rendered on the GPU. Geometry of a single teleport (floor circle,
+ * inner and outer lines) is built once; rotation is done in the vertex shader from
+ * the time uniform. Every teleport is one instance with its own position and color,
+ * and all queued teleports are drawn with one instanced call per primitive type
+ * and detail level. Lines are ordered so that every level uses a prefix of them */
+typedef struct teleport_renderer {
+    GLuint program;
+    GLuint vbo;
+    GLuint instance_vbo;
+    GLint time_location;
+    GLint palette_location;
+    int fan_first, fan_count;
+    int inner_first, outer_first;
+    int line_count[TELEPORT_LOD_COUNT];
+    GLfloat* instances[TELEPORT_LOD_COUNT];
+    int instance_count[TELEPORT_LOD_COUNT];
+    int instance_capacity[TELEPORT_LOD_COUNT];
+}   TeleportRenderer;
+
+/* Colors of every teleport color: inner and outer floor circle color and line color */
+typedef GLfloat TeleportPalette[TELEPORT_COLORS][3][4];
+
+/* Builds teleport geometry for the given cube size and compiles the shaders.
+ * Returns false if shaders or instancing aren't available */
+bool teleport_renderer_init(TeleportRenderer* t, float cube_size, TeleportPalette palette);
+
+/* Queues teleport with floor center in (x, y, z), palette color index and detail level.
+ * Teleports of one level are drawn in the order they were queued */
+void teleport_renderer_add(TeleportRenderer* t, float x, float y, float z, int color, int lod);
+
+/* Draws all queued teleports animated to the given time and empties the queue */
+void teleport_renderer_draw(TeleportRenderer* t, float time);
+
+/* Releases shaders and buffers */
+void teleport_renderer_free(TeleportRenderer* t);
+
+#endif
@@ -0,0 +1,174 @@
+#include "tile_pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Error-checking function. Used for technical C details */
+#define osAssert(condition, msg) osError(condition, msg)
+static void osError(bool condition, const char* msg)
+{
+    if (!condition) {
+        perror(msg);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Worker thread: works on every job until the pool is freed */
+static void* run_worker(void* arg);
+
+/* Processes tiles of the worker's own run, then steals from the others
+ * until no tile is left */
+static void work(TilePool* p, int worker);
+
+/* Takes tile from the front of the run, or steals it from the back.
+ * Returns false if the run is empty */
+static bool take_tile(TileRun* run, bool steal, int* tile);
+
+void tile_pool_init(TilePool* p, int worker_count)
+{
+    int k;
+
+    if (worker_count <= 0) {
+        worker_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    p->worker_count = worker_count < 1 ? 1
+                      : (worker_count > TILE_POOL_MAX_WORKERS ? TILE_POOL_MAX_WORKERS : worker_count);
+
+    for (k = 0; k < TILE_POOL_MAX_WORKERS; k++) {
+        atomic_init(&p->runs[k].range, 0);
+    }
+    atomic_init(&p->steals, 0);
+
+    p->function = NULL;
+    p->context = NULL;
+    p->generation = 0;
+    p->busy = 0;
+    p->quit = false;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->started, NULL);
+    pthread_cond_init(&p->finished, NULL);
+
+    /* Worker 0 is whoever runs the job */
+    for (k = 1; k < p->worker_count; k++) {
+        p->workers[k].pool = p;
+        p->workers[k].index = k;
+        osAssert(pthread_create(&p->workers[k].thread, NULL, run_worker, &p->workers[k]) == 0,
+                 "Error starting tile worker\n");
+    }
+}
+
+void tile_pool_run(TilePool* p, int tiles, TileFunction function, void* context)
+{
+    uint64_t begin, end;
+    int k;
+
+    pthread_mutex_lock(&p->lock);
+
+    p->function = function;
+    p->context = context;
+    atomic_store(&p->steals, 0);
+
+    for (k = 0; k < p->worker_count; k++) {
+        begin = (uint64_t)tiles * k / p->worker_count;
+        end = (uint64_t)tiles * (k + 1) / p->worker_count;
+        atomic_store(&p->runs[k].range, end << 32 | begin);
+    }
+
+    p->busy = p->worker_count - 1;
+    p->generation++;
+    pthread_cond_broadcast(&p->started);
+    pthread_mutex_unlock(&p->lock);
+
+    work(p, 0);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->busy > 0) {
+        pthread_cond_wait(&p->finished, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+void tile_pool_free(TilePool* p)
+{
+    int k;
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = true;
+    pthread_cond_broadcast(&p->started);
+    pthread_mutex_unlock(&p->lock);
+
+    for (k = 1; k < p->worker_count; k++) {
+        pthread_join(p->workers[k].thread, NULL);
+    }
+
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->started);
+    pthread_cond_destroy(&p->finished);
+}
+
+static void* run_worker(void* arg)
+{
+    TileWorker* worker = (TileWorker*)arg;
+    TilePool* p = worker->pool;
+    long seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->quit && p->generation == seen) {
+            pthread_cond_wait(&p->started, &p->lock);
+        }
+        if (p->quit) {
+            break;
+        }
+        seen = p->generation;
+        pthread_mutex_unlock(&p->lock);
+
+        work(p, worker->index);
+
+        pthread_mutex_lock(&p->lock);
+        if (--p->busy == 0) {
+            pthread_cond_signal(&p->finished);
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+static void work(TilePool* p, int worker)
+{
+    int tile, k, victim;
+
+    while (take_tile(&p->runs[worker], false, &tile)) {
+        p->function(p->context, worker, tile);
+    }
+
+    /* Others in turn, starting from the next worker, so thieves spread out */
+    for (k = 1; k < p->worker_count; k++) {
+        victim = (worker + k) % p->worker_count;
+
+        while (take_tile(&p->runs[victim], true, &tile)) {
+            atomic_fetch_add(&p->steals, 1);
+            p->function(p->context, worker, tile);
+        }
+    }
+}
+
+static bool take_tile(TileRun* run, bool steal, int* tile)
+{
+    uint64_t range = atomic_load(&run->range), next;
+    uint32_t begin, end;
+
+    do {
+        begin = (uint32_t)range;
+        end = (uint32_t)(range >> 32);
+        if (begin >= end) {
+            return false;
+        }
+
+        next = steal ? (uint64_t)(end - 1) << 32 | begin : (uint64_t)end << 32 | (begin + 1);
+    } while (!atomic_compare_exchange_weak(&run->range, &range, next));
+
+    *tile = steal ? (int)end - 1 : (int)begin;
+    return true;
+}
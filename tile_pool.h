@@ -0,0 +1,66 @@
+#ifndef TILE_POOL_H
+#define TILE_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* Pool of worker threads that process tiles of a job in parallel, the calling
+ * thread being worker 0. Every worker starts with an equal run of consecutive
+ * tiles and takes them from its front. A worker that is done steals tiles from
+ * the back of other runs, so a worker with costly tiles is helped out instead of
+ * holding up the job. A run is a single atomic word (its begin and end), so
+ * neither taking nor stealing a tile locks anything */
+
+#define TILE_POOL_MAX_WORKERS 16
+
+/* Size of a cache line: runs of different workers are kept apart */
+#define TILE_POOL_LINE 64
+
+/* Processes tile of the current job on the given worker */
+typedef void (*TileFunction)(void* context, int worker, int tile);
+
+/* Tiles [begin, end) of a worker not taken yet, as end << 32 | begin */
+typedef struct tile_run {
+    _Atomic uint64_t range;
+    char padding[TILE_POOL_LINE - sizeof(uint64_t)];
+}   TileRun;
+
+/* Thread of a worker other than the calling one */
+typedef struct tile_worker {
+    struct tile_pool* pool;
+    int index;
+    pthread_t thread;
+}   TileWorker;
+
+typedef struct tile_pool {
+    int worker_count;
+    TileWorker workers[TILE_POOL_MAX_WORKERS];
+    TileRun runs[TILE_POOL_MAX_WORKERS];
+
+    /* Current job. Workers start on it when generation changes, and the calling
+     * thread waits until busy (workers still at it) drops to zero */
+    TileFunction function;
+    void* context;
+    long generation;
+    int busy;
+    bool quit;
+    pthread_mutex_t lock;
+    pthread_cond_t started, finished;
+
+    /* Tiles stolen from other workers in the last job */
+    atomic_int steals;
+}   TilePool;
+
+/* Starts pool with worker_count workers, or one per processor if it's 0 */
+void tile_pool_init(TilePool* p, int worker_count);
+
+/* Calls function for tiles 0 to tiles - 1 spread over the workers, and returns
+ * once all of them are done */
+void tile_pool_run(TilePool* p, int tiles, TileFunction function, void* context);
+
+/* Stops the workers */
+void tile_pool_free(TilePool* p);
+
+#endif
@@ -0,0 +1,341 @@
+#include "world_mesh.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Faces the mesher generates. Bottom faces are never generated since the
+ * underside of the map can't be seen from the playing field */
+enum face {
+    FACE_TOP,
+    FACE_POS_X,
+    FACE_NEG_X,
+    FACE_POS_Z,
+    FACE_NEG_Z
+};
+
+/* Mesher state shared by the passes. Only columns inside the window
+ * [i0, i1) x [j0, j1) are meshed, but the whole grid is used to find hidden faces */
+typedef struct mesher {
+    Mesh* meshes;
+    const int* top;
+    const unsigned char* floor_material;
+    int rows, cols;
+    int i0, j0, i1, j1;
+    int levels;
+    float size;
+    enum face face;
+}   Mesher;
+
+/* Meshes all columns inside the mesher window */
+static void mesh_window(Mesher* g, int* mask);
+
+/* Returns material of cube (i, j, level) or -1 if there is no cube there */
+static int material_at(const Mesher* g, int i, int j, int level);
+
+/* Returns z coordinate of the boundary in front of row i */
+static float row_edge(const Mesher* g, int i);
+
+/* Emits quad merged from mask rectangle [a0, a1) x [b0, b1) of the given slice */
+static void emit_face(Mesher* g, int key, int slice, int a0, int b0, int a1, int b1);
+
+/* Greedily merges equal non-negative values of w x h mask into rectangles
+ * and emits them. Mask is cleared in the process. */
+static void greedy_merge(Mesher* g, int* mask, int w, int h, int slice);
+
+/* Builds face mask for one slice of side faces and merges it */
+static void side_faces(Mesher* g, int* mask, enum face face, int slice);
+
+void world_build(World* w, const int* top, const unsigned char* floor_material,
+                 int rows, int cols, float cube_size)
+{
+    Mesher g;
+    int* mask = NULL;
+    int ci, cj, i, j, k, levels;
+
+    g.meshes = w->meshes;
+    g.top = top;
+    g.floor_material = floor_material;
+    g.rows = rows;
+    g.cols = cols;
+    g.size = cube_size;
+
+    for (k = 0; k < WORLD_MATERIAL_COUNT; k++) {
+        mesh_init(&w->meshes[k]);
+    }
+
+    w->chunk_rows = (rows + WORLD_CHUNK_SIZE - 1) / WORLD_CHUNK_SIZE;
+    w->chunk_cols = (cols + WORLD_CHUNK_SIZE - 1) / WORLD_CHUNK_SIZE;
+    w->chunks = (WorldChunk*)malloc(w->chunk_rows * w->chunk_cols * sizeof(WorldChunk));
+
+    /* Highest column decides the mask size: chunk top faces or any side face slice */
+    levels = 1;
+    for (i = 0; i < rows * cols; i++) {
+        if (top[i] + 1 > levels) {
+            levels = top[i] + 1;
+        }
+    }
+    mask = (int*)malloc(WORLD_CHUNK_SIZE * (levels > WORLD_CHUNK_SIZE ? levels : WORLD_CHUNK_SIZE)
+                        * sizeof(int));
+
+    if (w->chunks == NULL || mask == NULL) {
+        fprintf(stderr, "Allocating memory for world chunks failed.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (ci = 0; ci < w->chunk_rows; ci++) {
+        for (cj = 0; cj < w->chunk_cols; cj++) {
+            WorldChunk* chunk = world_chunk(w, ci, cj);
+
+            chunk->i0 = g.i0 = ci * WORLD_CHUNK_SIZE;
+            chunk->j0 = g.j0 = cj * WORLD_CHUNK_SIZE;
+            chunk->i1 = g.i1 = g.i0 + WORLD_CHUNK_SIZE < rows ? g.i0 + WORLD_CHUNK_SIZE : rows;
+            chunk->j1 = g.j1 = g.j0 + WORLD_CHUNK_SIZE < cols ? g.j0 + WORLD_CHUNK_SIZE : cols;
+
+            /* Chunk's highest column */
+            g.levels = 1;
+            for (i = g.i0; i < g.i1; i++) {
+                for (j = g.j0; j < g.j1; j++) {
+                    if (top[i * cols + j] + 1 > g.levels) {
+                        g.levels = top[i * cols + j] + 1;
+                    }
+                }
+            }
+
+            /* Bounding box from the floor slab bottom to the highest wall top */
+            chunk->min[0] = (g.j0 - 0.5) * cube_size;
+            chunk->max[0] = (g.j1 - 0.5) * cube_size;
+            chunk->min[1] = -0.5 * cube_size;
+            chunk->max[1] = (g.levels - 0.5) * cube_size;
+            chunk->min[2] = row_edge(&g, g.i0);
+            chunk->max[2] = row_edge(&g, g.i1);
+
+            /* Chunk geometry is a contiguous range in every material mesh */
+            for (k = 0; k < WORLD_MATERIAL_COUNT; k++) {
+                chunk->first[k] = w->meshes[k].vertex_count;
+            }
+
+            mesh_window(&g, mask);
+
+            for (k = 0; k < WORLD_MATERIAL_COUNT; k++) {
+                chunk->count[k] = w->meshes[k].vertex_count - chunk->first[k];
+            }
+        }
+    }
+
+    free(mask);
+
+    /* Moving everything to the GPU */
+    for (k = 0; k < WORLD_MATERIAL_COUNT; k++) {
+        mesh_upload(&w->meshes[k]);
+    }
+}
+
+WorldChunk* world_chunk(const World* w, int ci, int cj)
+{
+    return &w->chunks[ci * w->chunk_cols + cj];
+}
+
+void world_free(World* w)
+{
+    int k;
+
+    for (k = 0; k < WORLD_MATERIAL_COUNT; k++) {
+        mesh_free(&w->meshes[k]);
+    }
+
+    free(w->chunks);
+    w->chunks = NULL;
+    w->chunk_rows = w->chunk_cols = 0;
+}
+
+static void mesh_window(Mesher* g, int* mask)
+{
+    int i, j;
+    int w = g->j1 - g->j0;
+
+    /* Top faces: only the highest cube of every column is seen from above.
+     * Faces at different heights are in different planes and get different keys */
+    g->face = FACE_TOP;
+    for (i = g->i0; i < g->i1; i++) {
+        for (j = g->j0; j < g->j1; j++) {
+            int level = g->top[i * g->cols + j];
+            mask[(i - g->i0) * w + j - g->j0] = level * WORLD_MATERIAL_COUNT
+                                              + material_at(g, i, j, level);
+        }
+    }
+    greedy_merge(g, mask, w, g->i1 - g->i0, 0);
+
+    /* Side faces: one slice per column boundary in x and per row boundary in z */
+    for (j = g->j0; j < g->j1; j++) {
+        side_faces(g, mask, FACE_POS_X, j);
+        side_faces(g, mask, FACE_NEG_X, j);
+    }
+    for (i = g->i0; i < g->i1; i++) {
+        side_faces(g, mask, FACE_POS_Z, i);
+        side_faces(g, mask, FACE_NEG_Z, i);
+    }
+}
+
+static int material_at(const Mesher* g, int i, int j, int level)
+{
+    int c;
+
+    /* Outside the map everything is empty */
+    if (i < 0 || i >= g->rows || j < 0 || j >= g->cols) {
+        return -1;
+    }
+
+    c = i * g->cols + j;
+    if (level > g->top[c]) {
+        return -1;
+    }
+
+    return level == 0 ? g->floor_material[c] : WORLD_WALL;
+}
+
+static float row_edge(const Mesher* g, int i)
+{
+    return (i - g->rows + 0.5) * g->size;
+}
+
+static void side_faces(Mesher* g, int* mask, enum face face, int slice)
+{
+    int i, j, level, m;
+
+    g->face = face;
+
+    if (face == FACE_POS_X || face == FACE_NEG_X) {
+        /* Slice is column j, mask is levels x window rows */
+        int dj = face == FACE_POS_X ? 1 : -1;
+
+        j = slice;
+        for (i = g->i0; i < g->i1; i++) {
+            for (level = 0; level < g->levels; level++) {
+                m = material_at(g, i, j, level);
+                if (m >= 0 && material_at(g, i, j + dj, level) >= 0) {
+                    m = -1;
+                }
+                mask[(i - g->i0) * g->levels + level] = m;
+            }
+        }
+        greedy_merge(g, mask, g->levels, g->i1 - g->i0, slice);
+    } else {
+        /* Slice is row i, mask is window columns x levels */
+        int di = face == FACE_POS_Z ? 1 : -1;
+        int w = g->j1 - g->j0;
+
+        i = slice;
+        for (level = 0; level < g->levels; level++) {
+            for (j = g->j0; j < g->j1; j++) {
+                m = material_at(g, i, j, level);
+                if (m >= 0 && material_at(g, i + di, j, level) >= 0) {
+                    m = -1;
+                }
+                mask[level * w + j - g->j0] = m;
+            }
+        }
+        greedy_merge(g, mask, w, g->levels, slice);
+    }
+}
+
+static void greedy_merge(Mesher* g, int* mask, int w, int h, int slice)
+{
+    int x, y, k, rw, rh;
+
+    for (y = 0; y < h; y++) {
+        for (x = 0; x < w; ) {
+            int key = mask[y * w + x];
+
+            if (key < 0) {
+                x++;
+                continue;
+            }
+
+            /* Growing rectangle width */
+            for (rw = 1; x + rw < w && mask[y * w + x + rw] == key; rw++)
+                ;
+
+            /* Growing rectangle height while the whole next line matches */
+            for (rh = 1; y + rh < h; rh++) {
+                for (k = 0; k < rw && mask[(y + rh) * w + x + k] == key; k++)
+                    ;
+                if (k < rw) {
+                    break;
+                }
+            }
+
+            /* Clearing merged part of the mask */
+            for (k = 0; k < rh; k++) {
+                int l;
+                for (l = 0; l < rw; l++) {
+                    mask[(y + k) * w + x + l] = -1;
+                }
+            }
+
+            emit_face(g, key, slice, x, y, x + rw, y + rh);
+            x += rw;
+        }
+    }
+}
+
+static void emit_face(Mesher* g, int key, int slice, int a0, int b0, int a1, int b1)
+{
+    float s = g->size;
+    float x, y, z, x0, x1, y0, y1, z0, z1;
+
+    switch (g->face) {
+        case FACE_TOP:
+            /* a - window columns, b - window rows, key holds level and material */
+            y = (key / WORLD_MATERIAL_COUNT + 0.5) * s;
+            x0 = (g->j0 + a0 - 0.5) * s;
+            x1 = (g->j0 + a1 - 0.5) * s;
+            z0 = row_edge(g, g->i0 + b0);
+            z1 = row_edge(g, g->i0 + b1);
+
+            mesh_add_quad(&g->meshes[key % WORLD_MATERIAL_COUNT], (float[]){0, 1, 0},
+                    (float[]){x0, y, z0}, (float[]){x0, y, z1},
+                    (float[]){x1, y, z1}, (float[]){x1, y, z0});
+            break;
+
+        case FACE_POS_X:
+        case FACE_NEG_X:
+            /* a - levels, b - window rows */
+            y0 = (a0 - 0.5) * s;
+            y1 = (a1 - 0.5) * s;
+            z0 = row_edge(g, g->i0 + b0);
+            z1 = row_edge(g, g->i0 + b1);
+
+            if (g->face == FACE_POS_X) {
+                x = (slice + 0.5) * s;
+                mesh_add_quad(&g->meshes[key], (float[]){1, 0, 0},
+                        (float[]){x, y0, z0}, (float[]){x, y1, z0},
+                        (float[]){x, y1, z1}, (float[]){x, y0, z1});
+            } else {
+                x = (slice - 0.5) * s;
+                mesh_add_quad(&g->meshes[key], (float[]){-1, 0, 0},
+                        (float[]){x, y0, z0}, (float[]){x, y0, z1},
+                        (float[]){x, y1, z1}, (float[]){x, y1, z0});
+            }
+            break;
+
+        case FACE_POS_Z:
+        case FACE_NEG_Z:
+            /* a - window columns, b - levels */
+            x0 = (g->j0 + a0 - 0.5) * s;
+            x1 = (g->j0 + a1 - 0.5) * s;
+            y0 = (b0 - 0.5) * s;
+            y1 = (b1 - 0.5) * s;
+
+            if (g->face == FACE_POS_Z) {
+                z = row_edge(g, slice + 1);
+                mesh_add_quad(&g->meshes[key], (float[]){0, 0, 1},
+                        (float[]){x0, y0, z}, (float[]){x1, y0, z},
+                        (float[]){x1, y1, z}, (float[]){x0, y1, z});
+            } else {
+                z = row_edge(g, slice);
+                mesh_add_quad(&g->meshes[key], (float[]){0, 0, -1},
+                        (float[]){x0, y0, z}, (float[]){x0, y1, z},
+                        (float[]){x1, y1, z}, (float[]){x1, y0, z});
+            }
+            break;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef WORLD_MESH_H
+#define WORLD_MESH_H
+
+#include "mesh.h"
+
+/* Width and height of a world chunk, in cells */
+#define WORLD_CHUNK_SIZE 16
+
+/* Materials of static world geometry */
+enum world_material {
+    WORLD_GRASS,
+    WORLD_WALL,
+    WORLD_LAVA,
+    WORLD_MATERIAL_COUNT
+};
+
+/* Square tile of WORLD_CHUNK_SIZE x WORLD_CHUNK_SIZE cells ([i0, i1) x [j0, j1)).
+ * Its static geometry is a range of vertices in every material mesh of the world */
+typedef struct world_chunk {
+    int i0, j0, i1, j1;
+    float min[3], max[3];
+    GLint first[WORLD_MATERIAL_COUNT];
+    GLsizei count[WORLD_MATERIAL_COUNT];
+}   WorldChunk;
+
+/* Static world: one mesh per material, split into chunks for culling */
+typedef struct world {
+    Mesh meshes[WORLD_MATERIAL_COUNT];
+    WorldChunk* chunks;
+    int chunk_rows, chunk_cols;
+}   World;
+
+/* Builds static world meshes from a grid of solid columns and uploads them.
+ * Column (i, j) is made of the floor cube (level 0) of material
+ * floor_material[i * cols + j] and wall cubes piled on it up to level
+ * top[i * cols + j].
+ * Faces between stacked cubes and between touching columns are dropped, and
+ * coplanar faces of the same material are merged into as few quads as possible
+ * inside every chunk. Cube (i, j, level) is centered in
+ * (j, level, -(rows - 1 - i)) * cube_size, which is the same local frame
+ * create_map() uses; chunk bounding boxes are given in that frame too. */
+void world_build(World* w, const int* top, const unsigned char* floor_material,
+                 int rows, int cols, float cube_size);
+
+/* Returns chunk (ci, cj) of the world */
+WorldChunk* world_chunk(const World* w, int ci, int cj);
+
+/* Releases world meshes and chunks */
+void world_free(World* w);
+
+#endif